@@ -0,0 +1,55 @@
+//! Fixtures shared by the benchmarks.
+#![allow(dead_code)]
+
+use deltachat::config::Config;
+use deltachat::context::Context;
+use deltachat::dc_tools::EmailAddress;
+use deltachat::key::{self, DcKey, SignedPublicKey, SignedSecretKey};
+use tempfile::{tempdir, TempDir};
+
+/// Address of the account created by [create_context].
+pub const ADDR: &str = "alice@example.com";
+
+/// Creates a context configured for [ADDR], without a key.
+///
+/// The returned directory holds the database and must be kept alive while
+/// the context is used.
+pub async fn create_configured_context() -> (TempDir, Context) {
+    let dir = tempdir().unwrap();
+    let dbfile = dir.path().join("db.sqlite");
+    let context = Context::new("FakeOS".into(), dbfile.into(), 100)
+        .await
+        .unwrap();
+
+    context.set_config(Config::Addr, Some(ADDR)).await.unwrap();
+    context
+        .set_config(Config::ConfiguredAddr, Some(ADDR))
+        .await
+        .unwrap();
+    context
+        .set_config(Config::Configured, Some("1"))
+        .await
+        .unwrap();
+
+    (dir, context)
+}
+
+/// Returns the keypair of [ADDR] from the test data.
+pub fn alice_keypair() -> key::KeyPair {
+    key::KeyPair {
+        addr: EmailAddress::new(ADDR).unwrap(),
+        public: SignedPublicKey::from_base64(include_str!("../../test-data/key/alice-public.asc"))
+            .unwrap(),
+        secret: SignedSecretKey::from_base64(include_str!("../../test-data/key/alice-secret.asc"))
+            .unwrap(),
+    }
+}
+
+/// Creates a context configured for [ADDR] with the keypair of [alice_keypair].
+pub async fn create_context() -> (TempDir, Context) {
+    let (dir, context) = create_configured_context().await;
+    key::store_self_keypair(&context, &alice_keypair(), key::KeyPairUse::Default)
+        .await
+        .unwrap();
+    (dir, context)
+}
@@ -25,6 +25,10 @@ async fn address_book_benchmark(n: u32, read_count: u32) {
     }
 }
 
+async fn search_benchmark(context: &Context, query: &str) {
+    Contact::get_all(context, 0, Some(query)).await.unwrap();
+}
+
 fn criterion_benchmark(c: &mut Criterion) {
     c.bench_function("create 500 contacts", |b| {
         b.iter(|| block_on(async { address_book_benchmark(black_box(500), black_box(0)).await }))
@@ -33,6 +37,23 @@ fn criterion_benchmark(c: &mut Criterion) {
     c.bench_function("create 100 contacts and read it 1000 times", |b| {
         b.iter(|| block_on(async { address_book_benchmark(black_box(100), black_box(1000)).await }))
     });
+
+    let dir = tempdir().unwrap();
+    let dbfile = dir.path().join("db.sqlite");
+    let context = block_on(async {
+        let context = Context::new("FakeOS".into(), dbfile.into(), 100)
+            .await
+            .unwrap();
+        let book = (0..20_000)
+            .map(|i| format!("Name {}\naddr{}@example.org\n", i, i))
+            .collect::<Vec<String>>()
+            .join("");
+        Contact::add_address_book(&context, &book).await.unwrap();
+        context
+    });
+    c.bench_function("search 20000 contacts", |b| {
+        b.iter(|| block_on(async { search_benchmark(&context, black_box("e 1234")).await }))
+    });
 }
 
 criterion_group!(benches, criterion_benchmark);
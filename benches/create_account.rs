@@ -1,8 +1,8 @@
 use async_std::path::PathBuf;
 use async_std::task::block_on;
-use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion};
 use deltachat::accounts::Accounts;
-use tempfile::tempdir;
+use tempfile::{tempdir, TempDir};
 
 async fn create_accounts(n: u32) {
     let dir = tempdir().unwrap();
@@ -16,11 +16,36 @@ async fn create_accounts(n: u32) {
     }
 }
 
+/// Creates an accounts folder with `n` accounts, to be opened by the benchmark.
+async fn create_accounts_dir(n: u32) -> (TempDir, PathBuf) {
+    let dir = tempdir().unwrap();
+    let p: PathBuf = dir.path().join("accounts").into();
+
+    let accounts = Accounts::new("my_os".into(), p.clone()).await.unwrap();
+    for _ in 1..n {
+        accounts.add_account().await.unwrap();
+    }
+    (dir, p)
+}
+
 fn criterion_benchmark(c: &mut Criterion) {
     c.bench_function("create 1 account", |b| {
         b.iter(|| block_on(async { create_accounts(black_box(1)).await }))
     });
+
+    let mut group = c.benchmark_group("open accounts");
+    for n in &[1, 10, 50] {
+        let (_dir, p) = block_on(create_accounts_dir(*n));
+        group.bench_with_input(BenchmarkId::from_parameter(n), &p, |b, p| {
+            b.iter(|| block_on(async { Accounts::open(black_box(p.clone())).await.unwrap() }))
+        });
+    }
+    group.finish();
 }
 
-criterion_group!(benches, criterion_benchmark);
+criterion_group! {
+    name = benches;
+    config = Criterion::default().sample_size(10);
+    targets = criterion_benchmark
+}
 criterion_main!(benches);
@@ -0,0 +1,133 @@
+use async_std::task::block_on;
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use deltachat::chat::{self, ChatId, ChatItem};
+use deltachat::chatlist::Chatlist;
+use deltachat::contact::Contact;
+use deltachat::context::Context;
+use deltachat::message::{Message, MsgId};
+use deltachat::sql;
+use tempfile::TempDir;
+
+mod common;
+
+/// Number of chats in the generated database.
+const CHAT_COUNT: usize = 2_000;
+
+/// Number of messages in the generated database.
+const MSG_COUNT: usize = 100_000;
+
+/// Every n-th message goes to the first chat, so there is one chat with many messages.
+const BIG_CHAT_RATIO: usize = 10;
+
+/// Number of messages the UI loads for the visible part of a chat.
+const VISIBLE_MSGS: usize = 50;
+
+/// Creates a database with [CHAT_COUNT] 1:1 chats and [MSG_COUNT] messages.
+///
+/// Returns the context and the ID of the biggest chat.
+async fn create_context() -> (TempDir, Context, ChatId) {
+    let (dir, context) = common::create_configured_context().await;
+
+    let mut chats = Vec::with_capacity(CHAT_COUNT);
+    for i in 0..CHAT_COUNT {
+        let contact_id = Contact::create(
+            &context,
+            &format!("Contact {}", i),
+            &format!("contact{}@example.org", i),
+        )
+        .await
+        .unwrap();
+        let chat_id = ChatId::create_for_contact(&context, contact_id)
+            .await
+            .unwrap();
+        chats.push((chat_id.to_u32(), contact_id));
+    }
+    let big_chat_id = ChatId::new(chats[0].0);
+
+    context
+        .sql()
+        .transaction(move |transaction| {
+            let mut stmt = transaction.prepare(
+                "INSERT INTO msgs \
+                 (rfc724_mid, chat_id, from_id, to_id, timestamp, type, state, txt, txt_raw, param) \
+                 VALUES (?, ?, ?, ?, ?, 10, ?, ?, ?, '');",
+            )?;
+            for i in 0..MSG_COUNT {
+                let (chat_id, contact_id) = if i % BIG_CHAT_RATIO == 0 {
+                    chats[0]
+                } else {
+                    chats[i % CHAT_COUNT]
+                };
+                // Every other message is outgoing.
+                let (from_id, to_id, state) = if i % 2 == 0 {
+                    (1, contact_id, 26) // MessageState::OutDelivered
+                } else {
+                    (contact_id, 1, 13) // MessageState::InSeen
+                };
+                let txt = format!("Message {} with some text to display in the chat.", i);
+                stmt.execute(rusqlite::params![
+                    format!("msg-{}@example.org", i),
+                    chat_id,
+                    from_id,
+                    to_id,
+                    1_600_000_000 + i as i64,
+                    state,
+                    txt,
+                    txt,
+                ])?;
+            }
+            Ok(())
+        })
+        .await
+        .unwrap();
+
+    (dir, context, big_chat_id)
+}
+
+async fn load_chatlist(context: &Context) {
+    let chatlist = Chatlist::try_load(context, 0, None, None).await.unwrap();
+    for i in 0..VISIBLE_MSGS.min(chatlist.len()) {
+        chatlist.get_summary(context, i, None).await.unwrap();
+    }
+}
+
+async fn load_chat(context: &Context, chat_id: ChatId) {
+    let items = chat::get_chat_msgs(context, chat_id, 0, None)
+        .await
+        .unwrap();
+    let msg_ids: Vec<MsgId> = items
+        .iter()
+        .rev()
+        .filter_map(|item| match item {
+            ChatItem::Message { msg_id } => Some(*msg_id),
+            _ => None,
+        })
+        .take(VISIBLE_MSGS)
+        .collect();
+    for msg_id in msg_ids {
+        Message::load_from_db(context, msg_id).await.unwrap();
+    }
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let (_dir, context, big_chat_id) = block_on(create_context());
+
+    let mut group = c.benchmark_group("load");
+    group.bench_function("Chatlist::try_load and summaries", |b| {
+        b.iter(|| block_on(load_chatlist(black_box(&context))))
+    });
+    group.bench_function("get_chat_msgs and Message::load_from_db", |b| {
+        b.iter(|| block_on(load_chat(black_box(&context), black_box(big_chat_id))))
+    });
+    group.bench_function("housekeeping", |b| {
+        b.iter(|| block_on(async { sql::housekeeping(black_box(&context)).await.unwrap() }))
+    });
+    group.finish();
+}
+
+criterion_group! {
+    name = benches;
+    config = Criterion::default().sample_size(10);
+    targets = criterion_benchmark
+}
+criterion_main!(benches);
@@ -0,0 +1,166 @@
+use async_std::task::block_on;
+use criterion::{
+    black_box, criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput,
+};
+use deltachat::context::Context;
+use deltachat::dc_receive_imf::dc_receive_imf;
+use deltachat::key::{DcKey, SignedPublicKey, SignedSecretKey};
+use deltachat::keyring::Keyring;
+use deltachat::mimeparser::MimeMessage;
+use deltachat::pgp;
+
+mod common;
+use common::create_context;
+
+/// Number of messages received in one benchmark iteration.
+const MSG_COUNT: usize = 100;
+
+fn plaintext_msg(i: usize) -> Vec<u8> {
+    format!(
+        "From: Sender {sender} <sender{sender}@example.org>\n\
+         To: alice@example.com\n\
+         Subject: Message {i}\n\
+         Message-ID: <plain-{i}@example.org>\n\
+         Date: Sun, 22 Mar 2020 22:37:57 +0000\n\
+         Chat-Version: 1.0\n\
+         Content-Type: text/plain; charset=utf-8\n\
+         \n\
+         Hello {i}, this is a plaintext benchmark message.\n\
+         \n\
+         > Quoted text\n\
+         -- \n\
+         Signature\n",
+        sender = i % 20,
+        i = i
+    )
+    .into_bytes()
+}
+
+async fn encrypted_msgs(count: usize) -> Vec<Vec<u8>> {
+    let alice_public = common::alice_keypair().public;
+    let bob_public =
+        SignedPublicKey::from_base64(include_str!("../test-data/key/bob-public.asc")).unwrap();
+    let bob_secret =
+        SignedSecretKey::from_base64(include_str!("../test-data/key/bob-secret.asc")).unwrap();
+
+    let mut msgs = Vec::with_capacity(count);
+    for i in 0..count {
+        let inner = format!(
+            "Content-Type: text/plain; charset=utf-8\r\n\
+             \r\n\
+             Hello {}, this is an encrypted benchmark message.\r\n",
+            i
+        );
+        let mut keyring = Keyring::new();
+        keyring.add(alice_public.clone());
+        keyring.add(bob_public.clone());
+        let encrypted = pgp::pk_encrypt(inner.as_bytes(), keyring, Some(bob_secret.clone()))
+            .await
+            .unwrap();
+        let msg = format!(
+            "From: Bob <bob@example.net>\r\n\
+             To: alice@example.com\r\n\
+             Subject: ...\r\n\
+             Message-ID: <encrypted-{i}@example.net>\r\n\
+             Date: Sun, 22 Mar 2020 22:37:57 +0000\r\n\
+             Chat-Version: 1.0\r\n\
+             Autocrypt: addr=bob@example.net; prefer-encrypt=mutual; keydata={keydata}\r\n\
+             MIME-Version: 1.0\r\n\
+             Content-Type: multipart/encrypted; protocol=\"application/pgp-encrypted\";\r\n \
+             boundary=\"bench\"\r\n\
+             \r\n\
+             --bench\r\n\
+             Content-Type: application/pgp-encrypted\r\n\
+             \r\n\
+             Version: 1\r\n\
+             \r\n\
+             --bench\r\n\
+             Content-Type: application/octet-stream; name=\"encrypted.asc\"\r\n\
+             Content-Disposition: inline; filename=\"encrypted.asc\"\r\n\
+             \r\n\
+             {encrypted}\r\n\
+             --bench--\r\n",
+            i = i,
+            keydata = bob_public.to_base64(),
+            encrypted = encrypted
+        );
+        msgs.push(msg.into_bytes());
+    }
+    msgs
+}
+
+async fn receive_msgs(context: &Context, msgs: &[Vec<u8>]) {
+    for (uid, msg) in msgs.iter().enumerate() {
+        dc_receive_imf(context, msg, "INBOX", uid as u32 + 1, false)
+            .await
+            .unwrap();
+    }
+}
+
+/// Returns all messages of the test-data/message corpus.
+fn corpus() -> Vec<(String, Vec<u8>)> {
+    let mut files: Vec<_> = std::fs::read_dir("test-data/message")
+        .unwrap()
+        .map(|entry| entry.unwrap().path())
+        .collect();
+    files.sort();
+    files
+        .into_iter()
+        .map(|path| {
+            let name = path.file_name().unwrap().to_string_lossy().to_string();
+            (name, std::fs::read(path).unwrap())
+        })
+        .collect()
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let plaintext: Vec<_> = (0..MSG_COUNT).map(plaintext_msg).collect();
+    let encrypted = block_on(encrypted_msgs(MSG_COUNT));
+
+    let mut group = c.benchmark_group("receive");
+    group.throughput(Throughput::Elements(MSG_COUNT as u64));
+    for (name, msgs) in &[("plaintext", &plaintext), ("encrypted", &encrypted)] {
+        group.bench_with_input(BenchmarkId::new("dc_receive_imf", name), msgs, |b, msgs| {
+            b.iter_batched(
+                || block_on(create_context()),
+                |(_dir, context)| block_on(receive_msgs(&context, black_box(msgs))),
+                BatchSize::PerIteration,
+            )
+        });
+    }
+    group.finish();
+
+    let (_dir, context) = block_on(create_context());
+    let corpus = corpus();
+    let mut group = c.benchmark_group("parse");
+    group.throughput(Throughput::Elements(corpus.len() as u64));
+    group.bench_function("MimeMessage::from_bytes corpus", |b| {
+        b.iter(|| {
+            block_on(async {
+                for (_name, bytes) in &corpus {
+                    // Some messages of the corpus are broken on purpose.
+                    MimeMessage::from_bytes(&context, black_box(bytes))
+                        .await
+                        .ok();
+                }
+            })
+        })
+    });
+    group.bench_function("MimeMessage::from_bytes encrypted", |b| {
+        b.iter(|| {
+            block_on(async {
+                MimeMessage::from_bytes(&context, black_box(&encrypted[0]))
+                    .await
+                    .unwrap()
+            })
+        })
+    });
+    group.finish();
+}
+
+criterion_group! {
+    name = benches;
+    config = Criterion::default().sample_size(10);
+    targets = criterion_benchmark
+}
+criterion_main!(benches);
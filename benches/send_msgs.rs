@@ -0,0 +1,98 @@
+use async_std::task::block_on;
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion};
+use deltachat::chat::{self, ChatId, ProtectionStatus};
+use deltachat::contact::Contact;
+use deltachat::context::Context;
+use deltachat::dc_receive_imf::dc_receive_imf;
+use deltachat::key::{DcKey, SignedPublicKey};
+
+mod common;
+use common::create_context;
+
+/// Group members and their public keys.
+const MEMBERS: &[(&str, &str)] = &[
+    (
+        "bob@example.net",
+        include_str!("../test-data/key/bob-public.asc"),
+    ),
+    (
+        "charlie@example.net",
+        include_str!("../test-data/key/charlie-public.asc"),
+    ),
+    (
+        "dom@example.net",
+        include_str!("../test-data/key/dom-public.asc"),
+    ),
+    (
+        "elena@example.net",
+        include_str!("../test-data/key/elena-public.asc"),
+    ),
+    (
+        "fiona@example.net",
+        include_str!("../test-data/key/fiona-public.asc"),
+    ),
+];
+
+/// Creates a group with all [MEMBERS].
+///
+/// If `encrypted` is set, a message with an Autocrypt header is received from
+/// every member first, so messages to the group are encrypted.
+async fn create_group(context: &Context, encrypted: bool) -> ChatId {
+    let chat_id = chat::create_group_chat(context, ProtectionStatus::Unprotected, "Group")
+        .await
+        .unwrap();
+    for (uid, (addr, public_key)) in MEMBERS.iter().enumerate() {
+        if encrypted {
+            let public_key = SignedPublicKey::from_base64(public_key).unwrap();
+            let msg = format!(
+                "From: {addr}\n\
+                 To: alice@example.com\n\
+                 Subject: Hi\n\
+                 Message-ID: <autocrypt-{uid}@example.net>\n\
+                 Date: Sun, 22 Mar 2020 22:37:57 +0000\n\
+                 Chat-Version: 1.0\n\
+                 Autocrypt: addr={addr}; prefer-encrypt=mutual; keydata={keydata}\n\
+                 Content-Type: text/plain; charset=utf-8\n\
+                 \n\
+                 Hi!\n",
+                addr = addr,
+                uid = uid,
+                keydata = public_key.to_base64()
+            );
+            dc_receive_imf(context, msg.as_bytes(), "INBOX", uid as u32 + 1, false)
+                .await
+                .unwrap();
+        }
+        let contact_id = Contact::create(context, "", addr).await.unwrap();
+        chat::add_contact_to_chat(context, chat_id, contact_id).await;
+    }
+    chat_id
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("send");
+    for encrypted in &[false, true] {
+        let (_dir, context) = block_on(create_context());
+        let chat_id = block_on(create_group(&context, *encrypted));
+        let name = if *encrypted { "encrypted" } else { "plaintext" };
+        // Sending renders the message and encrypts it if possible,
+        // the SMTP job is not run as IO is not started.
+        group.bench_function(BenchmarkId::new("send_text_msg to group", name), |b| {
+            b.iter(|| {
+                block_on(async {
+                    chat::send_text_msg(&context, chat_id, black_box("Hello group!".to_string()))
+                        .await
+                        .unwrap()
+                })
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group! {
+    name = benches;
+    config = Criterion::default().sample_size(10);
+    targets = criterion_benchmark
+}
+criterion_main!(benches);
@@ -0,0 +1,111 @@
+use criterion::{black_box, criterion_group, criterion_main, Criterion, Throughput};
+use deltachat::dehtml::dehtml;
+use deltachat::simplify::simplify;
+
+/// Returns a long plain-text mail with a forward header, quotes and a signature.
+fn plain_text() -> String {
+    let mut text =
+        String::from("---------- Forwarded message ----------\nFrom: bob@example.net\n\n");
+    for i in 0..500 {
+        text += &format!("Line {} of the message, with some words to process.\r\n", i);
+        if i % 50 == 0 {
+            text += "\r\n> quoted line\r\n> another quoted line\r\n\r\n";
+        }
+    }
+    text += "\r\n-- \r\nBob\r\nSent from my phone\r\n";
+    text
+}
+
+/// Returns an HTML mail, similar to the ones sent by webmailers and newsletters.
+fn html() -> String {
+    let mut html = String::from(
+        "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><style>p { margin: 0 }</style>\
+         <title>Newsletter</title></head><body>",
+    );
+    for i in 0..500 {
+        html += &format!(
+            "<div class=\"para\"><p>Paragraph {} with <b>bold</b>, <i>italic</i> and \
+             <a href=\"https://example.org/{}\">a link</a> &amp; some &quot;entities&quot;.</p>\
+             <br></div>",
+            i, i
+        );
+        if i % 50 == 0 {
+            html += "<blockquote><p>Quoted paragraph</p></blockquote>";
+        }
+    }
+    html += "</body></html>";
+    html
+}
+
+/// Returns the bodies of the test-data/message corpus, split into plain-text and HTML ones.
+///
+/// The headers are cut off, the bodies are not decoded.
+fn corpus() -> (Vec<String>, Vec<String>) {
+    let mut files: Vec<_> = std::fs::read_dir("test-data/message")
+        .unwrap()
+        .map(|entry| entry.unwrap().path())
+        .collect();
+    files.sort();
+    let mut plain = Vec::new();
+    let mut html = Vec::new();
+    for path in files {
+        let msg = String::from_utf8_lossy(&std::fs::read(path).unwrap()).to_string();
+        let body = match msg.find("\n\n").or_else(|| msg.find("\r\n\r\n")) {
+            Some(pos) => msg[pos..].to_string(),
+            None => msg,
+        };
+        if body.contains("<html") || body.contains("<HTML") {
+            html.push(body);
+        } else {
+            plain.push(body);
+        }
+    }
+    (plain, html)
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let plain_text = plain_text();
+    let html = html();
+    let (corpus_plain, corpus_html) = corpus();
+
+    let mut group = c.benchmark_group("simplify");
+    group.throughput(Throughput::Bytes(plain_text.len() as u64));
+    group.bench_function("simplify", |b| {
+        b.iter(|| simplify(black_box(plain_text.clone()), false))
+    });
+    group.finish();
+
+    let mut group = c.benchmark_group("simplify corpus");
+    group.throughput(Throughput::Bytes(
+        corpus_plain.iter().map(|text| text.len() as u64).sum(),
+    ));
+    group.bench_function("simplify", |b| {
+        b.iter(|| {
+            for text in &corpus_plain {
+                simplify(black_box(text.clone()), false);
+            }
+        })
+    });
+    group.finish();
+
+    let mut group = c.benchmark_group("dehtml");
+    group.throughput(Throughput::Bytes(html.len() as u64));
+    group.bench_function("dehtml", |b| b.iter(|| dehtml(black_box(&html))));
+    group.finish();
+
+    let mut group = c.benchmark_group("dehtml corpus");
+    group.throughput(Throughput::Bytes(
+        corpus_html.iter().map(|html| html.len() as u64).sum(),
+    ));
+    group.bench_function("dehtml", |b| {
+        b.iter(|| {
+            for html in &corpus_html {
+                dehtml(black_box(html));
+            }
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
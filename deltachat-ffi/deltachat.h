@@ -245,6 +245,22 @@ uint32_t        dc_get_id                    (dc_context_t* context);
 dc_event_emitter_t* dc_get_event_emitter(dc_context_t* context);
 
 
+/**
+ * Set the events that should not be emitted at all.
+ *
+ * If the UI does not handle some events, e.g. @ref DC_EVENT_INFO in release builds,
+ * ignoring them saves queueing them and waking up the event thread.
+ *
+ * @memberof dc_context_t
+ * @param context The context object.
+ * @param event_ids Array of the IDs of the events to ignore, e.g. @ref DC_EVENT_INFO.
+ * @param event_cnt The number of IDs in `event_ids`.
+ *     Each call replaces the previously ignored events,
+ *     pass 0 to get all events again.
+ */
+void dc_set_ignored_events(dc_context_t* context, const int* event_ids, int event_cnt);
+
+
 /**
  * Get the blob directory.
  *
@@ -431,6 +447,41 @@ int             dc_set_config_from_qr   (dc_context_t* context, const char* qr);
 char*           dc_get_info                  (const dc_context_t* context);
 
 
+/**
+ * Enable or disable recording of metrics.
+ *
+ * The metrics contain counters and latency histograms
+ * of fetching, receiving, parsing, decrypting, rendering and sending messages,
+ * of jobs and of database queries.
+ * They are shared by all contexts of the process
+ * and can be retrieved using dc_get_metrics_json().
+ *
+ * Recording is disabled by default.
+ * While it is disabled, the overhead is negligible.
+ * Disabling the recording keeps the metrics recorded so far.
+ *
+ * @param enabled 1=record metrics, 0=stop recording.
+ */
+void            dc_set_metrics_enabled       (int enabled);
+
+
+/**
+ * Get the metrics recorded since dc_set_metrics_enabled() was called.
+ *
+ * The result is a JSON object of the form
+ * `{"enabled":true,"spans":{"sql_read":{"count":3,"total_us":120,"max_us":80,"histogram":[[32,1],[128,2]]},...}}`.
+ * `count` is the number of recorded operations, `total_us` and `max_us` are their
+ * total and maximum duration in microseconds.
+ * A histogram entry `[32,1]` means that one operation took at least 16 and less than 32 microseconds,
+ * the upper bound of the last bucket is `null`.
+ *
+ * The names of the spans and the fields may be extended in future versions.
+ *
+ * @return JSON string which must be released using dc_str_unref() after usage. Never returns NULL.
+ */
+char*           dc_get_metrics_json          (void);
+
+
 /**
  * Get url that can be used to initiate an OAuth2 authorisation.
  *
@@ -668,6 +719,11 @@ int             dc_preconfigure_keypair        (dc_context_t* context, const cha
 #define         DC_GCL_ADD_ALLDONE_HINT      0x04
 #define         DC_GCL_FOR_FORWARDING        0x08
 
+#define         DC_CHATLIST_CHANGE_REMOVED   1
+#define         DC_CHATLIST_CHANGE_INSERTED  2
+#define         DC_CHATLIST_CHANGE_MOVED     3
+#define         DC_CHATLIST_CHANGE_UPDATED   4
+
 
 /**
  * Get a list of chats.
@@ -1347,6 +1403,28 @@ uint32_t dc_get_chat_ephemeral_timer (dc_context_t* context, uint32_t chat_id);
 dc_array_t*     dc_search_msgs               (dc_context_t* context, uint32_t chat_id, const char* query);
 
 
+/**
+ * Search messages containing the given query string, best matches first.
+ *
+ * Works like dc_search_msgs(), but the results are ordered by relevance
+ * and only a part of the results is returned,
+ * so the UI can load more results only when the user scrolls to them.
+ * Relevance ranking requires a query of at least 3 characters,
+ * for shorter queries the newest messages are returned first.
+ *
+ * @memberof dc_context_t
+ * @param context The context object as returned from dc_context_new().
+ * @param chat_id ID of the chat to search messages in.
+ *     Set this to 0 for a global search.
+ * @param query The query to search for.
+ * @param offset Number of best matching results to skip.
+ * @param limit Maximum number of results to return.
+ * @return An array of message IDs. Must be freed using dc_array_unref() when no longer needed.
+ *     If nothing can be found, the function returns NULL.
+ */
+dc_array_t*     dc_search_msgs_ranked        (dc_context_t* context, uint32_t chat_id, const char* query, int offset, int limit);
+
+
 /**
  * Get chat object by a chat ID.
  *
@@ -1678,6 +1756,30 @@ void            dc_marknoticed_contact       (dc_context_t* context, uint32_t co
 void            dc_markseen_msgs             (dc_context_t* context, const uint32_t* msg_ids, int msg_cnt);
 
 
+/**
+ * Load several messages at once, eg. the messages scrolled into view.
+ * All messages are read using a single database query,
+ * which is much faster than calling dc_get_msg() for each message
+ * when a chat view renders many messages.
+ *
+ * The returned array contains a read-only view for each existing message,
+ * in the order of msg_ids; special and unknown message IDs are skipped.
+ * Use dc_array_get_id(), dc_array_get_chat_id(), dc_array_get_contact_id(),
+ * dc_array_get_timestamp(), dc_array_get_state(), dc_array_get_viewtype()
+ * and dc_array_get_text() to access the items.
+ * For all other message properties, use dc_get_msg().
+ *
+ * @memberof dc_context_t
+ * @param context The context object.
+ * @param msg_ids An array of uint32_t containing the message IDs to load.
+ * @param msg_cnt The number of message IDs in msg_ids.
+ * @return Array of message views.
+ *     On errors, NULL is returned.
+ *     When done, the array must be freed using dc_array_unref().
+ */
+dc_array_t*     dc_get_msgs                  (dc_context_t* context, const uint32_t* msg_ids, int msg_cnt);
+
+
 /**
  * Get a single message object of the type dc_msg_t.
  * For a list of messages in a chat, see dc_get_chat_msgs()
@@ -2816,6 +2918,46 @@ uint32_t         dc_array_get_msg_id         (const dc_array_t* array, size_t in
 char*            dc_array_get_marker         (const dc_array_t* array, size_t index);
 
 
+/**
+ * Return the state of the message at the given index.
+ * Works only for arrays returned by dc_get_msgs().
+ *
+ * @memberof dc_array_t
+ * @param array The array object.
+ * @param index Index of the item. Must be between 0 and dc_array_get_cnt()-1.
+ * @return State of the message, one of the DC_STATE_* constants,
+ *     see dc_msg_get_state() for details.
+ */
+int              dc_array_get_state          (const dc_array_t* array, size_t index);
+
+
+/**
+ * Return the view type of the message at the given index.
+ * Works only for arrays returned by dc_get_msgs().
+ *
+ * @memberof dc_array_t
+ * @param array The array object.
+ * @param index Index of the item. Must be between 0 and dc_array_get_cnt()-1.
+ * @return One of the @ref DC_MSG constants,
+ *     see dc_msg_get_viewtype() for details.
+ */
+int              dc_array_get_viewtype       (const dc_array_t* array, size_t index);
+
+
+/**
+ * Return the text of the message at the given index.
+ * Works only for arrays returned by dc_get_msgs().
+ * The text is truncated the same way as by dc_msg_get_text().
+ *
+ * @memberof dc_array_t
+ * @param array The array object.
+ * @param index Index of the item. Must be between 0 and dc_array_get_cnt()-1.
+ * @return Message text, never NULL.
+ *     The returned value must be released using dc_str_unref() after usage.
+ */
+char*            dc_array_get_text           (const dc_array_t* array, size_t index);
+
+
 /**
  * Return the independent-state of the location at the given index.
  * Independent locations do not belong to the track of the user.
@@ -2980,6 +3122,71 @@ dc_lot_t*        dc_chatlist_get_summary     (const dc_chatlist_t* chatlist, siz
 dc_lot_t*        dc_chatlist_get_summary2    (dc_context_t* context, uint32_t chat_id, uint32_t msg_id);
 
 
+/**
+ * Get the chat objects of several chatlist items at once,
+ * eg. of the items scrolled into view.
+ * This is faster than calling dc_get_chat() for each item.
+ *
+ * @memberof dc_chatlist_t
+ * @param chatlist The chatlist object as created e.g. by dc_get_chatlist().
+ * @param index The index of the first item to get the chat for.
+ * @param count The number of items, the size of the `chats` buffer.
+ * @param chats Buffer for `count` chat objects.
+ *     The chat of item `index+i` is written to `chats[i]`, NULL if the chat cannot be loaded.
+ *     Each chat object must be freed using dc_chat_unref() when no longer used.
+ * @return The number of chat objects written to `chats`.
+ *     This is less than `count` if the chatlist has less than `index+count` items.
+ */
+size_t           dc_chatlist_get_chats       (const dc_chatlist_t* chatlist, size_t index, size_t count, dc_chat_t** chats);
+
+
+/**
+ * Get the summaries of several chatlist items at once,
+ * eg. of the items scrolled into view.
+ * This is faster than calling dc_chatlist_get_summary() for each item.
+ *
+ * @memberof dc_chatlist_t
+ * @param chatlist The chatlist object as created e.g. by dc_get_chatlist().
+ * @param index The index of the first item to get the summary for.
+ * @param count The number of items, the size of the `summaries` buffer.
+ * @param summaries Buffer for `count` dc_lot_t objects.
+ *     The summary of item `index+i` is written to `summaries[i]`, see dc_chatlist_get_summary() for details.
+ *     Each summary must be freed using dc_lot_unref().
+ * @return The number of summaries written to `summaries`.
+ *     This is less than `count` if the chatlist has less than `index+count` items.
+ */
+size_t           dc_chatlist_get_summaries   (const dc_chatlist_t* chatlist, size_t index, size_t count, dc_lot_t** summaries);
+
+
+/**
+ * Get the changes from one chatlist to a newer one,
+ * eg. to animate the rows of a list view instead of reloading all of them.
+ *
+ * The changes are returned as records of 4 values each,
+ * use dc_array_get_id() with the indices `4*i` to `4*i+3` to get the values of the change `i`:
+ *
+ * - the kind of the change, one of:
+ *   - DC_CHATLIST_CHANGE_REMOVED: the chat was at the old index and is not in `newer`
+ *   - DC_CHATLIST_CHANGE_INSERTED: the chat is at the new index and was not in `older`
+ *   - DC_CHATLIST_CHANGE_MOVED: the chat moved from the old index to the new index,
+ *     its last message may have changed as well
+ *   - DC_CHATLIST_CHANGE_UPDATED: the chat kept its position, but its last message changed
+ * - the old index, the index in `older`, 0 for DC_CHATLIST_CHANGE_INSERTED and DC_CHATLIST_CHANGE_UPDATED
+ * - the new index, the index in `newer`, 0 for DC_CHATLIST_CHANGE_REMOVED
+ * - the chat ID
+ *
+ * Removals are returned first, ordered by the old index,
+ * followed by the other changes, ordered by the new index.
+ *
+ * @memberof dc_chatlist_t
+ * @param older The chatlist object shown so far.
+ * @param newer The chatlist object to show instead, eg. loaded on DC_EVENT_MSGS_CHANGED.
+ * @return An array of the changes, 4 values per change.
+ *     Must be freed using dc_array_unref() when no longer used.
+ */
+dc_array_t*      dc_chatlist_diff            (const dc_chatlist_t* older, const dc_chatlist_t* newer);
+
+
 /**
  * Helper function to get the associated context object.
  *
@@ -4784,6 +4991,25 @@ int64_t          dc_lot_get_timestamp     (const dc_lot_t* lot);
 dc_event_t* dc_get_next_event(dc_event_emitter_t* emitter);
 
 
+/**
+ * Get up to `max` events from a context event emitter object at once.
+ *
+ * The function waits for the first event like dc_get_next_event()
+ * and then returns it together with the events that are already waiting,
+ * so that bindings have to cross the library boundary only once per batch.
+ *
+ * @memberof dc_event_emitter_t
+ * @param emitter Event emitter object as returned from dc_get_event_emitter().
+ * @param events Array of at least `max` event pointers that is filled with the events.
+ *     Every event stored there must be freed using dc_event_unref().
+ * @param max The maximum number of events to return, must be greater than 0.
+ * @return The number of events stored in `events`.
+ *     If 0 is returned, the context belonging to the event emitter is unref'd and no more events will come;
+ *     in this case, free the event emitter using dc_event_emitter_unref().
+ */
+int dc_get_next_events(dc_event_emitter_t* emitter, dc_event_t** events, int max);
+
+
 /**
  * Free a context event emitter object.
  *
@@ -4817,6 +5043,22 @@ void  dc_event_emitter_unref(dc_event_emitter_t* emitter);
 dc_event_t* dc_accounts_get_next_event (dc_accounts_event_emitter_t* emitter);
 
 
+/**
+ * Get up to `max` events from an accounts event emitter object at once.
+ * This works like dc_get_next_events() for the dc_accounts_t account manager.
+ *
+ * @memberof dc_accounts_event_emitter_t
+ * @param emitter Event emitter object as returned from dc_accounts_get_event_emitter().
+ * @param events Array of at least `max` event pointers that is filled with the events.
+ *     Every event stored there must be freed using dc_event_unref().
+ * @param max The maximum number of events to return, must be greater than 0.
+ * @return The number of events stored in `events`.
+ *     If 0 is returned, the contexts belonging to the event emitter are unref'd and no more events will come;
+ *     in this case, free the event emitter using dc_accounts_event_emitter_unref().
+ */
+int dc_accounts_get_next_events (dc_accounts_event_emitter_t* emitter, dc_event_t** events, int max);
+
+
 /**
  * Free an accounts event emitter object.
  *
@@ -1,7 +1,24 @@
-use crate::chat::ChatItem;
-use crate::constants::{DC_MSG_ID_DAYMARKER, DC_MSG_ID_MARKER1};
+use std::ops::Range;
+
+use crate::chat::{ChatId, ChatItem};
+use crate::constants::{Viewtype, DC_MSG_ID_DAYMARKER, DC_MSG_ID_MARKER1};
 use crate::location::Location;
-use crate::message::MsgId;
+use crate::message::{Message, MessageState, MsgId};
+
+/// Read-only view of a message stored in a [`dc_array_t::Msgs`] array.
+///
+/// The text is not owned by the view but points into the text buffer shared
+/// by all views of the array.
+#[derive(Debug, Clone)]
+pub struct MsgView {
+    pub id: MsgId,
+    pub chat_id: ChatId,
+    pub from_id: u32,
+    pub timestamp: i64,
+    pub state: MessageState,
+    pub viewtype: Viewtype,
+    text: Range<usize>,
+}
 
 /* * the structure behind dc_array_t */
 #[derive(Debug, Clone)]
@@ -10,6 +27,7 @@ pub enum dc_array_t {
     Chat(Vec<ChatItem>),
     Locations(Vec<Location>),
     Uint(Vec<u32>),
+    Msgs { views: Vec<MsgView>, text: String },
 }
 
 impl dc_array_t {
@@ -23,6 +41,7 @@ pub(crate) fn get_id(&self, index: usize) -> u32 {
             },
             Self::Locations(array) => array[index].location_id,
             Self::Uint(array) => array[index],
+            Self::Msgs { views, .. } => views[index].id.to_u32(),
         }
     }
 
@@ -36,6 +55,7 @@ pub(crate) fn get_timestamp(&self, index: usize) -> Option<i64> {
             }),
             Self::Locations(array) => array.get(index).map(|location| location.timestamp),
             Self::Uint(_) => None,
+            Self::Msgs { views, .. } => views.get(index).map(|view| view.timestamp),
         }
     }
 
@@ -47,6 +67,7 @@ pub(crate) fn get_marker(&self, index: usize) -> Option<&str> {
                 .get(index)
                 .and_then(|location| location.marker.as_deref()),
             Self::Uint(_) => None,
+            Self::Msgs { .. } => None,
         }
     }
 
@@ -58,6 +79,24 @@ pub(crate) fn get_location(&self, index: usize) -> &Location {
         }
     }
 
+    pub(crate) fn get_msg_view(&self, index: usize) -> &MsgView {
+        if let Self::Msgs { views, .. } = self {
+            &views[index]
+        } else {
+            panic!("Not an array of messages")
+        }
+    }
+
+    /// Returns the text of the message at the given index
+    /// without copying it out of the shared buffer.
+    pub(crate) fn get_msg_text(&self, index: usize) -> &str {
+        if let Self::Msgs { views, text } = self {
+            &text[views[index].text.clone()]
+        } else {
+            panic!("Not an array of messages")
+        }
+    }
+
     /// Returns the number of elements in the array.
     pub(crate) fn len(&self) -> usize {
         match self {
@@ -65,6 +104,7 @@ pub(crate) fn len(&self) -> usize {
             Self::Chat(array) => array.len(),
             Self::Locations(array) => array.len(),
             Self::Uint(array) => array.len(),
+            Self::Msgs { views, .. } => views.len(),
         }
     }
 
@@ -97,6 +137,30 @@ fn from(array: Vec<Location>) -> Self {
     }
 }
 
+impl From<Vec<Message>> for dc_array_t {
+    fn from(msgs: Vec<Message>) -> Self {
+        let mut views = Vec::with_capacity(msgs.len());
+        let mut text = String::new();
+        for msg in msgs {
+            let start = text.len();
+            if let Some(msg_text) = msg.get_text() {
+                text.push_str(&msg_text);
+            }
+            views.push(MsgView {
+                id: msg.get_id(),
+                chat_id: msg.get_chat_id(),
+                from_id: msg.get_from_id(),
+                timestamp: msg.get_timestamp(),
+                state: msg.get_state(),
+                viewtype: msg.get_viewtype(),
+                text: start..text.len(),
+            });
+        }
+        text.shrink_to_fit();
+        dc_array_t::Msgs { views, text }
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -119,6 +183,23 @@ fn test_dc_array() {
         assert_eq!(arr.search_id(1), None);
     }
 
+    #[test]
+    fn test_dc_array_msgs() {
+        let mut msgs = Vec::new();
+        for text in &["hello", "", "world"] {
+            let mut msg = Message::new(Viewtype::Text);
+            msg.set_text(Some(text.to_string()));
+            msgs.push(msg);
+        }
+        let arr: dc_array_t = msgs.into();
+
+        assert_eq!(arr.len(), 3);
+        assert_eq!(arr.get_msg_text(0), "hello");
+        assert_eq!(arr.get_msg_text(1), "");
+        assert_eq!(arr.get_msg_text(2), "world");
+        assert_eq!(arr.get_msg_view(2).viewtype, Viewtype::Text);
+    }
+
     #[test]
     #[should_panic]
     fn test_dc_array_out_of_bounds() {
@@ -40,7 +40,7 @@
 
 mod string;
 use self::string::*;
-use deltachat::chatlist::Chatlist;
+use deltachat::chatlist::{Chatlist, ChatlistChange};
 
 // as C lacks a good and portable error handling,
 // in general, the C Interface is forgiving wrt to bad parameters.
@@ -245,6 +245,16 @@
     })
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn dc_set_metrics_enabled(enabled: libc::c_int) {
+    deltachat::metrics::set_enabled(enabled != 0);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_get_metrics_json() -> *mut libc::c_char {
+    deltachat::metrics::snapshot_json().strdup()
+}
+
 fn render_info(
     info: BTreeMap<&'static str, String>,
 ) -> std::result::Result<String, std::fmt::Error> {
@@ -563,6 +573,55 @@ fn render_info(
         .unwrap_or_else(ptr::null_mut)
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn dc_get_next_events(
+    events: *mut dc_event_emitter_t,
+    out: *mut *mut dc_event_t,
+    max: libc::c_int,
+) -> libc::c_int {
+    if events.is_null() || out.is_null() || max <= 0 {
+        eprintln!("ignoring careless call to dc_get_next_events()");
+        return 0;
+    }
+    let events = &*events;
+
+    store_events(events.recv_batch_sync(max as usize), out, max)
+}
+
+/// Moves `events` to the caller-provided array `out` of size `max`
+/// and returns the number of stored events.
+unsafe fn store_events(
+    events: Vec<Event>,
+    out: *mut *mut dc_event_t,
+    max: libc::c_int,
+) -> libc::c_int {
+    let out = std::slice::from_raw_parts_mut(out, max as usize);
+    let mut cnt = 0;
+    for (slot, event) in out.iter_mut().zip(events) {
+        *slot = Box::into_raw(Box::new(event));
+        cnt += 1;
+    }
+    cnt
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_set_ignored_events(
+    context: *mut dc_context_t,
+    event_ids: *const libc::c_int,
+    event_cnt: libc::c_int,
+) {
+    if context.is_null() || (event_ids.is_null() && event_cnt > 0) {
+        eprintln!("ignoring careless call to dc_set_ignored_events()");
+        return;
+    }
+    let ctx = &*context;
+    if event_cnt <= 0 {
+        ctx.set_ignored_events(&[]);
+    } else {
+        ctx.set_ignored_events(std::slice::from_raw_parts(event_ids, event_cnt as usize));
+    }
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn dc_stop_io(context: *mut dc_context_t) {
     if context.is_null() {
@@ -1231,6 +1290,43 @@ fn from_prim<S, T>(s: S) -> Option<T>
     })
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn dc_search_msgs_ranked(
+    context: *mut dc_context_t,
+    chat_id: u32,
+    query: *const libc::c_char,
+    offset: libc::c_int,
+    limit: libc::c_int,
+) -> *mut dc_array::dc_array_t {
+    if context.is_null() || query.is_null() || offset < 0 || limit < 0 {
+        eprintln!("ignoring careless call to dc_search_msgs_ranked()");
+        return ptr::null_mut();
+    }
+    let ctx = &*context;
+    let chat_id = if chat_id == 0 {
+        None
+    } else {
+        Some(ChatId::new(chat_id))
+    };
+
+    block_on(async move {
+        let arr = dc_array_t::from(
+            ctx.search_msgs_ranked(
+                chat_id,
+                &to_string_lossy(query),
+                offset as usize,
+                limit as usize,
+            )
+            .await
+            .unwrap_or_log_default(ctx, "Failed search_msgs_ranked")
+            .iter()
+            .map(|msg_id| msg_id.to_u32())
+            .collect::<Vec<u32>>(),
+        );
+        Box::into_raw(Box::new(arr))
+    })
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn dc_get_chat(context: *mut dc_context_t, chat_id: u32) -> *mut dc_chat_t {
     if context.is_null() {
@@ -1240,7 +1336,7 @@ fn from_prim<S, T>(s: S) -> Option<T>
     let ctx = &*context;
 
     block_on(async move {
-        match chat::Chat::load_from_db(&ctx, ChatId::new(chat_id)).await {
+        match chat::Chat::load_cached(&ctx, ChatId::new(chat_id)).await {
             Ok(chat) => {
                 let ffi_chat = ChatWrapper { context, chat };
                 Box::into_raw(Box::new(ffi_chat))
@@ -1598,6 +1694,29 @@ fn from_prim<S, T>(s: S) -> Option<T>
         .ok();
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn dc_get_msgs(
+    context: *mut dc_context_t,
+    msg_ids: *const u32,
+    msg_cnt: libc::c_int,
+) -> *mut dc_array::dc_array_t {
+    if context.is_null() || msg_ids.is_null() || msg_cnt <= 0 {
+        eprintln!("ignoring careless call to dc_get_msgs()");
+        return ptr::null_mut();
+    }
+    let ctx = &*context;
+    let msg_ids = convert_and_prune_message_ids(msg_ids, msg_cnt);
+
+    block_on(async move {
+        Box::into_raw(Box::new(
+            message::Message::load_many(&ctx, &msg_ids)
+                .await
+                .unwrap_or_log_default(ctx, "failed to load msgs")
+                .into(),
+        ))
+    })
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn dc_get_msg(context: *mut dc_context_t, msg_id: u32) -> *mut dc_msg_t {
     if context.is_null() {
@@ -1833,7 +1952,7 @@ fn from_prim<S, T>(s: S) -> Option<T>
     let ctx = &*context;
 
     block_on(async move {
-        Contact::get_by_id(&ctx, contact_id)
+        Contact::get_by_id_cached(&ctx, contact_id)
             .await
             .map(|contact| Box::into_raw(Box::new(ContactWrapper { context, contact })))
             .unwrap_or_else(|_| ptr::null_mut())
@@ -2211,7 +2330,13 @@ fn from_prim<S, T>(s: S) -> Option<T>
         eprintln!("ignoring careless call to dc_array_get_chat_id()");
         return 0;
     }
-    (*array).get_location(index).chat_id.to_u32()
+    match &*array {
+        dc_array_t::Msgs { .. } => {
+            let view = (*array).get_msg_view(index);
+            view.chat_id.to_u32()
+        }
+        _ => (*array).get_location(index).chat_id.to_u32(),
+    }
 }
 #[no_mangle]
 pub unsafe extern "C" fn dc_array_get_contact_id(
@@ -2223,7 +2348,13 @@ fn from_prim<S, T>(s: S) -> Option<T>
         return 0;
     }
 
-    (*array).get_location(index).contact_id
+    match &*array {
+        dc_array_t::Msgs { .. } => {
+            let view = (*array).get_msg_view(index);
+            view.from_id
+        }
+        _ => (*array).get_location(index).contact_id,
+    }
 }
 #[no_mangle]
 pub unsafe extern "C" fn dc_array_get_msg_id(
@@ -2235,7 +2366,13 @@ fn from_prim<S, T>(s: S) -> Option<T>
         return 0;
     }
 
-    (*array).get_location(index).msg_id
+    match &*array {
+        dc_array_t::Msgs { .. } => {
+            let view = (*array).get_msg_view(index);
+            view.id.to_u32()
+        }
+        _ => (*array).get_location(index).msg_id,
+    }
 }
 #[no_mangle]
 pub unsafe extern "C" fn dc_array_get_marker(
@@ -2254,6 +2391,49 @@ fn from_prim<S, T>(s: S) -> Option<T>
     }
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn dc_array_get_state(
+    array: *const dc_array_t,
+    index: libc::size_t,
+) -> libc::c_int {
+    if array.is_null() {
+        eprintln!("ignoring careless call to dc_array_get_state()");
+        return 0;
+    }
+
+    (*array).get_msg_view(index).state as libc::c_int
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_array_get_viewtype(
+    array: *const dc_array_t,
+    index: libc::size_t,
+) -> libc::c_int {
+    if array.is_null() {
+        eprintln!("ignoring careless call to dc_array_get_viewtype()");
+        return 0;
+    }
+
+    (*array)
+        .get_msg_view(index)
+        .viewtype
+        .to_i64()
+        .expect("impossible: Viewtype -> i64 conversion failed") as libc::c_int
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_array_get_text(
+    array: *const dc_array_t,
+    index: libc::size_t,
+) -> *mut libc::c_char {
+    if array.is_null() {
+        eprintln!("ignoring careless call to dc_array_get_text()");
+        return "".strdup();
+    }
+
+    (*array).get_msg_text(index).strdup()
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn dc_array_search_id(
     array: *const dc_array_t,
@@ -2415,6 +2595,109 @@ pub struct ChatlistWrapper {
     })
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn dc_chatlist_get_chats(
+    chatlist: *mut dc_chatlist_t,
+    index: libc::size_t,
+    count: libc::size_t,
+    chats: *mut *mut dc_chat_t,
+) -> libc::size_t {
+    if chatlist.is_null() || chats.is_null() {
+        eprintln!("ignoring careless call to dc_chatlist_get_chats()");
+        return 0;
+    }
+    let ffi_list = &*chatlist;
+    let ctx = &*ffi_list.context;
+    let count = count.min(ffi_list.list.len().saturating_sub(index));
+    let chats = std::slice::from_raw_parts_mut(chats, count);
+
+    block_on(async move {
+        for (i, ffi_chat) in chats.iter_mut().enumerate() {
+            let chat_id = ffi_list.list.get_chat_id(index + i);
+            *ffi_chat = match chat::Chat::load_cached(&ctx, chat_id).await {
+                Ok(chat) => Box::into_raw(Box::new(ChatWrapper {
+                    context: ffi_list.context,
+                    chat,
+                })),
+                Err(_) => ptr::null_mut(),
+            };
+        }
+    });
+    count
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_chatlist_get_summaries(
+    chatlist: *mut dc_chatlist_t,
+    index: libc::size_t,
+    count: libc::size_t,
+    summaries: *mut *mut dc_lot_t,
+) -> libc::size_t {
+    if chatlist.is_null() || summaries.is_null() {
+        eprintln!("ignoring careless call to dc_chatlist_get_summaries()");
+        return 0;
+    }
+    let ffi_list = &*chatlist;
+    let ctx = &*ffi_list.context;
+    let count = count.min(ffi_list.list.len().saturating_sub(index));
+    let summaries = std::slice::from_raw_parts_mut(summaries, count);
+
+    block_on(async move {
+        for (i, summary) in summaries.iter_mut().enumerate() {
+            let chat_id = ffi_list.list.get_chat_id(index + i);
+            let chat = chat::Chat::load_cached(&ctx, chat_id).await.ok();
+            let lot = ffi_list
+                .list
+                .get_summary(&ctx, index + i, chat.as_ref())
+                .await
+                .log_err(ctx, "get_summary failed")
+                .unwrap_or_default();
+            *summary = Box::into_raw(Box::new(lot));
+        }
+    });
+    count
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_chatlist_diff(
+    older: *const dc_chatlist_t,
+    newer: *const dc_chatlist_t,
+) -> *mut dc_array::dc_array_t {
+    if older.is_null() || newer.is_null() {
+        eprintln!("ignoring careless call to dc_chatlist_diff()");
+        return ptr::null_mut();
+    }
+    let older = &*older;
+    let newer = &*newer;
+
+    let mut values: Vec<u32> = Vec::new();
+    for change in older.list.diff(&newer.list) {
+        let (kind, old_index, index, chat_id) = match change {
+            ChatlistChange::Removed { old_index, chat_id } => {
+                (constants::DC_CHATLIST_CHANGE_REMOVED, old_index, 0, chat_id)
+            }
+            ChatlistChange::Inserted { index, chat_id } => {
+                (constants::DC_CHATLIST_CHANGE_INSERTED, 0, index, chat_id)
+            }
+            ChatlistChange::Moved {
+                old_index,
+                index,
+                chat_id,
+            } => (
+                constants::DC_CHATLIST_CHANGE_MOVED,
+                old_index,
+                index,
+                chat_id,
+            ),
+            ChatlistChange::Updated { index, chat_id } => {
+                (constants::DC_CHATLIST_CHANGE_UPDATED, 0, index, chat_id)
+            }
+        };
+        values.extend_from_slice(&[kind, old_index as u32, index as u32, chat_id.to_u32()]);
+    }
+    Box::into_raw(Box::new(dc_array_t::from(values)))
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn dc_chatlist_get_context(
     chatlist: *mut dc_chatlist_t,
@@ -3918,3 +4201,18 @@ fn convert_and_prune_message_ids(msg_ids: *const u32, msg_cnt: libc::c_int) -> V
         .map(|ev| Box::into_raw(Box::new(ev)))
         .unwrap_or_else(ptr::null_mut)
 }
+
+#[no_mangle]
+pub unsafe extern "C" fn dc_accounts_get_next_events(
+    emitter: *mut dc_accounts_event_emitter_t,
+    out: *mut *mut dc_event_t,
+    max: libc::c_int,
+) -> libc::c_int {
+    if emitter.is_null() || out.is_null() || max <= 0 {
+        eprintln!("ignoring careless call to dc_accounts_get_next_events()");
+        return 0;
+    }
+    let emitter = &mut *emitter;
+
+    store_events(emitter.recv_batch_sync(max as usize), out, max)
+}
@@ -94,6 +94,8 @@ pub async fn remove_account(&self, id: u32) -> Result<()> {
         ensure!(ctx.is_some(), "no account with this id: {}", id);
         let ctx = ctx.unwrap();
         ctx.stop_io().await;
+        // The context may still be referenced, e.g. by the UI.
+        ctx.sql.secret_key_cache.clear();
         drop(ctx);
 
         if let Some(cfg) = self.config.get_account(id).await {
@@ -246,6 +248,32 @@ pub fn recv_sync(&mut self) -> Option<Event> {
     pub async fn recv(&mut self) -> Option<Event> {
         self.0.next().await
     }
+
+    /// Blocking recv of up to `max` events, see [`EventEmitter::recv_batch`].
+    pub fn recv_batch_sync(&mut self, max: usize) -> Vec<Event> {
+        async_std::task::block_on(self.recv_batch(max))
+    }
+
+    /// Async recv of up to `max` events.
+    ///
+    /// Waits for the first event, then returns it together with the events which are
+    /// already buffered. Returns an empty vector if all `Sender`s have been droped.
+    pub async fn recv_batch(&mut self, max: usize) -> Vec<Event> {
+        let mut events = Vec::new();
+        if max == 0 {
+            return events;
+        }
+        if let Some(event) = self.recv().await {
+            events.push(event);
+            while events.len() < max {
+                match futures::FutureExt::now_or_never(self.0.next()) {
+                    Some(Some(event)) => events.push(event),
+                    _ => break,
+                }
+            }
+        }
+        events
+    }
 }
 
 impl async_std::stream::Stream for EventEmitter {
@@ -319,17 +347,30 @@ pub async fn from_file(file: PathBuf) -> Result<Self> {
         })
     }
 
+    /// Opens the contexts of all accounts.
+    ///
+    /// The contexts are opened concurrently, each in its own task, so opening
+    /// the databases and checking their migrations does not add up for many accounts.
     pub async fn load_accounts(&self) -> Result<BTreeMap<u32, Context>> {
         let cfg = &*self.inner.read().await;
+        let tasks: Vec<_> = cfg
+            .accounts
+            .iter()
+            .map(|account_config| {
+                let os_name = cfg.os_name.clone();
+                let dbfile = account_config.dbfile();
+                let id = account_config.id;
+                async_std::task::spawn(async move {
+                    let ctx = Context::new(os_name, dbfile.into(), id).await?;
+                    Ok::<_, anyhow::Error>((id, ctx))
+                })
+            })
+            .collect();
+
         let mut accounts = BTreeMap::new();
-        for account_config in &cfg.accounts {
-            let ctx = Context::new(
-                cfg.os_name.clone(),
-                account_config.dbfile().into(),
-                account_config.id,
-            )
-            .await?;
-            accounts.insert(account_config.id, ctx);
+        for task in tasks {
+            let (id, ctx) = task.await?;
+            accounts.insert(id, ctx);
         }
 
         Ok(accounts)
@@ -1,9 +1,12 @@
 //! # Blob directory management
 
 use core::cmp::max;
+use std::borrow::Cow;
+use std::convert::TryFrom;
 use std::ffi::OsStr;
 use std::fmt;
 
+use async_std::channel::{self, Receiver, Sender};
 use async_std::path::{Path, PathBuf};
 use async_std::prelude::*;
 use async_std::{fs, io};
@@ -13,8 +16,11 @@
 use anyhow::Error;
 use image::DynamicImage;
 use image::GenericImageView;
+use image::ImageDecoder;
 use image::ImageFormat;
 use num_traits::FromPrimitive;
+use once_cell::sync::Lazy;
+use sha2::{Digest, Sha256};
 use thiserror::Error;
 
 use crate::config::Config;
@@ -85,6 +91,183 @@ pub async fn create(
         Ok(blob)
     }
 
+    /// Creates a blob like [BlobObject::create], but reuses an existing blob
+    /// with the same content and name.
+    ///
+    /// This is used for received attachments, so the same file received in
+    /// several chats is only stored once.  See [BlobObject::deduplicate].
+    pub(crate) async fn create_deduplicated(
+        context: &'a Context,
+        suggested_name: &str,
+        data: &[u8],
+    ) -> std::result::Result<BlobObject<'a>, BlobError> {
+        let hash = hex::encode(Sha256::digest(data));
+        let (stem, ext) = BlobObject::sanitise_name(suggested_name);
+        let basename = format!("{}{}", stem, ext);
+        if let Some(blob) =
+            BlobObject::lookup_deduplicated(context, &hash, &basename, data.len()).await
+        {
+            return Ok(blob);
+        }
+        let blob = BlobObject::create(context, suggested_name, data).await?;
+        BlobObject::register_deduplicated(context, &hash, &basename, &blob).await;
+        Ok(blob)
+    }
+
+    /// Creates a new blob object with a unique name from data produced in chunks.
+    ///
+    /// This creates a new blob as described in [BlobObject::create],
+    /// but the data does not need to be in memory at once.  If a
+    /// chunk can not be produced, the file is removed again and
+    /// [BlobError::WriteFailure] is returned.
+    ///
+    /// The data is hashed while it is written.  If a blob with the same
+    /// content and name exists, the new file is removed and the existing
+    /// blob is returned instead, like [BlobObject::create_deduplicated] does.
+    ///
+    /// Returns the blob and the number of bytes written.
+    pub(crate) async fn create_from_chunks<'b, I>(
+        context: &'a Context,
+        suggested_name: &str,
+        chunks: I,
+    ) -> std::result::Result<(BlobObject<'a>, usize), BlobError>
+    where
+        I: Iterator<Item = std::io::Result<Cow<'b, [u8]>>>,
+    {
+        let blobdir = context.get_blobdir();
+        let (stem, ext) = BlobObject::sanitise_name(suggested_name);
+        let (name, mut file) = BlobObject::create_new_file(blobdir, &stem, &ext).await?;
+        let mut bytes = 0;
+        let mut hasher = Sha256::new();
+        for chunk in chunks {
+            let res = match chunk {
+                Ok(chunk) => {
+                    bytes += chunk.len();
+                    hasher.update(&chunk);
+                    file.write_all(&chunk).await
+                }
+                Err(err) => Err(err),
+            };
+            if let Err(err) = res {
+                drop(file);
+                // Attempt to remove the failed file, swallow errors resulting from that.
+                fs::remove_file(blobdir.join(&name)).await.ok();
+                return Err(BlobError::WriteFailure {
+                    blobdir: blobdir.to_path_buf(),
+                    blobname: name,
+                    cause: err.into(),
+                });
+            }
+        }
+
+        // workaround, see create() for details
+        let _ = file.flush().await;
+        drop(file);
+
+        let hash = hex::encode(hasher.finalize());
+        let basename = format!("{}{}", stem, ext);
+        if bytes > 0 {
+            if let Some(blob) =
+                BlobObject::lookup_deduplicated(context, &hash, &basename, bytes).await
+            {
+                fs::remove_file(blobdir.join(&name)).await.ok();
+                return Ok((blob, bytes));
+            }
+        }
+
+        let blob = BlobObject {
+            blobdir,
+            name: format!("$BLOBDIR/{}", name),
+        };
+        context.emit_event(EventType::NewBlobFile(blob.as_name().to_string()));
+        if bytes > 0 {
+            BlobObject::register_deduplicated(context, &hash, &basename, &blob).await;
+        }
+        Ok((blob, bytes))
+    }
+
+    /// Returns the registered blob with the SHA-256 `hash` and `basename`,
+    /// the sanitised suggested name of the blob.
+    ///
+    /// The name of a blob is shown as the file name of its messages, so
+    /// only blobs with the same content and name are deduplicated.  The
+    /// blob is only returned if it still exists and has `size` bytes.
+    async fn lookup_deduplicated(
+        context: &'a Context,
+        hash: &str,
+        basename: &str,
+        size: usize,
+    ) -> Option<BlobObject<'a>> {
+        let name: String = context
+            .sql
+            .query_get_value(
+                "SELECT name FROM blobs WHERE hash=? AND basename=?;",
+                paramsv![hash, basename],
+            )
+            .await
+            .ok()
+            .flatten()?;
+        let blob = BlobObject::from_name(context, format!("$BLOBDIR/{}", name)).ok()?;
+        let path = blob.to_abs_path();
+        match fs::metadata(&path).await {
+            Ok(metadata) if metadata.len() == size as u64 => {
+                // Housekeeping keeps recently modified files even if they are unreferenced,
+                // this protects the reused blob until the new message referring to it is saved.
+                if let Err(err) =
+                    filetime::set_file_mtime(path.as_os_str(), filetime::FileTime::now())
+                {
+                    warn!(context, "Cannot reuse blob {}: {}", name, err);
+                    return None;
+                }
+                info!(context, "Reusing blob {} with the same content.", name);
+                Some(blob)
+            }
+            _ => None,
+        }
+    }
+
+    /// Registers `blob` as the blob with the SHA-256 `hash` and `basename`,
+    /// see [BlobObject::lookup_deduplicated].
+    ///
+    /// Registered blobs may be shared by several messages, they are never
+    /// changed in place, see [BlobObject::is_deduplicated].  Unreferenced
+    /// blobs are deleted by housekeeping, which also removes the registration.
+    async fn register_deduplicated(
+        context: &Context,
+        hash: &str,
+        basename: &str,
+        blob: &BlobObject<'_>,
+    ) {
+        if let Err(err) = context
+            .sql
+            .execute(
+                "INSERT OR REPLACE INTO blobs (hash, basename, name) VALUES (?, ?, ?);",
+                paramsv![hash, basename, blob.as_file_name()],
+            )
+            .await
+        {
+            warn!(
+                context,
+                "Cannot register blob {}: {:#}",
+                blob.as_name(),
+                err
+            );
+        }
+    }
+
+    /// Returns true if the blob is registered for deduplication,
+    /// so it may be shared by several messages and must not be changed in place.
+    async fn is_deduplicated(&self, context: &Context) -> bool {
+        context
+            .sql
+            .exists(
+                "SELECT COUNT(*) FROM blobs WHERE name=?;",
+                paramsv![self.as_file_name()],
+            )
+            .await
+            .unwrap_or(true)
+    }
+
     // Creates a new file, returning a tuple of the name and the handle.
     async fn create_new_file(
         dir: &Path,
@@ -402,7 +585,11 @@ pub async fn recode_to_avatar_size(&mut self, context: &Context) -> Result<(), B
         Ok(())
     }
 
-    pub async fn recode_to_image_size(&self, context: &Context) -> Result<(), BlobError> {
+    /// Recodes the image to the configured media quality if it is too large.
+    ///
+    /// If the blob may be shared with other messages, the recoded image is
+    /// written to a new blob, so the name of the blob may change.
+    pub async fn recode_to_image_size(&mut self, context: &Context) -> Result<(), BlobError> {
         let blob_abs = self.to_abs_path();
         if message::guess_msgtype_from_suffix(Path::new(&blob_abs))
             != Some((Viewtype::Image, "image/jpeg"))
@@ -418,15 +605,8 @@ pub async fn recode_to_image_size(&self, context: &Context) -> Result<(), BlobEr
                 MediaQuality::Worse => WORSE_IMAGE_SIZE,
             };
 
-        if self
-            .recode_to_size(context, blob_abs, img_wh, None)
-            .await?
-            .is_some()
-        {
-            return Err(format_err!(
-                "Internal error: recode_to_size(..., None) shouldn't change the name of the image"
-            )
-            .into());
+        if let Some(new_name) = self.recode_to_size(context, blob_abs, img_wh, None).await? {
+            self.name = new_name;
         }
         Ok(())
     }
@@ -434,139 +614,245 @@ pub async fn recode_to_image_size(&self, context: &Context) -> Result<(), BlobEr
     async fn recode_to_size(
         &self,
         context: &Context,
-        mut blob_abs: PathBuf,
-        mut img_wh: u32,
+        blob_abs: PathBuf,
+        img_wh: u32,
         max_bytes: Option<usize>,
     ) -> Result<Option<String>, BlobError> {
-        let mut img = image::open(&blob_abs).map_err(|err| BlobError::RecodeFailure {
+        let orientation = self.get_exif_orientation(context);
+        let copy_on_write = self.is_deduplicated(context).await;
+
+        // Decoding and encoding images is CPU-bound, do it on a separate thread
+        // and recode at most one image per CPU at the same time.
+        let _permit = RecodePermit::acquire().await;
+        let context = context.clone();
+        async_std::task::spawn_blocking(move || {
+            recode_image(
+                &context,
+                blob_abs,
+                orientation,
+                img_wh,
+                max_bytes,
+                copy_on_write,
+            )
+        })
+        .await
+    }
+
+    pub fn get_exif_orientation(&self, context: &Context) -> Result<i32, Error> {
+        let file = std::fs::File::open(self.to_abs_path())?;
+        let mut bufreader = std::io::BufReader::new(&file);
+        let exifreader = exif::Reader::new();
+        let exif = exifreader.read_from_container(&mut bufreader)?;
+        if let Some(orientation) = exif.get_field(exif::Tag::Orientation, exif::In::PRIMARY) {
+            // possible orientation values are described at http://sylvana.net/jpegcrop/exif_orientation.html
+            // we only use rotation, in practise, flipping is not used.
+            match orientation.value.get_uint(0) {
+                Some(3) => return Ok(180),
+                Some(6) => return Ok(90),
+                Some(8) => return Ok(270),
+                other => warn!(context, "exif orientation value ignored: {:?}", other),
+            }
+        }
+        Ok(0)
+    }
+}
+
+/// Limits the number of images recoded at the same time to the number of CPUs.
+static RECODE_SLOTS: Lazy<(Sender<()>, Receiver<()>)> = Lazy::new(|| {
+    let slots = max(num_cpus::get(), 1);
+    let (sender, receiver) = channel::bounded(slots);
+    for _ in 0..slots {
+        sender.try_send(()).ok();
+    }
+    (sender, receiver)
+});
+
+/// Permission to recode an image, given back when dropped.
+struct RecodePermit;
+
+impl RecodePermit {
+    async fn acquire() -> RecodePermit {
+        // The sender is never dropped, so the channel is never closed.
+        RECODE_SLOTS.1.recv().await.ok();
+        RecodePermit
+    }
+}
+
+impl Drop for RecodePermit {
+    fn drop(&mut self) {
+        RECODE_SLOTS.0.try_send(()).ok();
+    }
+}
+
+/// Decodes the image at `path` and returns it together with its original width and height.
+///
+/// Large JPEG images are decoded at a reduced scale that is still at least
+/// `img_wh` pixels wide and high, which is much faster than decoding them
+/// completely and scaling them down afterwards.
+fn decode_image(path: &Path, img_wh: u32) -> image::ImageResult<(DynamicImage, (u32, u32))> {
+    let reader = image::io::Reader::open(path)?.with_guessed_format()?;
+    if reader.format() == Some(ImageFormat::Jpeg) {
+        if let Ok(wh) = u16::try_from(img_wh) {
+            let file = std::io::BufReader::new(std::fs::File::open(path)?);
+            let mut decoder = image::codecs::jpeg::JpegDecoder::new(file)?;
+            let dimensions = decoder.dimensions();
+            decoder.scale(wh, wh)?;
+            return Ok((DynamicImage::from_decoder(decoder)?, dimensions));
+        }
+    }
+    let img = reader.decode()?;
+    let dimensions = img.dimensions();
+    Ok((img, dimensions))
+}
+
+/// Scales down and rotates the image at `blob_abs` as needed, see [BlobObject::recode_to_size].
+///
+/// If `copy_on_write` is set, a changed image is written to a new file
+/// instead of replacing the original one.
+///
+/// This is blocking and should be run on a separate thread.
+fn recode_image(
+    context: &Context,
+    mut blob_abs: PathBuf,
+    orientation: Result<i32, Error>,
+    mut img_wh: u32,
+    max_bytes: Option<usize>,
+    copy_on_write: bool,
+) -> Result<Option<String>, BlobError> {
+    let do_rotate = matches!(orientation, Ok(90) | Ok(180) | Ok(270));
+    if !do_rotate && max_bytes.is_none() {
+        // Check the dimensions without decoding the image. This avoids recoding
+        // an image again, e.g. when it is forwarded.
+        if let Ok((width, height)) = image::io::Reader::open(&blob_abs)
+            .and_then(|reader| reader.with_guessed_format())
+            .map_err(image::ImageError::from)
+            .and_then(|reader| reader.into_dimensions())
+        {
+            if width <= img_wh && height <= img_wh {
+                return Ok(None);
+            }
+        }
+    }
+
+    let (mut img, (width, height)) =
+        decode_image(&blob_abs, img_wh).map_err(|err| BlobError::RecodeFailure {
             blobdir: context.get_blobdir().to_path_buf(),
             blobname: blob_abs.to_str().unwrap_or_default().to_string(),
             cause: err,
         })?;
-        let orientation = self.get_exif_orientation(context);
-        let mut encoded = Vec::new();
-        let mut changed_name = None;
+    let mut encoded = Vec::new();
+    let mut changed_name = None;
 
-        fn encode_img(img: &DynamicImage, encoded: &mut Vec<u8>) -> anyhow::Result<()> {
-            encoded.clear();
-            img.write_to(encoded, image::ImageFormat::Jpeg)?;
-            Ok(())
-        }
-        fn encoded_img_exceeds_bytes(
-            context: &Context,
-            img: &DynamicImage,
-            max_bytes: Option<usize>,
-            encoded: &mut Vec<u8>,
-        ) -> anyhow::Result<bool> {
-            if let Some(max_bytes) = max_bytes {
-                encode_img(img, encoded)?;
-                if encoded.len() > max_bytes {
-                    info!(
-                        context,
-                        "image size {}B ({}x{}px) exceeds {}B, need to scale down",
-                        encoded.len(),
-                        img.width(),
-                        img.height(),
-                        max_bytes,
-                    );
-                    return Ok(true);
-                }
+    fn encode_img(img: &DynamicImage, encoded: &mut Vec<u8>) -> anyhow::Result<()> {
+        encoded.clear();
+        img.write_to(encoded, image::ImageFormat::Jpeg)?;
+        Ok(())
+    }
+    fn encoded_img_exceeds_bytes(
+        context: &Context,
+        img: &DynamicImage,
+        max_bytes: Option<usize>,
+        encoded: &mut Vec<u8>,
+    ) -> anyhow::Result<bool> {
+        if let Some(max_bytes) = max_bytes {
+            encode_img(img, encoded)?;
+            if encoded.len() > max_bytes {
+                info!(
+                    context,
+                    "image size {}B ({}x{}px) exceeds {}B, need to scale down",
+                    encoded.len(),
+                    img.width(),
+                    img.height(),
+                    max_bytes,
+                );
+                return Ok(true);
             }
-            Ok(false)
         }
-        let exceeds_width = img.width() > img_wh || img.height() > img_wh;
-
-        let do_scale =
-            exceeds_width || encoded_img_exceeds_bytes(context, &img, max_bytes, &mut encoded)?;
-        let do_rotate = matches!(orientation, Ok(90) | Ok(180) | Ok(270));
-
-        if do_scale || do_rotate {
-            if do_rotate {
-                img = match orientation {
-                    Ok(90) => img.rotate90(),
-                    Ok(180) => img.rotate180(),
-                    Ok(270) => img.rotate270(),
-                    _ => img,
-                }
+        Ok(false)
+    }
+    // Check the original dimensions, the image may have been scaled down while decoding.
+    let exceeds_width = width > img_wh || height > img_wh;
+
+    let do_scale =
+        exceeds_width || encoded_img_exceeds_bytes(context, &img, max_bytes, &mut encoded)?;
+
+    if do_scale || do_rotate {
+        if do_rotate {
+            img = match orientation {
+                Ok(90) => img.rotate90(),
+                Ok(180) => img.rotate180(),
+                Ok(270) => img.rotate270(),
+                _ => img,
             }
+        }
 
-            if do_scale {
-                if !exceeds_width {
-                    // The image is already smaller than img_wh, but exceeds max_bytes
-                    // We can directly start with trying to scale down to 2/3 of its current width
-                    img_wh = max(img.width(), img.height()) * 2 / 3
-                }
+        if do_scale {
+            if !exceeds_width {
+                // The image is already smaller than img_wh, but exceeds max_bytes
+                // We can directly start with trying to scale down to 2/3 of its current width
+                img_wh = max(img.width(), img.height()) * 2 / 3
+            }
 
-                loop {
-                    let new_img = img.thumbnail(img_wh, img_wh);
+            loop {
+                let new_img = img.thumbnail(img_wh, img_wh);
 
-                    if encoded_img_exceeds_bytes(context, &new_img, max_bytes, &mut encoded)? {
-                        if img_wh < 20 {
-                            return Err(format_err!(
-                                "Failed to scale image to below {}B",
-                                max_bytes.unwrap_or_default()
-                            )
-                            .into());
-                        }
+                if encoded_img_exceeds_bytes(context, &new_img, max_bytes, &mut encoded)? {
+                    if img_wh < 20 {
+                        return Err(format_err!(
+                            "Failed to scale image to below {}B",
+                            max_bytes.unwrap_or_default()
+                        )
+                        .into());
+                    }
 
-                        img_wh = img_wh * 2 / 3;
-                    } else {
-                        if encoded.is_empty() {
-                            encode_img(&new_img, &mut encoded)?;
-                        }
-
-                        info!(
-                            context,
-                            "Final scaled-down image size: {}B ({}px)",
-                            encoded.len(),
-                            img_wh
-                        );
-                        break;
+                    img_wh = img_wh * 2 / 3;
+                } else {
+                    if encoded.is_empty() {
+                        encode_img(&new_img, &mut encoded)?;
                     }
-                }
-            }
 
-            // The file format is JPEG now, we may have to change the file extension
-            if !matches!(ImageFormat::from_path(&blob_abs), Ok(ImageFormat::Jpeg)) {
-                blob_abs = blob_abs.with_extension("jpg");
-                let file_name = blob_abs.file_name().context("No avatar file name (???)")?;
-                let file_name = file_name.to_str().context("Filename is no UTF-8 (???)")?;
-                changed_name = Some(format!("$BLOBDIR/{}", file_name));
+                    info!(
+                        context,
+                        "Final scaled-down image size: {}B ({}px)",
+                        encoded.len(),
+                        img_wh
+                    );
+                    break;
+                }
             }
+        }
 
-            if encoded.is_empty() {
-                encode_img(&img, &mut encoded)?;
-            }
+        // The file format is JPEG now, we may have to change the file extension
+        let orig_blob_abs = blob_abs.clone();
+        if !matches!(ImageFormat::from_path(&blob_abs), Ok(ImageFormat::Jpeg)) {
+            blob_abs = blob_abs.with_extension("jpg");
+        }
+        if copy_on_write {
+            let stem = blob_abs
+                .file_stem()
+                .and_then(OsStr::to_str)
+                .context("Filename is no UTF-8 (???)")?
+                .to_string();
+            blob_abs = blob_abs.with_file_name(format!("{}-{}.jpg", stem, rand::random::<u32>()));
+        }
+        if blob_abs != orig_blob_abs {
+            let file_name = blob_abs.file_name().context("No avatar file name (???)")?;
+            let file_name = file_name.to_str().context("Filename is no UTF-8 (???)")?;
+            changed_name = Some(format!("$BLOBDIR/{}", file_name));
+        }
 
-            fs::write(&blob_abs, &encoded)
-                .await
-                .map_err(|err| BlobError::WriteFailure {
-                    blobdir: context.get_blobdir().to_path_buf(),
-                    blobname: blob_abs.to_str().unwrap_or_default().to_string(),
-                    cause: err.into(),
-                })?;
+        if encoded.is_empty() {
+            encode_img(&img, &mut encoded)?;
         }
 
-        Ok(changed_name)
+        std::fs::write(&blob_abs, &encoded).map_err(|err| BlobError::WriteFailure {
+            blobdir: context.get_blobdir().to_path_buf(),
+            blobname: blob_abs.to_str().unwrap_or_default().to_string(),
+            cause: err.into(),
+        })?;
     }
 
-    pub fn get_exif_orientation(&self, context: &Context) -> Result<i32, Error> {
-        let file = std::fs::File::open(self.to_abs_path())?;
-        let mut bufreader = std::io::BufReader::new(&file);
-        let exifreader = exif::Reader::new();
-        let exif = exifreader.read_from_container(&mut bufreader)?;
-        if let Some(orientation) = exif.get_field(exif::Tag::Orientation, exif::In::PRIMARY) {
-            // possible orientation values are described at http://sylvana.net/jpegcrop/exif_orientation.html
-            // we only use rotation, in practise, flipping is not used.
-            match orientation.value.get_uint(0) {
-                Some(3) => return Ok(180),
-                Some(6) => return Ok(90),
-                Some(8) => return Ok(270),
-                other => warn!(context, "exif orientation value ignored: {:?}", other),
-            }
-        }
-        Ok(0)
-    }
+    Ok(changed_name)
 }
 
 impl<'a> fmt::Display for BlobObject<'a> {
@@ -635,6 +921,107 @@ async fn test_create() {
         assert_eq!(blob.to_abs_path(), t.get_blobdir().join("foo"));
     }
 
+    #[async_std::test]
+    async fn test_create_from_chunks() {
+        let t = TestContext::new().await;
+        let chunks = vec![
+            Ok(Cow::Borrowed(&b"hel"[..])),
+            Ok(Cow::Owned(b"lo".to_vec())),
+        ];
+        let (blob, bytes) = BlobObject::create_from_chunks(&t, "foo", chunks.into_iter())
+            .await
+            .unwrap();
+        assert_eq!(blob.as_name(), "$BLOBDIR/foo");
+        assert_eq!(bytes, 5);
+        assert_eq!(fs::read(blob.to_abs_path()).await.unwrap(), b"hello");
+
+        let chunks = vec![
+            Ok(Cow::Borrowed(&b"hello"[..])),
+            Err(std::io::Error::new(std::io::ErrorKind::InvalidData, "bad")),
+        ];
+        assert!(
+            BlobObject::create_from_chunks(&t, "bar", chunks.into_iter())
+                .await
+                .is_err()
+        );
+        assert!(!t.get_blobdir().join("bar").exists().await);
+    }
+
+    #[async_std::test]
+    async fn test_create_deduplicated() {
+        let t = TestContext::new().await;
+        let blob = BlobObject::create_deduplicated(&t, "foo.txt", b"hello")
+            .await
+            .unwrap();
+        assert_eq!(blob.as_name(), "$BLOBDIR/foo.txt");
+
+        // Same content and name: the blob is reused.
+        let blob2 = BlobObject::create_deduplicated(&t, "foo.txt", b"hello")
+            .await
+            .unwrap();
+        assert_eq!(blob2, blob);
+
+        // A reused blob is protected from housekeeping as a new file.
+        let path = blob.to_abs_path();
+        filetime::set_file_mtime(path.as_os_str(), filetime::FileTime::from_unix_time(0, 0))
+            .unwrap();
+        BlobObject::create_deduplicated(&t, "foo.txt", b"hello")
+            .await
+            .unwrap();
+        let modified = fs::metadata(&path).await.unwrap().modified().unwrap();
+        assert!(modified > std::time::UNIX_EPOCH + std::time::Duration::from_secs(3600));
+
+        let chunks = vec![Ok(Cow::Borrowed(&b"hello"[..]))];
+        let (blob3, _) = BlobObject::create_from_chunks(&t, "foo.txt", chunks.into_iter())
+            .await
+            .unwrap();
+        assert_eq!(blob3, blob);
+        let mut dir = fs::read_dir(t.get_blobdir()).await.unwrap();
+        let mut files = 0;
+        while dir.next().await.is_some() {
+            files += 1;
+        }
+        assert_eq!(files, 1);
+
+        // Different name or content: a new blob is created.
+        let blob4 = BlobObject::create_deduplicated(&t, "bar.txt", b"hello")
+            .await
+            .unwrap();
+        assert_eq!(blob4.as_name(), "$BLOBDIR/bar.txt");
+        let blob5 = BlobObject::create_deduplicated(&t, "foo.txt", b"world")
+            .await
+            .unwrap();
+        assert_ne!(blob5, blob);
+
+        // A removed blob is not reused.
+        fs::remove_file(blob.to_abs_path()).await.unwrap();
+        let blob6 = BlobObject::create_deduplicated(&t, "foo.txt", b"hello")
+            .await
+            .unwrap();
+        assert_eq!(fs::read(blob6.to_abs_path()).await.unwrap(), b"hello");
+    }
+
+    #[async_std::test]
+    async fn test_recode_deduplicated() {
+        let t = TestContext::new().await;
+        let bytes = include_bytes!("../test-data/image/avatar1000x1000.jpg");
+        t.set_config(Config::MediaQuality, Some("1")).await.unwrap();
+        let mut blob = BlobObject::create_deduplicated(&t, "image.jpg", bytes)
+            .await
+            .unwrap();
+        let shared = blob.clone();
+
+        // The shared original is kept, the recoded image is a new blob.
+        blob.recode_to_image_size(&t).await.unwrap();
+        assert_ne!(blob, shared);
+        assert_eq!(
+            &fs::read(shared.to_abs_path()).await.unwrap()[..],
+            &bytes[..]
+        );
+        let img = image::open(blob.to_abs_path()).unwrap();
+        assert_eq!(img.width(), WORSE_IMAGE_SIZE);
+    }
+
     #[async_std::test]
     async fn test_lowercase_ext() {
         let t = TestContext::new().await;
@@ -921,6 +1308,28 @@ async fn test_selfavatar_copy_without_recode() {
         assert_eq!(avatar_cfg, avatar_blob.to_str().map(|s| s.to_string()));
     }
 
+    #[async_std::test]
+    async fn test_decode_image_scaled() {
+        let t = TestContext::new().await;
+        let avatar_src = t.dir.path().join("avatar.jpg");
+        fs::write(
+            &avatar_src,
+            include_bytes!("../test-data/image/avatar1000x1000.jpg"),
+        )
+        .await
+        .unwrap();
+
+        // JPEG images are decoded at a reduced scale, but not smaller than requested.
+        let (img, dimensions) = decode_image(&avatar_src, 300).unwrap();
+        assert_eq!(dimensions, (1000, 1000));
+        assert!(img.width() >= 300 && img.width() < 1000);
+        assert!(img.height() >= 300 && img.height() < 1000);
+
+        let (img, dimensions) = decode_image(&avatar_src, 2000).unwrap();
+        assert_eq!(dimensions, (1000, 1000));
+        assert_eq!(img.dimensions(), (1000, 1000));
+    }
+
     #[async_std::test]
     async fn test_recode_image() {
         let bytes = include_bytes!("../test-data/image/avatar1000x1000.jpg");
@@ -1,13 +1,13 @@
 //! # Chat module
 
 use std::convert::{TryFrom, TryInto};
-use std::str::FromStr;
 use std::time::{Duration, SystemTime};
 
 use anyhow::{bail, ensure, format_err, Context as _, Result};
 use async_std::path::{Path, PathBuf};
 use deltachat_derive::{FromSql, ToSql};
 use itertools::Itertools;
+use num_traits::FromPrimitive;
 use serde::{Deserialize, Serialize};
 
 use crate::aheader::EncryptPreference;
@@ -28,7 +28,7 @@
     dc_create_smeared_timestamps, dc_get_abs_path, dc_gm2local_offset, improve_single_line_input,
     remove_subject_prefix, time, IsNoneOrEmpty,
 };
-use crate::ephemeral::{delete_expired_messages, schedule_ephemeral_task, Timer as EphemeralTimer};
+use crate::ephemeral::{schedule_ephemeral_task, Timer as EphemeralTimer};
 use crate::events::EventType;
 use crate::html::new_html_mimepart;
 use crate::job::{self, Action};
@@ -232,14 +232,16 @@ pub async fn set_blocked(self, context: &Context, new_blocked: Blocked) -> bool
             warn!(context, "ignoring setting of Block-status for {}", self);
             return false;
         }
-        context
+        let ok = context
             .sql
             .execute(
                 "UPDATE chats SET blocked=? WHERE id=?;",
                 paramsv![new_blocked, self],
             )
             .await
-            .is_ok()
+            .is_ok();
+        context.sql.read_cache.invalidate_chat(self);
+        ok
     }
 
     pub async fn unblock(self, context: &Context) {
@@ -392,6 +394,7 @@ pub async fn unarchive(self, context: &Context) -> Result<()> {
                 paramsv![self],
             )
             .await?;
+        context.sql.read_cache.invalidate_chat(self);
         Ok(())
     }
 
@@ -900,6 +903,23 @@ pub async fn load_from_db(context: &Context, chat_id: ChatId) -> Result<Self> {
         Ok(chat)
     }
 
+    /// Loads a chat like [Chat::load_from_db], but returns a cached snapshot if possible.
+    ///
+    /// The snapshot is updated when the chat is changed, this is meant for displaying chats,
+    /// e.g. in the chatlist. Functions which modify the chat should use [Chat::load_from_db].
+    pub async fn load_cached(context: &Context, chat_id: ChatId) -> Result<Self> {
+        if let Some(chat) = context.sql.read_cache.get_chat(chat_id) {
+            return Ok(chat);
+        }
+        let generation = context.sql.read_cache.chat_generation();
+        let chat = Chat::load_from_db(context, chat_id).await?;
+        // The name of the archived link contains the number of archived chats.
+        if !chat_id.is_archived_link() {
+            context.sql.read_cache.insert_chat(chat.clone(), generation);
+        }
+        Ok(chat)
+    }
+
     pub fn is_self_talk(&self) -> bool {
         self.param.exists(Param::Selftalk)
     }
@@ -930,6 +950,7 @@ pub async fn update_param(&mut self, context: &Context) -> Result<()> {
                 paramsv![self.param.to_string(), self.id],
             )
             .await?;
+        context.sql.read_cache.invalidate_chat(self.id);
         Ok(())
     }
 
@@ -1447,6 +1468,7 @@ async fn update_special_chat_name(context: &Context, contact_id: u32, name: Stri
                 paramsv![name, chat_id, name],
             )
             .await?;
+        context.sql.read_cache.invalidate_chat(chat_id);
     }
     Ok(())
 }
@@ -1621,7 +1643,7 @@ async fn prepare_msg_blob(context: &Context, msg: &mut Message) -> Result<()> {
     if msg.viewtype == Viewtype::Text || msg.viewtype == Viewtype::VideochatInvitation {
         // the caller should check if the message text is empty
     } else if msgtype_has_file(msg.viewtype) {
-        let blob = msg
+        let mut blob = msg
             .param
             .get_blob(Param::File, context, !msg.is_increation())
             .await?
@@ -1867,23 +1889,9 @@ pub async fn get_chat_msgs(
     flags: u32,
     marker1before: Option<MsgId>,
 ) -> Result<Vec<ChatItem>> {
-    match delete_expired_messages(context).await {
-        Err(err) => warn!(context, "Failed to delete expired messages: {}", err),
-        Ok(messages_deleted) => {
-            if messages_deleted {
-                // Trigger reload of chatlist.
-                //
-                // On desktop chatlist is always shown on the side,
-                // and it is important to update the last message shown
-                // there.
-                context.emit_event(EventType::MsgsChanged {
-                    msg_id: MsgId::new(0),
-                    chat_id: ChatId::new(0),
-                })
-            }
-        }
-    }
-
+    // Expired messages are deleted by the ephemeral task,
+    // skip the ones it has not deleted yet.
+    let now = time();
     let process_row = if (flags & DC_GCM_INFO_ONLY) != 0 {
         |row: &rusqlite::Row| {
             // is_info logic taken from Message.is_info()
@@ -1891,12 +1899,14 @@ pub async fn get_chat_msgs(
             let (from_id, to_id) = (row.get::<_, u32>("from_id")?, row.get::<_, u32>("to_id")?);
             let is_info_msg: bool = from_id == DC_CONTACT_ID_INFO as u32
                 || to_id == DC_CONTACT_ID_INFO as u32
-                || match Params::from_str(&params) {
-                    Ok(p) => {
-                        let cmd = p.get_cmd();
+                || match Params::lookup(&params, Param::Cmd)
+                    .and_then(|cmd| cmd.parse().ok())
+                    .and_then(SystemMessage::from_i32)
+                {
+                    Some(cmd) => {
                         cmd != SystemMessage::Unknown && cmd != SystemMessage::AutocryptSetupMessage
                     }
-                    _ => false,
+                    None => false,
                 };
 
             Ok((
@@ -1956,8 +1966,9 @@ pub async fn get_chat_msgs(
                 AND m.hidden=0
                 AND chats.blocked=2
                 AND contacts.blocked=0
+                AND (m.ephemeral_timestamp=0 OR m.ephemeral_timestamp>?)
               ORDER BY m.timestamp,m.id;",
-                paramsv![DC_CONTACT_ID_INFO],
+                paramsv![DC_CONTACT_ID_INFO, now],
                 process_row,
                 process_rows,
             )
@@ -1976,8 +1987,9 @@ pub async fn get_chat_msgs(
                     OR m.from_id == ?
                     OR m.to_id == ?
                 )
+                AND (m.ephemeral_timestamp=0 OR m.ephemeral_timestamp>?)
               ORDER BY m.timestamp, m.id;",
-                paramsv![chat_id, DC_CONTACT_ID_INFO, DC_CONTACT_ID_INFO],
+                paramsv![chat_id, DC_CONTACT_ID_INFO, DC_CONTACT_ID_INFO, now],
                 process_row,
                 process_rows,
             )
@@ -1990,8 +2002,9 @@ pub async fn get_chat_msgs(
                FROM msgs m
               WHERE m.chat_id=?
                 AND m.hidden=0
+                AND (m.ephemeral_timestamp=0 OR m.ephemeral_timestamp>?)
               ORDER BY m.timestamp, m.id;",
-                paramsv![chat_id],
+                paramsv![chat_id, now],
                 process_row,
                 process_rows,
             )
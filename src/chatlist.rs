@@ -1,5 +1,7 @@
 //! # Chat list module
 
+use std::collections::HashMap;
+
 use anyhow::{bail, ensure, Result};
 
 use crate::chat::{update_special_chat_names, Chat, ChatId, ChatVisibility};
@@ -10,9 +12,8 @@
 };
 use crate::contact::Contact;
 use crate::context::Context;
-use crate::ephemeral::delete_expired_messages;
 use crate::lot::Lot;
-use crate::message::{Message, MessageState, MsgId};
+use crate::message::{Message, MsgId};
 use crate::stock_str;
 
 /// An object representing a single chatlist in memory.
@@ -101,12 +102,6 @@ pub async fn try_load(
         let flag_no_specials = 0 != listflags & DC_GCL_NO_SPECIALS;
         let flag_add_alldone_hint = 0 != listflags & DC_GCL_ADD_ALLDONE_HINT;
 
-        // Note that we do not emit DC_EVENT_MSGS_MODIFIED here even if some
-        // messages get deleted to avoid reloading the same chatlist.
-        if let Err(err) = delete_expired_messages(context).await {
-            warn!(context, "Failed to hide expired messages: {}", err);
-        }
-
         let mut add_archived_link_item = false;
 
         let process_row = |row: &rusqlite::Row| {
@@ -128,12 +123,10 @@ pub async fn try_load(
             ChatId::new(0)
         };
 
-        // select with left join and minimum:
+        // the last message of each chat is maintained by triggers on `msgs`
+        // in `chats.last_msg_id` and `chats.last_msg_timestamp`,
+        // drafts are taken into account, other hidden messages are not.
         //
-        // - the inner select must use `hidden` and _not_ `m.hidden`
-        //   which would refer the outer select and take a lot of time
-        // - `GROUP BY` is needed several messages may have the same
-        //   timestamp
         // - the list starts with the newest chats
         //
         // nb: the query currently shows messages from blocked
@@ -146,22 +139,13 @@ pub async fn try_load(
         let mut ids = if let Some(query_contact_id) = query_contact_id {
             // show chats shared with a given contact
             context.sql.query_map(
-                "SELECT c.id, m.id
+                "SELECT c.id, c.last_msg_id
                  FROM chats c
-                 LEFT JOIN msgs m
-                        ON c.id=m.chat_id
-                       AND m.id=(
-                               SELECT id
-                                 FROM msgs
-                                WHERE chat_id=c.id
-                                  AND (hidden=0 OR state=?1)
-                                  ORDER BY timestamp DESC, id DESC LIMIT 1)
                  WHERE c.id>9
                    AND c.blocked=0
-                   AND c.id IN(SELECT chat_id FROM chats_contacts WHERE contact_id=?2)
-                 GROUP BY c.id
-                 ORDER BY c.archived=?3 DESC, IFNULL(m.timestamp,c.created_timestamp) DESC, m.id DESC;",
-                paramsv![MessageState::OutDraft, query_contact_id as i32, ChatVisibility::Pinned],
+                   AND c.id IN(SELECT chat_id FROM chats_contacts WHERE contact_id=?1)
+                 ORDER BY c.archived=?2 DESC, IFNULL(c.last_msg_timestamp,c.created_timestamp) DESC, c.last_msg_id DESC;",
+                paramsv![query_contact_id as i32, ChatVisibility::Pinned],
                 process_row,
                 process_rows,
             ).await?
@@ -173,22 +157,13 @@ pub async fn try_load(
             context
                 .sql
                 .query_map(
-                    "SELECT c.id, m.id
+                    "SELECT c.id, c.last_msg_id
                  FROM chats c
-                 LEFT JOIN msgs m
-                        ON c.id=m.chat_id
-                       AND m.id=(
-                               SELECT id
-                                 FROM msgs
-                                WHERE chat_id=c.id
-                                  AND (hidden=0 OR state=?)
-                                  ORDER BY timestamp DESC, id DESC LIMIT 1)
                  WHERE c.id>9
                    AND c.blocked=0
                    AND c.archived=1
-                 GROUP BY c.id
-                 ORDER BY IFNULL(m.timestamp,c.created_timestamp) DESC, m.id DESC;",
-                    paramsv![MessageState::OutDraft],
+                 ORDER BY IFNULL(c.last_msg_timestamp,c.created_timestamp) DESC, c.last_msg_id DESC;",
+                    paramsv![],
                     process_row,
                     process_rows,
                 )
@@ -207,22 +182,13 @@ pub async fn try_load(
             context
                 .sql
                 .query_map(
-                    "SELECT c.id, m.id
+                    "SELECT c.id, c.last_msg_id
                  FROM chats c
-                 LEFT JOIN msgs m
-                        ON c.id=m.chat_id
-                       AND m.id=(
-                               SELECT id
-                                 FROM msgs
-                                WHERE chat_id=c.id
-                                  AND (hidden=0 OR state=?1)
-                                  ORDER BY timestamp DESC, id DESC LIMIT 1)
-                 WHERE c.id>9 AND c.id!=?2
+                 WHERE c.id>9 AND c.id!=?1
                    AND c.blocked=0
-                   AND c.name LIKE ?3
-                 GROUP BY c.id
-                 ORDER BY IFNULL(m.timestamp,c.created_timestamp) DESC, m.id DESC;",
-                    paramsv![MessageState::OutDraft, skip_id, str_like_cmd],
+                   AND c.name LIKE ?2
+                 ORDER BY IFNULL(c.last_msg_timestamp,c.created_timestamp) DESC, c.last_msg_id DESC;",
+                    paramsv![skip_id, str_like_cmd],
                     process_row,
                     process_rows,
                 )
@@ -237,22 +203,13 @@ pub async fn try_load(
                 ChatId::new(0)
             };
             let mut ids = context.sql.query_map(
-                "SELECT c.id, m.id
+                "SELECT c.id, c.last_msg_id
                  FROM chats c
-                 LEFT JOIN msgs m
-                        ON c.id=m.chat_id
-                       AND m.id=(
-                               SELECT id
-                                 FROM msgs
-                                WHERE chat_id=c.id
-                                  AND (hidden=0 OR state=?1)
-                                  ORDER BY timestamp DESC, id DESC LIMIT 1)
-                 WHERE c.id>9 AND c.id!=?2
+                 WHERE c.id>9 AND c.id!=?1
                    AND c.blocked=0
-                   AND NOT c.archived=?3
-                 GROUP BY c.id
-                 ORDER BY c.id=?4 DESC, c.archived=?5 DESC, IFNULL(m.timestamp,c.created_timestamp) DESC, m.id DESC;",
-                paramsv![MessageState::OutDraft, skip_id, ChatVisibility::Archived, sort_id_up, ChatVisibility::Pinned],
+                   AND NOT c.archived=?2
+                 ORDER BY c.id=?3 DESC, c.archived=?4 DESC, IFNULL(c.last_msg_timestamp,c.created_timestamp) DESC, c.last_msg_id DESC;",
+                paramsv![skip_id, ChatVisibility::Archived, sort_id_up, ChatVisibility::Pinned],
                 process_row,
                 process_rows,
             ).await?;
@@ -393,6 +350,134 @@ pub async fn get_summary2(
     pub fn get_index_for_id(&self, id: ChatId) -> Option<usize> {
         self.ids.iter().position(|(chat_id, _)| chat_id == &id)
     }
+
+    /// Returns the changes needed to turn this chatlist into the `newer` one.
+    ///
+    /// This allows the UI to update only the affected rows instead of redrawing
+    /// the whole list when a new chatlist is loaded after `DC_EVENT_MSGS_CHANGED`.
+    /// Removed chats are reported first, with their index in this list.
+    /// Then inserted, moved and updated chats are reported with their index in the `newer` list,
+    /// ordered by this index.
+    /// Only chats that changed their position relative to other chats are reported as moved,
+    /// so when a chat moves to the top, the chats it moves over are not reported.
+    pub fn diff(&self, newer: &Chatlist) -> Vec<ChatlistChange> {
+        let old: HashMap<ChatId, (usize, Option<MsgId>)> = self
+            .ids
+            .iter()
+            .enumerate()
+            .map(|(index, (chat_id, msg_id))| (*chat_id, (index, *msg_id)))
+            .collect();
+        let new: HashMap<ChatId, usize> = newer
+            .ids
+            .iter()
+            .enumerate()
+            .map(|(index, (chat_id, _))| (*chat_id, index))
+            .collect();
+
+        let mut changes: Vec<ChatlistChange> = self
+            .ids
+            .iter()
+            .enumerate()
+            .filter(|(_, (chat_id, _))| !new.contains_key(chat_id))
+            .map(|(old_index, (chat_id, _))| ChatlistChange::Removed {
+                old_index,
+                chat_id: *chat_id,
+            })
+            .collect();
+
+        // Chats present in both lists, in the new order, keep their relative position
+        // if they are part of the longest sequence with increasing old positions.
+        let kept: Vec<(usize, usize)> = newer
+            .ids
+            .iter()
+            .enumerate()
+            .filter_map(|(index, (chat_id, _))| {
+                old.get(chat_id).map(|(old_index, _)| (index, *old_index))
+            })
+            .collect();
+        let old_positions: Vec<usize> = kept.iter().map(|(_, old_index)| *old_index).collect();
+        let mut unmoved = vec![false; newer.ids.len()];
+        for i in longest_increasing_subsequence(&old_positions) {
+            if let Some((index, _)) = kept.get(i) {
+                if let Some(unmoved) = unmoved.get_mut(*index) {
+                    *unmoved = true;
+                }
+            }
+        }
+
+        for (index, (chat_id, msg_id)) in newer.ids.iter().enumerate() {
+            let chat_id = *chat_id;
+            match old.get(&chat_id) {
+                None => changes.push(ChatlistChange::Inserted { index, chat_id }),
+                Some((old_index, old_msg_id)) => {
+                    if !unmoved.get(index).copied().unwrap_or_default() {
+                        changes.push(ChatlistChange::Moved {
+                            old_index: *old_index,
+                            index,
+                            chat_id,
+                        });
+                    } else if old_msg_id != msg_id {
+                        changes.push(ChatlistChange::Updated { index, chat_id });
+                    }
+                }
+            }
+        }
+
+        changes
+    }
+}
+
+/// A change between two chatlists, as returned by [`Chatlist::diff`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ChatlistChange {
+    /// The chat was at `old_index` in the old list and is not in the new list.
+    Removed { old_index: usize, chat_id: ChatId },
+
+    /// The chat is at `index` in the new list and was not in the old list.
+    Inserted { index: usize, chat_id: ChatId },
+
+    /// The chat moved from `old_index` in the old list to `index` in the new list.
+    ///
+    /// Its last message may have changed as well.
+    Moved {
+        old_index: usize,
+        index: usize,
+        chat_id: ChatId,
+    },
+
+    /// The chat kept its position, now at `index` in the new list, but its last message changed.
+    Updated { index: usize, chat_id: ChatId },
+}
+
+/// Returns the indices of a longest strictly increasing subsequence of `seq`.
+#[allow(clippy::indexing_slicing)]
+fn longest_increasing_subsequence(seq: &[usize]) -> Vec<usize> {
+    // `tails[k]` is the index of the smallest last element
+    // of all increasing subsequences of length `k + 1`.
+    let mut tails: Vec<usize> = Vec::new();
+    let mut prev: Vec<Option<usize>> = vec![None; seq.len()];
+    for (i, x) in seq.iter().enumerate() {
+        let pos = match tails.binary_search_by(|t| seq[*t].cmp(x)) {
+            Ok(pos) | Err(pos) => pos,
+        };
+        if pos > 0 {
+            prev[i] = Some(tails[pos - 1]);
+        }
+        if pos == tails.len() {
+            tails.push(i);
+        } else {
+            tails[pos] = i;
+        }
+    }
+
+    let mut res = Vec::with_capacity(tails.len());
+    let mut cur = tails.last().copied();
+    while let Some(i) = cur {
+        res.push(i);
+        cur = prev[i];
+    }
+    res.reverse();
+    res
 }
 
 /// Returns the number of archived chats
@@ -487,6 +572,111 @@ async fn test_try_load() {
         assert_eq!(chats.len(), 1);
     }
 
+    #[test]
+    fn test_longest_increasing_subsequence() {
+        assert!(longest_increasing_subsequence(&[]).is_empty());
+        assert_eq!(longest_increasing_subsequence(&[5]), vec![0]);
+        assert_eq!(longest_increasing_subsequence(&[0, 1, 2]), vec![0, 1, 2]);
+        assert_eq!(longest_increasing_subsequence(&[2, 0, 1]), vec![1, 2]);
+        assert_eq!(longest_increasing_subsequence(&[1, 2, 0]), vec![0, 1]);
+        assert_eq!(longest_increasing_subsequence(&[3, 0, 4, 1, 2]).len(), 3);
+    }
+
+    #[test]
+    fn test_diff() {
+        let a = ChatId::new(10);
+        let b = ChatId::new(11);
+        let c = ChatId::new(12);
+        let d = ChatId::new(13);
+        let old = Chatlist {
+            ids: vec![
+                (a, Some(MsgId::new(1))),
+                (b, None),
+                (c, Some(MsgId::new(3))),
+            ],
+        };
+        assert!(old.diff(&old).is_empty());
+
+        // `c` got a new message and moved to the top, `b` was removed, `d` was added.
+        let new = Chatlist {
+            ids: vec![
+                (c, Some(MsgId::new(4))),
+                (a, Some(MsgId::new(1))),
+                (d, None),
+            ],
+        };
+        assert_eq!(
+            old.diff(&new),
+            vec![
+                ChatlistChange::Removed {
+                    old_index: 1,
+                    chat_id: b
+                },
+                ChatlistChange::Moved {
+                    old_index: 2,
+                    index: 0,
+                    chat_id: c
+                },
+                ChatlistChange::Inserted {
+                    index: 2,
+                    chat_id: d
+                },
+            ]
+        );
+
+        // Last message changed without moving.
+        let newer = Chatlist {
+            ids: vec![
+                (c, Some(MsgId::new(5))),
+                (a, Some(MsgId::new(1))),
+                (d, None),
+            ],
+        };
+        assert_eq!(
+            new.diff(&newer),
+            vec![ChatlistChange::Updated {
+                index: 0,
+                chat_id: c
+            }]
+        );
+    }
+
+    #[async_std::test]
+    async fn test_last_msg_maintained() -> anyhow::Result<()> {
+        let t = TestContext::new_alice().await;
+        let chat_id1 = create_group_chat(&t, ProtectionStatus::Unprotected, "a chat").await?;
+        let chat_id2 = create_group_chat(&t, ProtectionStatus::Unprotected, "b chat").await?;
+
+        // New groups have a draft, which is shown in the chatlist.
+        let chats = Chatlist::try_load(&t, 0, None, None).await?;
+        assert_eq!(chats.get_chat_id(0), chat_id2);
+        assert_eq!(chats.get_chat_id(1), chat_id1);
+        let draft_id1 = chats.get_msg_id(1)?;
+        assert!(draft_id1.is_some());
+
+        let msg_id = crate::chat::send_text_msg(&t, chat_id1, "hello".to_string()).await?;
+        let new_chats = Chatlist::try_load(&t, 0, None, None).await?;
+        assert_eq!(new_chats.get_chat_id(0), chat_id1);
+        assert_eq!(new_chats.get_msg_id(0)?, Some(msg_id));
+        assert_eq!(
+            chats.diff(&new_chats),
+            vec![ChatlistChange::Moved {
+                old_index: 1,
+                index: 0,
+                chat_id: chat_id1
+            }]
+        );
+
+        // Deleting the last message falls back to the previous one.
+        message::delete_msgs(&t, &[msg_id]).await;
+        let chats = Chatlist::try_load(&t, 0, None, None).await?;
+        assert_eq!(chats.get_chat_id(0), chat_id2);
+        assert_eq!(chats.get_chat_id(1), chat_id1);
+        assert_eq!(chats.get_msg_id(1)?, draft_id1);
+
+        Ok(())
+    }
+
     #[async_std::test]
     async fn test_sort_self_talk_up_on_forward() {
         let t = TestContext::new().await;
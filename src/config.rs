@@ -5,13 +5,11 @@
 use strum_macros::{AsRefStr, Display, EnumIter, EnumProperty, EnumString};
 
 use crate::blob::BlobObject;
-use crate::chat::ChatId;
 use crate::constants::DC_VERSION_STR;
 use crate::context::Context;
 use crate::dc_tools::{dc_get_abs_path, improve_single_line_input};
-use crate::events::EventType;
+use crate::ephemeral;
 use crate::job;
-use crate::message::MsgId;
 use crate::mimefactory::RECOMMENDED_FILE_SIZE;
 use crate::provider::{get_provider_by_id, Provider};
 use crate::stock_str;
@@ -250,7 +248,7 @@ pub async fn get_config_delete_device_after(&self) -> Result<Option<i64>> {
     /// Set the given config key.
     /// If `None` is passed as a value the value is cleared and set to the default if there is one.
     pub async fn set_config(&self, key: Config, value: Option<&str>) -> Result<()> {
-        match key {
+        let ret: Result<()> = match key {
             Config::Selfavatar => {
                 self.sql
                     .execute("UPDATE contacts SET selfavatar_sent=0;", paramsv![])
@@ -288,11 +286,9 @@ pub async fn set_config(&self, key: Config, value: Option<&str>) -> Result<()> {
                     .set_raw_config(key, value)
                     .await
                     .map_err(Into::into);
-                // Force chatlist reload to delete old messages immediately.
-                self.emit_event(EventType::MsgsChanged {
-                    msg_id: MsgId::new(0),
-                    chat_id: ChatId::new(0),
-                });
+                // Delete old messages immediately,
+                // MsgsChanged is emitted if any message is deleted.
+                ephemeral::schedule_ephemeral_task_with_device_deletion(self).await;
                 ret
             }
             Config::Displayname => {
@@ -313,7 +309,10 @@ pub async fn set_config(&self, key: Config, value: Option<&str>) -> Result<()> {
                 self.sql.set_raw_config(key, value).await?;
                 Ok(())
             }
-        }
+        };
+        // The self contact is loaded from the config.
+        self.sql.read_cache.clear();
+        ret
     }
 
     pub async fn set_config_bool(&self, key: Config, value: bool) -> Result<()> {
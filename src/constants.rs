@@ -108,6 +108,11 @@ fn default() -> Self {
 pub const DC_GCL_ADD_ALLDONE_HINT: usize = 0x04;
 pub const DC_GCL_FOR_FORWARDING: usize = 0x08;
 
+pub const DC_CHATLIST_CHANGE_REMOVED: u32 = 1;
+pub const DC_CHATLIST_CHANGE_INSERTED: u32 = 2;
+pub const DC_CHATLIST_CHANGE_MOVED: u32 = 3;
+pub const DC_CHATLIST_CHANGE_UPDATED: u32 = 4;
+
 pub const DC_GCM_ADDDAYMARKER: u32 = 0x01;
 pub const DC_GCM_INFO_ONLY: u32 = 0x02;
 
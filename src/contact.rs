@@ -8,6 +8,7 @@
 use itertools::Itertools;
 use once_cell::sync::Lazy;
 use regex::Regex;
+use rusqlite::OptionalExtension;
 
 use crate::aheader::EncryptPreference;
 use crate::chat::ChatId;
@@ -40,7 +41,7 @@
 /// authorized name and given name.
 /// By default, these names are equal, but functions working with contact names
 /// only affect the given name.
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Contact {
     /// The contact ID.
     ///
@@ -481,6 +482,7 @@ pub(crate) async fn add_or_lookup(
                     )
                     .await
                     .ok();
+                context.sql.read_cache.invalidate_contact(row_id);
 
                 if update_name {
                     // Update the contact name also if it is used as a group name.
@@ -568,24 +570,104 @@ pub(crate) async fn add_or_lookup(
     ///
     /// Returns the number of modified contacts.
     pub async fn add_address_book(context: &Context, addr_book: &str) -> Result<usize> {
-        let mut modify_cnt = 0;
+        let addr_self = context
+            .get_config(Config::ConfiguredAddr)
+            .await?
+            .unwrap_or_default();
 
+        let mut entries = Vec::new();
         for (name, addr) in split_address_book(addr_book).into_iter() {
             let (name, addr) = sanitize_name_and_addr(name, addr);
             let name = normalize_name(name);
-            match Contact::add_or_lookup(context, &name, &addr, Origin::AddressBook).await {
-                Err(err) => {
-                    warn!(
-                        context,
-                        "Failed to add address {} from address book: {}", addr, err
-                    );
-                }
-                Ok((_, modified)) => {
-                    if modified != Modifier::None {
-                        modify_cnt += 1
+            let addr = addr_normalize(&addr).to_string();
+            if addr.is_empty() || addr_cmp(&addr, &addr_self) {
+                continue;
+            }
+            if !may_be_valid_addr(&addr) {
+                warn!(
+                    context,
+                    "Failed to add address {} from address book: Bad address supplied", addr
+                );
+                continue;
+            }
+            entries.push((name, addr));
+        }
+
+        // All entries are written in one transaction with prepared statements,
+        // this is much faster than calling add_or_lookup() for every entry.
+        // The rows are updated like add_or_lookup() does for Origin::AddressBook.
+        let (modify_cnt, modified_chats) = context
+            .sql
+            .transaction(move |transaction| {
+                let mut select_stmt = transaction.prepare(
+                    "SELECT id, name, addr, origin FROM contacts WHERE addr=? COLLATE NOCASE;",
+                )?;
+                let mut update_stmt = transaction
+                    .prepare("UPDATE contacts SET name=?, addr=?, origin=? WHERE id=?;")?;
+                let mut insert_stmt = transaction.prepare(
+                    "INSERT INTO contacts (name, addr, origin, authname) VALUES(?, ?, ?, '');",
+                )?;
+                // The name of the contact is also used as the name of its 1:1 chat.
+                let mut chat_stmt = transaction.prepare(
+                    "SELECT id FROM chats WHERE type=? \
+                     AND id IN(SELECT chat_id FROM chats_contacts WHERE contact_id=?);",
+                )?;
+                let mut chat_name_stmt = transaction.prepare(
+                    "UPDATE chats SET name=(\
+                       SELECT iif(name!='',name,iif(authname!='',authname,addr)) \
+                       FROM contacts WHERE id=?1) \
+                     WHERE id=?2 AND name!=(\
+                       SELECT iif(name!='',name,iif(authname!='',authname,addr)) \
+                       FROM contacts WHERE id=?1);",
+                )?;
+
+                let origin = Origin::AddressBook;
+                let mut modify_cnt = 0;
+                let mut modified_chats = Vec::new();
+                for (name, addr) in &entries {
+                    let row = select_stmt
+                        .query_row(paramsv![addr], |row| {
+                            let row_id: u32 = row.get(0)?;
+                            let row_name: String = row.get(1)?;
+                            let row_addr: String = row.get(2)?;
+                            let row_origin: Origin = row.get(3)?;
+                            Ok((row_id, row_name, row_addr, row_origin))
+                        })
+                        .optional()?;
+
+                    if let Some((row_id, row_name, row_addr, row_origin)) = row {
+                        let update_name = name != &row_name;
+                        let update_addr = origin >= row_origin && addr != &row_addr;
+                        if !(update_name || update_addr || origin > row_origin) {
+                            continue;
+                        }
+                        update_stmt.execute(paramsv![
+                            if update_name { name } else { &row_name },
+                            if update_addr { addr } else { &row_addr },
+                            origin.max(row_origin),
+                            row_id
+                        ])?;
+                        if update_name {
+                            let chat_id: Option<u32> = chat_stmt
+                                .query_row(paramsv![Chattype::Single, row_id], |row| row.get(0))
+                                .optional()?;
+                            if let Some(chat_id) = chat_id {
+                                if chat_name_stmt.execute(paramsv![row_id, chat_id])? > 0 {
+                                    modified_chats.push(ChatId::new(chat_id));
+                                }
+                            }
+                        }
+                    } else {
+                        insert_stmt.execute(paramsv![name, addr, origin])?;
                     }
+                    modify_cnt += 1;
                 }
-            }
+                Ok((modify_cnt, modified_chats))
+            })
+            .await?;
+
+        for chat_id in modified_chats {
+            context.emit_event(EventType::ChatModified(chat_id));
         }
         if modify_cnt > 0 {
             context.emit_event(EventType::ContactsChanged(None));
@@ -619,25 +701,38 @@ pub async fn get_all(
         let flag_add_self = (listflags & DC_GCL_ADD_SELF) != 0;
 
         if flag_verified_only || query.is_some() {
-            let s3str_like_cmd = format!("%{}%", query.as_ref().map(|s| s.as_ref()).unwrap_or(""));
+            let query_str = query.as_ref().map(|s| s.as_ref()).unwrap_or("");
+            let (query_cond, query_param) =
+                match context.fts_query("contacts_fts", query_str).await? {
+                    Some(fts_query) => (
+                        "c.id IN (SELECT rowid FROM contacts_fts WHERE contacts_fts MATCH ?4)",
+                        fts_query,
+                    ),
+                    None => (
+                        "(iif(c.name='',c.authname,c.name) LIKE ?4 OR c.addr LIKE ?4)",
+                        format!("%{}%", query_str),
+                    ),
+                };
             context
                 .sql
                 .query_map(
-                    "SELECT c.id FROM contacts c \
+                    format!(
+                        "SELECT c.id FROM contacts c \
                  LEFT JOIN acpeerstates ps ON c.addr=ps.addr  \
                  WHERE c.addr!=?1 \
                  AND c.id>?2 \
                  AND c.origin>=?3 \
                  AND c.blocked=0 \
-                 AND (iif(c.name='',c.authname,c.name) LIKE ?4 OR c.addr LIKE ?5) \
-                 AND (1=?6 OR LENGTH(ps.verified_key_fingerprint)!=0)  \
+                 AND {} \
+                 AND (1=?5 OR LENGTH(ps.verified_key_fingerprint)!=0)  \
                  ORDER BY LOWER(iif(c.name='',c.authname,c.name)||c.addr),c.id;",
+                        query_cond
+                    ),
                     paramsv![
                         self_addr,
                         DC_CONTACT_ID_LAST_SPECIAL as i32,
                         Origin::IncomingReplyTo,
-                        s3str_like_cmd,
-                        s3str_like_cmd,
+                        query_param,
                         if flag_verified_only { 0i32 } else { 1i32 },
                     ],
                     |row| row.get::<_, i32>(0),
@@ -742,6 +837,7 @@ async fn update_blocked_mailinglist_contacts(context: &Context) -> Result<()> {
                 )
                 .await?;
         }
+        context.sql.read_cache.clear();
         Ok(())
     }
 
@@ -906,6 +1002,23 @@ pub async fn get_by_id(context: &Context, contact_id: u32) -> Result<Contact> {
         Ok(contact)
     }
 
+    /// Loads a contact like [Contact::get_by_id], but returns a cached snapshot if possible.
+    ///
+    /// The snapshot is updated when the contact is changed, this is meant for displaying
+    /// contacts. Functions which modify the contact should use [Contact::get_by_id].
+    pub async fn get_by_id_cached(context: &Context, contact_id: u32) -> Result<Contact> {
+        if let Some(contact) = context.sql.read_cache.get_contact(contact_id) {
+            return Ok(contact);
+        }
+        let generation = context.sql.read_cache.contact_generation();
+        let contact = Contact::load_from_db(context, contact_id).await?;
+        context
+            .sql
+            .read_cache
+            .insert_contact(contact.clone(), generation);
+        Ok(contact)
+    }
+
     /// Updates `param` column in the database.
     pub async fn update_param(&self, context: &Context) -> Result<()> {
         context
@@ -915,6 +1028,7 @@ pub async fn update_param(&self, context: &Context) -> Result<()> {
                 paramsv![self.param.to_string(), self.id as i32],
             )
             .await?;
+        context.sql.read_cache.invalidate_contact(self.id);
         Ok(())
     }
 
@@ -927,6 +1041,7 @@ pub async fn update_status(&self, context: &Context) -> Result<()> {
                 paramsv![self.status, self.id as i32],
             )
             .await?;
+        context.sql.read_cache.invalidate_contact(self.id);
         Ok(())
     }
 
@@ -1114,14 +1229,16 @@ pub async fn real_exists_by_id(context: &Context, contact_id: u32) -> bool {
     }
 
     pub async fn scaleup_origin_by_id(context: &Context, contact_id: u32, origin: Origin) -> bool {
-        context
+        let ok = context
             .sql
             .execute(
                 "UPDATE contacts SET origin=? WHERE id=? AND origin<?;",
                 paramsv![origin, contact_id as i32, origin],
             )
             .await
-            .is_ok()
+            .is_ok();
+        context.sql.read_cache.invalidate_contact(contact_id);
+        ok
     }
 }
 
@@ -1608,6 +1725,37 @@ async fn test_add_or_lookup() {
         assert!(!contact.is_blocked());
     }
 
+    #[async_std::test]
+    async fn test_add_address_book_updates_chat_name() -> Result<()> {
+        let t = TestContext::new().await;
+        let contact_id = Contact::create(&t, "", "bob@example.net").await?;
+        let chat_id = ChatId::create_for_contact(&t, contact_id).await?;
+        assert_eq!(
+            chat::Chat::load_from_db(&t, chat_id).await?.get_name(),
+            "bob@example.net"
+        );
+
+        let book = "Bob Builder\nbob@example.net\nClaire\nclaire@example.org\n";
+        assert_eq!(Contact::add_address_book(&t, book).await?, 2);
+        assert_eq!(
+            chat::Chat::load_from_db(&t, chat_id).await?.get_name(),
+            "Bob Builder"
+        );
+
+        // Importing the same book again does not modify anything.
+        assert_eq!(Contact::add_address_book(&t, book).await?, 0);
+
+        // The search index is updated with the new names.
+        let contacts = Contact::get_all(&t, 0, Some("builder")).await?;
+        assert_eq!(contacts, vec![contact_id]);
+        let contacts = Contact::get_all(&t, 0, Some("example")).await?;
+        assert_eq!(contacts.len(), 2);
+        let contacts = Contact::get_all(&t, 0, Some("Cl")).await?;
+        assert_eq!(contacts.len(), 1);
+
+        Ok(())
+    }
+
     #[async_std::test]
     async fn test_delete() -> Result<()> {
         let alice = TestContext::new_alice().await;
@@ -1,8 +1,10 @@
 //! Context module
 
 use std::collections::{BTreeMap, HashMap};
+use std::convert::TryFrom;
 use std::ffi::OsString;
 use std::ops::Deref;
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::time::{Instant, SystemTime};
 
 use anyhow::{bail, ensure, Result};
@@ -18,7 +20,9 @@
 use crate::constants::DC_VERSION_STR;
 use crate::contact::Contact;
 use crate::dc_tools::{duration_to_str, time};
+use crate::ephemeral;
 use crate::events::{Event, EventEmitter, EventType, Events};
+use crate::job;
 use crate::key::{DcKey, SignedPublicKey};
 use crate::login_param::LoginParam;
 use crate::message::{self, MessageState, MsgId};
@@ -60,7 +64,16 @@ pub struct InnerContext {
     pub(crate) events: Events,
 
     pub(crate) scheduler: RwLock<Scheduler>,
+    pub(crate) job_schedule: job::Schedule,
     pub(crate) ephemeral_task: RwLock<Option<task::JoinHandle<()>>>,
+    pub(crate) expiry_stats: ephemeral::ExpiryStats,
+    /// When the ephemeral task deletes the messages expired according to
+    /// `delete_device_after` next, `None` if it should do so immediately.
+    pub(crate) next_device_deletion: Mutex<Option<Instant>>,
+    /// Set while housekeeping runs, in the background or inline.
+    pub(crate) housekeeping_running: AtomicBool,
+    /// Housekeeping running in the background, see [InnerContext::stop_housekeeping].
+    pub(crate) housekeeping_task: RwLock<Option<task::JoinHandle<()>>>,
 
     pub(crate) last_full_folder_scan: Mutex<Option<Instant>>,
 
@@ -138,7 +151,12 @@ pub(crate) async fn with_blobdir(
             translated_stockstrings: RwLock::new(HashMap::new()),
             events: Events::default(),
             scheduler: RwLock::new(Scheduler::Stopped),
+            job_schedule: Default::default(),
             ephemeral_task: RwLock::new(None),
+            expiry_stats: Default::default(),
+            next_device_deletion: Mutex::new(None),
+            housekeeping_running: AtomicBool::new(false),
+            housekeeping_task: RwLock::new(None),
             creation_time: std::time::SystemTime::now(),
             last_full_folder_scan: Mutex::new(None),
         };
@@ -159,6 +177,12 @@ pub async fn start_io(&self) {
             return;
         }
 
+        // The database may have been replaced while IO was stopped, e.g. by a backup import.
+        self.job_schedule.reset().await;
+
+        // Delete the messages which expired while IO was stopped.
+        ephemeral::schedule_ephemeral_task_with_device_deletion(self).await;
+
         {
             let l = &mut *self.inner.scheduler.write().await;
             if let Err(err) = l.start(self.clone()).await {
@@ -194,6 +218,7 @@ pub fn get_blobdir(&self) -> &Path {
 
     /// Emits a single event.
     pub fn emit_event(&self, event: EventType) {
+        self.sql.read_cache.invalidate(&event);
         self.events.emit(Event {
             id: self.id,
             typ: event,
@@ -208,6 +233,14 @@ pub fn get_event_emitter(&self) -> EventEmitter {
         self.events.get_emitter()
     }
 
+    /// Sets the IDs of the events which should not be emitted at all.
+    ///
+    /// The IDs are the `DC_EVENT_*` constants, see [`EventType::as_id`].
+    /// Replaces the previously set IDs, an empty slice emits all events again.
+    pub fn set_ignored_events(&self, event_ids: &[i32]) {
+        self.events.set_ignored(event_ids);
+    }
+
     /// Get the ID of this context.
     pub fn get_id(&self) -> u32 {
         self.id
@@ -415,6 +448,25 @@ pub async fn get_info(&self) -> Result<BTreeMap<&'static str, String>> {
                 .await?
                 .to_string(),
         );
+        let (config_cache_hits, config_cache_misses) = self.sql.config_cache_stats();
+        res.insert("config_cache_hits", config_cache_hits.to_string());
+        res.insert("config_cache_misses", config_cache_misses.to_string());
+        res.insert(
+            "expiry_passes",
+            self.expiry_stats.passes.load(Ordering::Relaxed).to_string(),
+        );
+        res.insert(
+            "expired_msgs_deleted",
+            self.expiry_stats
+                .deleted
+                .load(Ordering::Relaxed)
+                .to_string(),
+        );
+        res.insert("events_dropped", self.events.dropped_count().to_string());
+        res.insert(
+            "events_coalesced",
+            self.events.coalesced_count().to_string(),
+        );
 
         let elapsed = self.creation_time.elapsed();
         res.insert("uptime", duration_to_str(elapsed.unwrap_or_default()));
@@ -470,7 +522,7 @@ pub async fn search_msgs(&self, chat_id: Option<ChatId>, query: &str) -> Result<
         if real_query.is_empty() {
             return Ok(Vec::new());
         }
-        let str_like_in_text = format!("%{}%", real_query);
+        let (text_cond, text_param) = self.search_condition(real_query).await?;
 
         let do_query = |query, params| {
             self.sql.query_map(
@@ -489,16 +541,19 @@ pub async fn search_msgs(&self, chat_id: Option<ChatId>, query: &str) -> Result<
 
         let list = if let Some(chat_id) = chat_id {
             do_query(
-                "SELECT m.id AS id, m.timestamp AS timestamp
-                 FROM msgs m
-                 LEFT JOIN contacts ct
-                        ON m.from_id=ct.id
-                 WHERE m.chat_id=?
-                   AND m.hidden=0
-                   AND ct.blocked=0
-                   AND txt LIKE ?
-                 ORDER BY m.timestamp,m.id;",
-                paramsv![chat_id, str_like_in_text],
+                format!(
+                    "SELECT m.id AS id, m.timestamp AS timestamp
+                     FROM msgs m
+                     LEFT JOIN contacts ct
+                            ON m.from_id=ct.id
+                     WHERE m.chat_id=?
+                       AND m.hidden=0
+                       AND ct.blocked=0
+                       AND {}
+                     ORDER BY m.timestamp,m.id;",
+                    text_cond
+                ),
+                paramsv![chat_id, text_param],
             )
             .await?
         } else {
@@ -513,19 +568,22 @@ pub async fn search_msgs(&self, chat_id: Option<ChatId>, query: &str) -> Result<
             // According to some tests, this limit speeds up eg. 2 character searches by factor 10.
             // The limit is documented and UI may add a hint when getting 1000 results.
             do_query(
-                "SELECT m.id AS id, m.timestamp AS timestamp
-                 FROM msgs m
-                 LEFT JOIN contacts ct
-                        ON m.from_id=ct.id
-                 LEFT JOIN chats c
-                        ON m.chat_id=c.id
-                 WHERE m.chat_id>9
-                   AND m.hidden=0
-                   AND c.blocked=0
-                   AND ct.blocked=0
-                   AND m.txt LIKE ?
-                 ORDER BY m.id DESC LIMIT 1000",
-                paramsv![str_like_in_text],
+                format!(
+                    "SELECT m.id AS id, m.timestamp AS timestamp
+                     FROM msgs m
+                     LEFT JOIN contacts ct
+                            ON m.from_id=ct.id
+                     LEFT JOIN chats c
+                            ON m.chat_id=c.id
+                     WHERE m.chat_id>9
+                       AND m.hidden=0
+                       AND c.blocked=0
+                       AND ct.blocked=0
+                       AND {}
+                     ORDER BY m.id DESC LIMIT 1000",
+                    text_cond
+                ),
+                paramsv![text_param],
             )
             .await?
         };
@@ -533,6 +591,112 @@ pub async fn search_msgs(&self, chat_id: Option<ChatId>, query: &str) -> Result<
         Ok(list)
     }
 
+    /// Searches for messages containing the query string, best matches first.
+    ///
+    /// Works like [`Context::search_msgs`], but results are ordered by relevance
+    /// and only the `limit` results following the first `offset` ones are returned,
+    /// so the UI can load results page by page.
+    /// Relevance ranking uses the full-text index and needs a query of at least
+    /// three characters, shorter queries return the newest messages first.
+    pub async fn search_msgs_ranked(
+        &self,
+        chat_id: Option<ChatId>,
+        query: &str,
+        offset: usize,
+        limit: usize,
+    ) -> Result<Vec<MsgId>> {
+        let real_query = query.trim();
+        if real_query.is_empty() || limit == 0 {
+            return Ok(Vec::new());
+        }
+        let offset = i64::try_from(offset)?;
+        let limit = i64::try_from(limit)?;
+
+        let (from, text_cond, text_param, order) =
+            if let Some(fts_query) = self.fts_query("msgs_fts", real_query).await? {
+                (
+                    "msgs_fts INNER JOIN msgs m ON m.id=msgs_fts.rowid",
+                    "msgs_fts MATCH ?",
+                    fts_query,
+                    "msgs_fts.rank, m.id DESC",
+                )
+            } else {
+                (
+                    "msgs m",
+                    "m.txt LIKE ?",
+                    format!("%{}%", real_query),
+                    "m.id DESC",
+                )
+            };
+
+        let mut params: Vec<&dyn crate::ToSql> = Vec::new();
+        let chat_cond = if let Some(chat_id) = chat_id.as_ref() {
+            params.push(chat_id);
+            "m.chat_id=?"
+        } else {
+            "m.chat_id>9 AND c.blocked=0"
+        };
+        params.push(&text_param);
+        params.push(&limit);
+        params.push(&offset);
+
+        let list = self
+            .sql
+            .query_map(
+                format!(
+                    "SELECT m.id AS id
+                     FROM {}
+                     LEFT JOIN contacts ct
+                            ON m.from_id=ct.id
+                     LEFT JOIN chats c
+                            ON m.chat_id=c.id
+                     WHERE {}
+                       AND m.hidden=0
+                       AND ct.blocked=0
+                       AND {}
+                     ORDER BY {} LIMIT ? OFFSET ?;",
+                    from, chat_cond, text_cond, order
+                ),
+                rusqlite::params_from_iter(params),
+                |row| row.get::<_, MsgId>("id"),
+                |rows| {
+                    let mut ret = Vec::new();
+                    for id in rows {
+                        ret.push(id?);
+                    }
+                    Ok(ret)
+                },
+            )
+            .await?;
+
+        Ok(list)
+    }
+
+    /// Returns an SQL condition on `msgs m` matching `query` and its parameter.
+    ///
+    /// Uses the full-text index if possible, `LIKE` otherwise.
+    async fn search_condition(&self, query: &str) -> Result<(&'static str, String)> {
+        if let Some(fts_query) = self.fts_query("msgs_fts", query).await? {
+            Ok((
+                "m.id IN (SELECT rowid FROM msgs_fts WHERE msgs_fts MATCH ?)",
+                fts_query,
+            ))
+        } else {
+            Ok(("m.txt LIKE ?", format!("%{}%", query)))
+        }
+    }
+
+    /// Returns the FTS5 query matching `query` as a substring in the full-text index `table`
+    /// or `None` if the index cannot be used for it.
+    ///
+    /// The trigram tokenizer can only match strings of at least three characters.
+    pub(crate) async fn fts_query(&self, table: &str, query: &str) -> Result<Option<String>> {
+        if query.chars().count() < 3 || !self.sql.table_exists(table).await? {
+            return Ok(None);
+        }
+        Ok(Some(format!("\"{}\"", query.replace('"', "\"\""))))
+    }
+
     pub async fn is_inbox(&self, folder_name: &str) -> Result<bool> {
         let inbox = self.get_config(Config::ConfiguredInboxFolder).await?;
         Ok(inbox.as_deref() == Some(folder_name))
@@ -581,6 +745,19 @@ async fn stop_io(&self) {
         if let Some(ephemeral_task) = self.ephemeral_task.write().await.take() {
             ephemeral_task.cancel().await;
         }
+        self.stop_housekeeping().await;
+    }
+
+    /// Cancels housekeeping running in the background.
+    ///
+    /// Housekeeping deletes files which are not referenced by the database,
+    /// so it must not run while the database or the blobs are replaced.
+    /// Cancelled housekeeping continues with the interrupted step next time.
+    pub(crate) async fn stop_housekeeping(&self) {
+        if let Some(housekeeping_task) = self.housekeeping_task.write().await.take() {
+            housekeeping_task.cancel().await;
+            self.housekeeping_running.store(false, Ordering::SeqCst);
+        }
     }
 }
 
@@ -971,4 +1148,71 @@ async fn test_limit_search_msgs() -> Result<()> {
 
         Ok(())
     }
+
+    #[async_std::test]
+    async fn test_search_msgs_ranked() -> Result<()> {
+        let alice = TestContext::new_alice().await;
+        let chat = alice
+            .create_chat_with_contact("Bob", "bob@example.org")
+            .await;
+
+        let mut msg1 = Message::new(Viewtype::Text);
+        msg1.set_text(Some("foobar".to_string()));
+        send_msg(&alice, chat.id, &mut msg1).await?;
+
+        let mut msg2 = Message::new(Viewtype::Text);
+        msg2.set_text(Some("foo foo foo, a lot of foo".to_string()));
+        send_msg(&alice, chat.id, &mut msg2).await?;
+
+        let mut msg3 = Message::new(Viewtype::Text);
+        msg3.set_text(Some("nothing to see here".to_string()));
+        send_msg(&alice, chat.id, &mut msg3).await?;
+
+        // The message mentioning "foo" more often is the better match.
+        let res = alice.search_msgs_ranked(None, "foo", 0, 10).await?;
+        assert_eq!(res, vec![msg2.id, msg1.id]);
+
+        // Pagination.
+        let res = alice.search_msgs_ranked(None, "foo", 1, 10).await?;
+        assert_eq!(res, vec![msg1.id]);
+        let res = alice.search_msgs_ranked(Some(chat.id), "foo", 0, 1).await?;
+        assert_eq!(res, vec![msg2.id]);
+        let res = alice.search_msgs_ranked(None, "foo", 2, 10).await?;
+        assert!(res.is_empty());
+
+        // Short queries are not ranked, newer messages come first.
+        let res = alice.search_msgs_ranked(None, "oo", 0, 10).await?;
+        assert_eq!(res, vec![msg2.id, msg1.id]);
+
+        // Query syntax is not interpreted.
+        let res = alice
+            .search_msgs_ranked(None, "foo\" OR \"see", 0, 10)
+            .await?;
+        assert!(res.is_empty());
+
+        Ok(())
+    }
+
+    #[async_std::test]
+    async fn test_search_msgs_index_updated() -> Result<()> {
+        let alice = TestContext::new_alice().await;
+        let chat = alice
+            .create_chat_with_contact("Bob", "bob@example.org")
+            .await;
+
+        let mut msg = Message::new(Viewtype::Text);
+        msg.set_text(Some("hello indexed world".to_string()));
+        send_msg(&alice, chat.id, &mut msg).await?;
+        assert_eq!(alice.search_msgs(None, "indexed").await?, vec![msg.id]);
+
+        // Trashed messages are removed from the index.
+        message::delete_msgs(&alice, &[msg.id]).await;
+        assert!(alice.search_msgs(None, "indexed").await?.is_empty());
+        assert!(alice
+            .search_msgs_ranked(None, "indexed", 0, 10)
+            .await?
+            .is_empty());
+
+        Ok(())
+    }
 }
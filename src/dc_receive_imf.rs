@@ -25,6 +25,7 @@
 use crate::job::{self, Action};
 use crate::log::LogExt;
 use crate::message::{self, rfc724_mid_exists, Message, MessageState, MessengerMessage, MsgId};
+use crate::metrics;
 use crate::mimeparser::{
     parse_message_ids, AvatarAction, MailinglistType, MimeMessage, SystemMessage,
 };
@@ -66,6 +67,7 @@ pub(crate) async fn dc_receive_imf_inner(
     seen: bool,
     fetching_existing_messages: bool,
 ) -> Result<()> {
+    let _timer = metrics::start(metrics::Span::ReceiveImf);
     info!(
         context,
         "Receiving message {}/{}, seen={}...", server_folder, server_uid, seen
@@ -947,7 +949,7 @@ async fn add_parts(
     let mut is_hidden = is_hidden;
     let mut ids = Vec::with_capacity(parts.len());
 
-    let conn = context.sql.get_conn().await?;
+    let conn = context.sql.get_write_conn().await?;
 
     for part in &mut parts {
         let mut txt_raw = "".to_string();
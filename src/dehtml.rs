@@ -2,16 +2,14 @@
 //!
 //! A module to remove HTML tags from the email text
 
+use std::borrow::Cow;
 use std::io::BufRead;
 
-use once_cell::sync::Lazy;
 use quick_xml::{
     events::{BytesEnd, BytesStart, BytesText},
     Reader,
 };
 
-static LINE_RE: Lazy<regex::Regex> = Lazy::new(|| regex::Regex::new(r"(\r?\n)+").unwrap());
-
 struct Dehtml {
     strbuilder: String,
     add_text: AddText,
@@ -29,16 +27,18 @@ struct Dehtml {
 }
 
 impl Dehtml {
-    fn line_prefix(&self) -> &str {
+    fn line_prefix(&self) -> &'static str {
         if self.divs_since_quoted_content_div > 0 || self.blockquotes_since_blockquote > 0 {
             "> "
         } else {
             ""
         }
     }
-    fn append_prefix(&self, line_end: impl AsRef<str>) -> String {
+    fn push_line_end(&mut self, line_end: &str) {
         // line_end is e.g. "\n\n". We add "> " if necessary.
-        line_end.as_ref().to_owned() + self.line_prefix()
+        let prefix = self.line_prefix();
+        self.strbuilder.push_str(line_end);
+        self.strbuilder.push_str(prefix);
     }
     fn get_add_text(&self) -> AddText {
         if self.divs_since_quote_div > 0 && self.divs_since_quoted_content_div == 0 {
@@ -94,7 +94,7 @@ fn dehtml_quick_xml(buf: &str) -> String {
             }
             Ok(quick_xml::events::Event::End(ref e)) => dehtml_endtag_cb(e, &mut dehtml),
             Ok(quick_xml::events::Event::Text(ref e)) => dehtml_text_cb(e, &mut dehtml),
-            Ok(quick_xml::events::Event::CData(ref e)) => dehtml_cdata_cb(e, &mut dehtml),
+            Ok(quick_xml::events::Event::CData(ref e)) => dehtml_text_cb(e, &mut dehtml),
             Ok(quick_xml::events::Event::Empty(ref e)) => {
                 // Handle empty tags as a start tag immediately followed by end tag.
                 // For example, `<p/>` is treated as `<p></p>`.
@@ -118,52 +118,81 @@ fn dehtml_quick_xml(buf: &str) -> String {
 }
 
 fn dehtml_text_cb(event: &BytesText, dehtml: &mut Dehtml) {
-    if dehtml.get_add_text() == AddText::YesPreserveLineEnds
-        || dehtml.get_add_text() == AddText::YesRemoveLineEnds
-    {
+    let add_text = dehtml.get_add_text();
+    if add_text == AddText::YesPreserveLineEnds || add_text == AddText::YesRemoveLineEnds {
         let last_added = escaper::decode_html_buf_sloppy(event.escaped()).unwrap_or_default();
 
-        if dehtml.get_add_text() == AddText::YesRemoveLineEnds {
-            dehtml.strbuilder += LINE_RE.replace_all(&last_added, "\r").as_ref();
+        if add_text == AddText::YesRemoveLineEnds {
+            push_replacing_line_ends(&mut dehtml.strbuilder, &last_added, "\r");
         } else if !dehtml.line_prefix().is_empty() {
-            let l = dehtml.append_prefix("\n");
-            dehtml.strbuilder += LINE_RE.replace_all(&last_added, l.as_str()).as_ref();
+            let prefix = dehtml.line_prefix();
+            push_replacing_line_ends(
+                &mut dehtml.strbuilder,
+                &last_added,
+                &["\n", prefix].concat(),
+            );
         } else {
             dehtml.strbuilder += &last_added;
         }
     }
 }
 
-fn dehtml_cdata_cb(event: &BytesText, dehtml: &mut Dehtml) {
-    if dehtml.get_add_text() == AddText::YesPreserveLineEnds
-        || dehtml.get_add_text() == AddText::YesRemoveLineEnds
-    {
-        let last_added = escaper::decode_html_buf_sloppy(event.escaped()).unwrap_or_default();
-
-        if dehtml.get_add_text() == AddText::YesRemoveLineEnds {
-            dehtml.strbuilder += LINE_RE.replace_all(&last_added, "\r").as_ref();
-        } else if !dehtml.line_prefix().is_empty() {
-            let l = dehtml.append_prefix("\n");
-            dehtml.strbuilder += LINE_RE.replace_all(&last_added, l.as_str()).as_ref();
+/// Appends `text` to `out`, replacing each run of line ends (`\n` or `\r\n`) with `replacement`.
+///
+/// A `\r` which is not followed by `\n` is kept.
+#[allow(clippy::indexing_slicing)]
+fn push_replacing_line_ends(out: &mut String, text: &str, replacement: &str) {
+    let mut rest = text;
+    while let Some(pos) = rest.find('\n') {
+        let bytes = rest.as_bytes();
+        let run_start = if pos > 0 && bytes[pos - 1] == b'\r' {
+            pos - 1
         } else {
-            dehtml.strbuilder += &last_added;
+            pos
+        };
+        let mut run_end = pos + 1;
+        loop {
+            match bytes.get(run_end..run_end + 2) {
+                Some(b"\r\n") => run_end += 2,
+                _ if bytes.get(run_end) == Some(&b'\n') => run_end += 1,
+                _ => break,
+            }
+        }
+        out.push_str(&rest[..run_start]);
+        out.push_str(replacement);
+        rest = &rest[run_end..];
+    }
+    out.push_str(rest);
+}
+
+/// Returns the trimmed and lowercased tag or attribute name, without allocating if it is lowercase already.
+fn lowercase_name(name: &[u8]) -> Cow<str> {
+    match String::from_utf8_lossy(name) {
+        Cow::Borrowed(name) => {
+            let name = name.trim();
+            if name.chars().any(char::is_uppercase) {
+                Cow::Owned(name.to_lowercase())
+            } else {
+                Cow::Borrowed(name)
+            }
         }
+        Cow::Owned(name) => Cow::Owned(name.trim().to_lowercase()),
     }
 }
 
 fn dehtml_endtag_cb(event: &BytesEnd, dehtml: &mut Dehtml) {
-    let tag = String::from_utf8_lossy(event.name()).trim().to_lowercase();
+    let tag = lowercase_name(event.name());
 
-    match tag.as_str() {
+    match tag.as_ref() {
         "p" | "table" | "td" | "style" | "script" | "title" | "pre" => {
-            dehtml.strbuilder += &dehtml.append_prefix("\n\n");
+            dehtml.push_line_end("\n\n");
             dehtml.add_text = AddText::YesRemoveLineEnds;
         }
         "div" => {
             pop_tag(&mut dehtml.divs_since_quote_div);
             pop_tag(&mut dehtml.divs_since_quoted_content_div);
 
-            dehtml.strbuilder += &dehtml.append_prefix("\n\n");
+            dehtml.push_line_end("\n\n");
             dehtml.add_text = AddText::YesRemoveLineEnds;
         }
         "a" => {
@@ -193,11 +222,11 @@ fn dehtml_starttag_cb<B: std::io::BufRead>(
     dehtml: &mut Dehtml,
     reader: &quick_xml::Reader<B>,
 ) {
-    let tag = String::from_utf8_lossy(event.name()).trim().to_lowercase();
+    let tag = lowercase_name(event.name());
 
-    match tag.as_str() {
+    match tag.as_ref() {
         "p" | "table" | "td" => {
-            dehtml.strbuilder += &dehtml.append_prefix("\n\n");
+            dehtml.push_line_end("\n\n");
             dehtml.add_text = AddText::YesRemoveLineEnds;
         }
         #[rustfmt::skip]
@@ -205,25 +234,25 @@ fn dehtml_starttag_cb<B: std::io::BufRead>(
             maybe_push_tag(event, reader, "quote", &mut dehtml.divs_since_quote_div);
             maybe_push_tag(event, reader, "quoted-content", &mut dehtml.divs_since_quoted_content_div);
 
-            dehtml.strbuilder += &dehtml.append_prefix("\n\n");
+            dehtml.push_line_end("\n\n");
             dehtml.add_text = AddText::YesRemoveLineEnds;
         }
         "br" => {
-            dehtml.strbuilder += &dehtml.append_prefix("\n");
+            dehtml.push_line_end("\n");
             dehtml.add_text = AddText::YesRemoveLineEnds;
         }
         "style" | "script" | "title" => {
             dehtml.add_text = AddText::No;
         }
         "pre" => {
-            dehtml.strbuilder += &dehtml.append_prefix("\n\n");
+            dehtml.push_line_end("\n\n");
             dehtml.add_text = AddText::YesPreserveLineEnds;
         }
         "a" => {
             if let Some(href) = event
                 .html_attributes()
                 .filter_map(|attr| attr.ok())
-                .find(|attr| String::from_utf8_lossy(attr.key).trim().to_lowercase() == "href")
+                .find(|attr| lowercase_name(attr.key) == "href")
             {
                 let href = href
                     .unescape_and_decode_value(reader)
@@ -344,6 +373,24 @@ fn test_dehtml_parse_br() {
         assert_eq!(plain, "line1\n\r\r\rline2\nline3");
     }
 
+    #[test]
+    fn test_push_replacing_line_ends() {
+        let cases = vec![
+            ("", ""),
+            ("foo", "foo"),
+            ("\n", "|"),
+            ("a\nb", "a|b"),
+            ("a\r\n\n\r\nb\n", "a|b|"),
+            ("a\r\rb", "a\r\rb"),
+            ("a\r\r\n\rb", "a\r|\rb"),
+        ];
+        for (input, output) in cases {
+            let mut out = String::new();
+            push_replacing_line_ends(&mut out, input, "|");
+            assert_eq!(out, output);
+        }
+    }
+
     #[test]
     fn test_dehtml_parse_href() {
         let html = "<a href=url>text</a";
@@ -56,10 +56,12 @@
 //! the database entries which are expired either according to their
 //! ephemeral message timers or global `delete_server_after` setting.
 
+use std::cmp::min;
 use std::convert::{TryFrom, TryInto};
 use std::num::ParseIntError;
 use std::str::FromStr;
-use std::time::{Duration, SystemTime, UNIX_EPOCH};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 
 use anyhow::{ensure, Context as _, Result};
 use async_std::task;
@@ -296,16 +298,43 @@ pub(crate) async fn start_ephemeral_timer(self, context: &Context) -> anyhow::Re
     }
 }
 
+/// Interval of the `delete_device_after` passes done by the ephemeral task.
+///
+/// The setting is at least one hour, so there is no need to delete the
+/// messages more precisely.
+const DELETE_DEVICE_AFTER_INTERVAL: Duration = Duration::from_secs(60 * 60);
+
+/// Delay before the ephemeral task retries a pass which failed, e.g. because
+/// of a database error.
+const EPHEMERAL_RETRY_INTERVAL: Duration = Duration::from_secs(60);
+
+/// Counters of the local deletion passes, reported by [Context::get_info].
+#[derive(Debug, Default)]
+pub(crate) struct ExpiryStats {
+    /// Number of passes which deleted at least one message.
+    pub(crate) passes: AtomicUsize,
+
+    /// Number of messages deleted locally.
+    pub(crate) deleted: AtomicUsize,
+}
+
 /// Deletes messages which are expired according to
 /// `delete_device_after` setting or `ephemeral_timestamp` column.
 ///
 /// Returns true if any message is deleted, so caller can emit
 /// MsgsChanged event. If nothing has been deleted, returns
-/// false. This function does not emit the MsgsChanged event itself,
-/// because it is also called when chatlist is reloaded, and emitting
-/// MsgsChanged there will cause infinite reload loop.
+/// false.
 pub(crate) async fn delete_expired_messages(context: &Context) -> Result<bool> {
-    let mut updated = context
+    let start = Instant::now();
+    let deleted =
+        delete_ephemeral_messages(context).await? + delete_device_expired_messages(context).await?;
+    record_expiry_pass(context, deleted, start);
+    Ok(deleted > 0)
+}
+
+/// Deletes messages whose `ephemeral_timestamp` is reached and returns their number.
+async fn delete_ephemeral_messages(context: &Context) -> Result<usize> {
+    context
         .sql
         .execute(
             // If you change which information is removed here, also change MsgId::trash() and
@@ -323,62 +352,69 @@ pub(crate) async fn delete_expired_messages(context: &Context) -> Result<bool> {
             paramsv![DC_CHAT_ID_TRASH, time(), DC_CHAT_ID_TRASH],
         )
         .await
-        .context("update failed")?
-        > 0;
-
-    if let Some(delete_device_after) = context.get_config_delete_device_after().await? {
-        let self_chat_id = ChatId::lookup_by_contact(context, DC_CONTACT_ID_SELF)
-            .await?
-            .unwrap_or_default();
-        let device_chat_id = ChatId::lookup_by_contact(context, DC_CONTACT_ID_DEVICE)
-            .await?
-            .unwrap_or_default();
-
-        let threshold_timestamp = time() - delete_device_after;
+        .context("update failed")
+}
 
-        // Delete expired messages
-        //
-        // Only update the rows that have to be updated, to avoid emitting
-        // unnecessary "chat modified" events.
-        let rows_modified = context
-            .sql
-            .execute(
-                "UPDATE msgs \
+/// Deletes messages which are older than `delete_device_after` and returns their number.
+async fn delete_device_expired_messages(context: &Context) -> Result<usize> {
+    let delete_device_after = match context.get_config_delete_device_after().await? {
+        Some(delete_device_after) => delete_device_after,
+        None => return Ok(0),
+    };
+    let self_chat_id = ChatId::lookup_by_contact(context, DC_CONTACT_ID_SELF)
+        .await?
+        .unwrap_or_default();
+    let device_chat_id = ChatId::lookup_by_contact(context, DC_CONTACT_ID_DEVICE)
+        .await?
+        .unwrap_or_default();
+
+    let threshold_timestamp = time() - delete_device_after;
+
+    // Delete expired messages
+    //
+    // Only update the rows that have to be updated, to avoid emitting
+    // unnecessary "chat modified" events.
+    context
+        .sql
+        .execute(
+            "UPDATE msgs \
              SET txt = 'DELETED', chat_id = ? \
              WHERE timestamp < ? \
              AND chat_id > ? \
              AND chat_id != ? \
              AND chat_id != ?",
-                paramsv![
-                    DC_CHAT_ID_TRASH,
-                    threshold_timestamp,
-                    DC_CHAT_ID_LAST_SPECIAL,
-                    self_chat_id,
-                    device_chat_id
-                ],
-            )
-            .await
-            .context("deleted update failed")?;
+            paramsv![
+                DC_CHAT_ID_TRASH,
+                threshold_timestamp,
+                DC_CHAT_ID_LAST_SPECIAL,
+                self_chat_id,
+                device_chat_id
+            ],
+        )
+        .await
+        .context("deleted update failed")
+}
 
-        updated |= rows_modified > 0;
+fn record_expiry_pass(context: &Context, deleted: usize, start: Instant) {
+    if deleted > 0 {
+        context.expiry_stats.passes.fetch_add(1, Ordering::Relaxed);
+        context
+            .expiry_stats
+            .deleted
+            .fetch_add(deleted, Ordering::Relaxed);
+        info!(
+            context,
+            "Deleted {} expired messages in {:?}.",
+            deleted,
+            start.elapsed()
+        );
     }
-
-    schedule_ephemeral_task(context).await;
-    Ok(updated)
 }
 
-/// Schedule a task to emit MsgsChanged event when the next local
-/// deletion happens. Existing task is cancelled to make sure at most
-/// one such task is scheduled at a time.
-///
-/// UI is expected to reload the chatlist or the chat in response to
-/// MsgsChanged event, this will trigger actual deletion.
-///
-/// This takes into account only per-chat timeouts, because global device
-/// timeouts are at least one hour long and deletion is triggered often enough
-/// by user actions.
-pub async fn schedule_ephemeral_task(context: &Context) {
-    let ephemeral_timestamp: Option<i64> = match context
+/// Returns the time until the next ephemeral message expires,
+/// `None` if there are no ephemeral messages waiting for deletion.
+async fn next_ephemeral_expiration(context: &Context) -> Result<Option<Duration>> {
+    let ephemeral_timestamp: Option<i64> = context
         .sql
         .query_get_value(
             r#"
@@ -391,51 +427,123 @@ pub async fn schedule_ephemeral_task(context: &Context) {
     "#,
             paramsv![DC_CHAT_ID_TRASH], // Trash contains already deleted messages, skip them
         )
-        .await
-    {
-        Err(err) => {
-            warn!(context, "Can't calculate next ephemeral timeout: {}", err);
-            return;
-        }
-        Ok(ephemeral_timestamp) => ephemeral_timestamp,
-    };
+        .await?;
+
+    Ok(ephemeral_timestamp.map(|ephemeral_timestamp| {
+        let until =
+            UNIX_EPOCH + Duration::from_secs(ephemeral_timestamp.try_into().unwrap_or(u64::MAX));
+        // Zero if the message is already expired.
+        until.duration_since(SystemTime::now()).unwrap_or_default()
+    }))
+}
+
+/// Schedules the task which deletes ephemeral messages when they expire.
+/// Existing task is cancelled to make sure at most one such task is
+/// scheduled at a time.
+///
+/// The task sleeps until the next `ephemeral_timestamp`, deletes the
+/// expired messages and emits a MsgsChanged event, so UI reloads the
+/// chatlist or the chat. Messages expired according to the global
+/// `delete_device_after` setting are deleted every
+/// [DELETE_DEVICE_AFTER_INTERVAL] by the same task.
+pub async fn schedule_ephemeral_task(context: &Context) {
+    start_ephemeral_task(context, false).await;
+}
+
+/// Schedules the ephemeral task like [schedule_ephemeral_task], but lets it
+/// delete the messages expired according to `delete_device_after` immediately.
+pub(crate) async fn schedule_ephemeral_task_with_device_deletion(context: &Context) {
+    start_ephemeral_task(context, true).await;
+}
+
+async fn start_ephemeral_task(context: &Context, delete_device_now: bool) {
+    if delete_device_now {
+        *context.next_device_deletion.lock().await = None;
+    }
 
     // Cancel existing task, if any
     if let Some(ephemeral_task) = context.ephemeral_task.write().await.take() {
         ephemeral_task.cancel().await;
     }
 
-    if let Some(ephemeral_timestamp) = ephemeral_timestamp {
-        let now = SystemTime::now();
-        let until = UNIX_EPOCH
-            + Duration::from_secs(ephemeral_timestamp.try_into().unwrap_or(u64::MAX))
-            + Duration::from_secs(1);
-
-        if let Ok(duration) = until.duration_since(now) {
-            // Schedule a task, ephemeral_timestamp is in the future
-            let context1 = context.clone();
-            let ephemeral_task = task::spawn(async move {
-                async_std::task::sleep(duration).await;
-                emit_event!(
-                    context1,
-                    EventType::MsgsChanged {
-                        chat_id: ChatId::new(0),
-                        msg_id: MsgId::new(0)
-                    }
+    let context1 = context.clone();
+    let ephemeral_task = task::spawn(async move {
+        ephemeral_loop(&context1).await;
+    });
+    *context.ephemeral_task.write().await = Some(ephemeral_task);
+}
+
+async fn ephemeral_loop(context: &Context) {
+    loop {
+        let duration = match ephemeral_pass(context).await {
+            Ok(Some(duration)) => duration,
+            Ok(None) => return,
+            Err(err) => {
+                warn!(
+                    context,
+                    "Ephemeral task failed, retrying in {:?}: {:#}", EPHEMERAL_RETRY_INTERVAL, err
                 );
-            });
-            *context.ephemeral_task.write().await = Some(ephemeral_task);
-        } else {
-            // Emit event immediately
-            emit_event!(
-                context,
-                EventType::MsgsChanged {
-                    chat_id: ChatId::new(0),
-                    msg_id: MsgId::new(0)
-                }
-            );
+                EPHEMERAL_RETRY_INTERVAL
+            }
+        };
+        async_std::task::sleep(duration).await;
+    }
+}
+
+/// Deletes the expired messages and returns the time until the next pass is due,
+/// `None` if there is nothing to delete in the future.
+///
+/// The deadline of the next `delete_device_after` pass is kept in the context, so
+/// restarting the task, e.g. on every sent message, does not postpone it.
+async fn ephemeral_pass(context: &Context) -> Result<Option<Duration>> {
+    let start = Instant::now();
+    let mut deleted = delete_ephemeral_messages(context)
+        .await
+        .context("failed to delete ephemeral messages")?;
+
+    {
+        let mut next_device_deletion = context.next_device_deletion.lock().await;
+        if next_device_deletion.map_or(true, |deadline| Instant::now() >= deadline) {
+            match delete_device_expired_messages(context).await {
+                Ok(device_deleted) => deleted += device_deleted,
+                Err(err) => warn!(context, "Failed to delete old messages: {:#}", err),
+            }
+            *next_device_deletion = Some(Instant::now() + DELETE_DEVICE_AFTER_INTERVAL);
         }
     }
+    record_expiry_pass(context, deleted, start);
+    if deleted > 0 {
+        emit_event!(
+            context,
+            EventType::MsgsChanged {
+                chat_id: ChatId::new(0),
+                msg_id: MsgId::new(0)
+            }
+        );
+    }
+
+    let ephemeral_expiration = next_ephemeral_expiration(context)
+        .await
+        .context("can't calculate next ephemeral timeout")?;
+    let device_expiration = match context.get_config_delete_device_after().await {
+        Ok(Some(_)) => context
+            .next_device_deletion
+            .lock()
+            .await
+            .map(|deadline| deadline.saturating_duration_since(Instant::now())),
+        Ok(None) => None,
+        Err(err) => {
+            warn!(context, "Can't read delete_device_after: {:#}", err);
+            None
+        }
+    };
+
+    Ok(match (ephemeral_expiration, device_expiration) {
+        (None, None) => None,
+        (Some(ephemeral), None) => Some(ephemeral),
+        (None, Some(device)) => Some(device),
+        (Some(ephemeral), Some(device)) => Some(min(ephemeral, device)),
+    })
 }
 
 /// Returns ID of any expired message that should be deleted from the server.
@@ -443,6 +551,19 @@ pub async fn schedule_ephemeral_task(context: &Context) {
 /// It looks up the trash chat too, to find messages that are already
 /// deleted locally, but not deleted on the server.
 pub(crate) async fn load_imap_deletion_msgid(context: &Context) -> anyhow::Result<Option<MsgId>> {
+    Ok(load_imap_deletion_msgids(context, 1)
+        .await?
+        .into_iter()
+        .next())
+}
+
+/// Returns the IDs of up to `limit` expired messages that should be deleted from the server.
+///
+/// See [load_imap_deletion_msgid] for details.
+pub(crate) async fn load_imap_deletion_msgids(
+    context: &Context,
+    limit: u32,
+) -> anyhow::Result<Vec<MsgId>> {
     let now = time();
 
     let threshold_timestamp = match context.get_config_delete_server_after().await? {
@@ -452,7 +573,7 @@ pub(crate) async fn load_imap_deletion_msgid(context: &Context) -> anyhow::Resul
 
     context
         .sql
-        .query_row_optional(
+        .query_map(
             "SELECT id FROM msgs \
          WHERE ( \
          timestamp < ? \
@@ -460,12 +581,15 @@ pub(crate) async fn load_imap_deletion_msgid(context: &Context) -> anyhow::Resul
          ) \
          AND server_uid != 0 \
          AND NOT id IN (SELECT foreign_id FROM jobs WHERE action = ?)
-         LIMIT 1",
-            paramsv![threshold_timestamp, now, job::Action::DeleteMsgOnImap],
-            |row| {
-                let msg_id: MsgId = row.get(0)?;
-                Ok(msg_id)
-            },
+         LIMIT ?",
+            paramsv![
+                threshold_timestamp,
+                now,
+                job::Action::DeleteMsgOnImap,
+                limit
+            ],
+            |row| row.get::<_, MsgId>(0),
+            |ids| ids.collect::<Result<Vec<_>, _>>().map_err(Into::into),
         )
         .await
 }
@@ -722,7 +846,8 @@ async fn test_ephemeral_delete_msgs() {
             .send_text(chat.id, "Saved message, disappearing after 1s")
             .await;
 
-        sleep(Duration::from_millis(1100)).await;
+        // The ephemeral task deletes the message in the background.
+        sleep(Duration::from_millis(1500)).await;
 
         // Check checks that the msg was deleted locally
         check_msg_was_deleted(&t, &chat, msg.sender_msg_id).await;
@@ -1,6 +1,9 @@
 //! # Events specification
 
+use std::collections::HashSet;
 use std::ops::Deref;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
 
 use async_std::channel::{self, Receiver, Sender, TrySendError};
 use async_std::path::PathBuf;
@@ -10,30 +13,93 @@
 use crate::ephemeral::Timer as EphemeralTimer;
 use crate::message::MsgId;
 
+/// Maximum number of events buffered for the [`EventEmitter`]s.
+///
+/// When the buffer is full, the oldest event is dropped.
+const EVENTS_CAPACITY: usize = 10_000;
+
 #[derive(Debug)]
 pub struct Events {
     receiver: Receiver<Event>,
     sender: Sender<Event>,
+    state: Arc<EventsState>,
+}
+
+/// State shared between [`Events`] and its [`EventEmitter`]s.
+#[derive(Debug, Default)]
+struct EventsState {
+    /// `MsgsChanged` events which are buffered, but not received yet.
+    ///
+    /// An identical `MsgsChanged` event is not buffered again while one is pending,
+    /// the receiver handles the change when it gets the pending event.
+    pending_msgs_changed: Mutex<HashSet<(ChatId, MsgId)>>,
+
+    /// IDs of the events which are not emitted at all.
+    ignored: RwLock<HashSet<i32>>,
+
+    /// Number of events dropped because the buffer was full.
+    dropped: AtomicUsize,
+
+    /// Number of events merged into an identical pending event.
+    coalesced: AtomicUsize,
+}
+
+impl EventsState {
+    /// Marks an event as taken out of the buffer.
+    fn remove_pending(&self, event: &Event) {
+        if let EventType::MsgsChanged { chat_id, msg_id } = event.typ {
+            self.pending_msgs_changed
+                .lock()
+                .unwrap()
+                .remove(&(chat_id, msg_id));
+        }
+    }
 }
 
 impl Default for Events {
     fn default() -> Self {
-        let (sender, receiver) = channel::bounded(1_000);
+        let (sender, receiver) = channel::bounded(EVENTS_CAPACITY);
 
-        Self { receiver, sender }
+        Self {
+            receiver,
+            sender,
+            state: Default::default(),
+        }
     }
 }
 
 impl Events {
     pub fn emit(&self, event: Event) {
+        {
+            let ignored = self.state.ignored.read().unwrap();
+            if !ignored.is_empty() && ignored.contains(&event.as_id()) {
+                return;
+            }
+        }
+
+        if let EventType::MsgsChanged { chat_id, msg_id } = event.typ {
+            let mut pending = self.state.pending_msgs_changed.lock().unwrap();
+            if !pending.insert((chat_id, msg_id)) {
+                self.state.coalesced.fetch_add(1, Ordering::Relaxed);
+                return;
+            }
+        }
+
+        self.send(event);
+    }
+
+    fn send(&self, event: Event) {
         match self.sender.try_send(event) {
             Ok(()) => {}
             Err(TrySendError::Full(event)) => {
                 // when we are full, we pop remove the oldest event and push on the new one
-                let _ = self.receiver.try_recv();
+                if let Ok(oldest) = self.receiver.try_recv() {
+                    self.state.remove_pending(&oldest);
+                    self.state.dropped.fetch_add(1, Ordering::Relaxed);
+                }
 
                 // try again
-                self.emit(event);
+                self.send(event);
             }
             Err(TrySendError::Closed(_)) => {
                 unreachable!("unable to emit event, channel disconnected");
@@ -43,7 +109,32 @@ pub fn emit(&self, event: Event) {
 
     /// Retrieve the event emitter.
     pub fn get_emitter(&self) -> EventEmitter {
-        EventEmitter(self.receiver.clone())
+        EventEmitter {
+            receiver: self.receiver.clone(),
+            state: self.state.clone(),
+        }
+    }
+
+    /// Sets the IDs of the events which should not be emitted.
+    ///
+    /// Replaces the previously set IDs, an empty list emits all events again.
+    pub fn set_ignored(&self, event_ids: &[i32]) {
+        *self.state.ignored.write().unwrap() = event_ids.iter().copied().collect();
+    }
+
+    /// Returns true if events with the given ID are not emitted.
+    pub fn is_ignored(&self, event_id: i32) -> bool {
+        self.state.ignored.read().unwrap().contains(&event_id)
+    }
+
+    /// Returns the number of events dropped because nobody received them in time.
+    pub fn dropped_count(&self) -> usize {
+        self.state.dropped.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of `MsgsChanged` events merged into an identical pending event.
+    pub fn coalesced_count(&self) -> usize {
+        self.state.coalesced.load(Ordering::Relaxed)
     }
 }
 
@@ -59,7 +150,10 @@ pub fn get_emitter(&self) -> EventEmitter {
 /// [`Context::get_event_emitter`]: crate::context::Context::get_event_emitter
 /// [`Stream`]: async_std::stream::Stream
 #[derive(Debug, Clone)]
-pub struct EventEmitter(Receiver<Event>);
+pub struct EventEmitter {
+    receiver: Receiver<Event>,
+    state: Arc<EventsState>,
+}
 
 impl EventEmitter {
     /// Blocking recv of an event. Return `None` if the `Sender` has been droped.
@@ -69,7 +163,42 @@ pub fn recv_sync(&self) -> Option<Event> {
 
     /// Async recv of an event. Return `None` if the `Sender` has been droped.
     pub async fn recv(&self) -> Option<Event> {
-        self.0.recv().await.ok()
+        let event = self.receiver.recv().await.ok()?;
+        self.state.remove_pending(&event);
+        Some(event)
+    }
+
+    /// Non-blocking recv of an event. Returns `None` if no event is buffered.
+    pub fn try_recv(&self) -> Option<Event> {
+        let event = self.receiver.try_recv().ok()?;
+        self.state.remove_pending(&event);
+        Some(event)
+    }
+
+    /// Blocking recv of up to `max` events, see [`EventEmitter::recv_batch`].
+    pub fn recv_batch_sync(&self, max: usize) -> Vec<Event> {
+        async_std::task::block_on(self.recv_batch(max))
+    }
+
+    /// Async recv of up to `max` events.
+    ///
+    /// Waits for the first event, then returns it together with the events which are
+    /// already buffered. Returns an empty vector if the `Sender` has been droped.
+    pub async fn recv_batch(&self, max: usize) -> Vec<Event> {
+        let mut events = Vec::new();
+        if max == 0 {
+            return events;
+        }
+        if let Some(event) = self.recv().await {
+            events.push(event);
+            while events.len() < max {
+                match self.try_recv() {
+                    Some(event) => events.push(event),
+                    None => break,
+                }
+            }
+        }
+        events
     }
 }
 
@@ -80,7 +209,11 @@ fn poll_next(
         mut self: std::pin::Pin<&mut Self>,
         cx: &mut std::task::Context<'_>,
     ) -> std::task::Poll<Option<Self::Item>> {
-        std::pin::Pin::new(&mut self.0).poll_next(cx)
+        let poll = std::pin::Pin::new(&mut self.receiver).poll_next(cx);
+        if let std::task::Poll::Ready(Some(ref event)) = poll {
+            self.state.remove_pending(event);
+        }
+        poll
     }
 }
 
@@ -323,3 +456,78 @@ pub enum EventType {
     #[strum(props(id = "2100"))]
     ConnectivityChanged,
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn msgs_changed(chat_id: u32, msg_id: u32) -> Event {
+        Event {
+            id: 1,
+            typ: EventType::MsgsChanged {
+                chat_id: ChatId::new(chat_id),
+                msg_id: MsgId::new(msg_id),
+            },
+        }
+    }
+
+    #[async_std::test]
+    async fn test_coalesce_msgs_changed() {
+        let events = Events::default();
+        let emitter = events.get_emitter();
+
+        events.emit(msgs_changed(10, 1));
+        events.emit(msgs_changed(10, 1));
+        events.emit(msgs_changed(10, 2));
+        events.emit(msgs_changed(10, 1));
+        assert_eq!(events.coalesced_count(), 2);
+
+        assert_eq!(emitter.recv().await, Some(msgs_changed(10, 1)));
+        assert_eq!(emitter.try_recv(), Some(msgs_changed(10, 2)));
+        assert_eq!(emitter.try_recv(), None);
+
+        // The first event was received, so the same change is emitted again.
+        events.emit(msgs_changed(10, 1));
+        assert_eq!(emitter.try_recv(), Some(msgs_changed(10, 1)));
+    }
+
+    #[async_std::test]
+    async fn test_ignored_events() {
+        let events = Events::default();
+        let emitter = events.get_emitter();
+
+        let info = Event {
+            id: 1,
+            typ: EventType::Info("foo".to_string()),
+        };
+        events.set_ignored(&[info.as_id()]);
+        assert!(events.is_ignored(info.as_id()));
+        events.emit(info.clone());
+        events.emit(msgs_changed(10, 1));
+        assert_eq!(emitter.recv_batch(10).await, vec![msgs_changed(10, 1)]);
+
+        events.set_ignored(&[]);
+        events.emit(info.clone());
+        assert_eq!(emitter.try_recv(), Some(info));
+    }
+
+    #[async_std::test]
+    async fn test_dropped_events() {
+        let events = Events::default();
+        let emitter = events.get_emitter();
+
+        for i in 0..EVENTS_CAPACITY + 5 {
+            events.emit(msgs_changed(10, i as u32));
+        }
+        assert_eq!(events.dropped_count(), 5);
+
+        // The oldest events are dropped and may be emitted again.
+        assert_eq!(emitter.try_recv(), Some(msgs_changed(10, 5)));
+        events.emit(msgs_changed(10, 0));
+        assert_eq!(events.coalesced_count(), 0);
+
+        let batch = emitter.recv_batch(EVENTS_CAPACITY).await;
+        assert_eq!(batch.len(), EVENTS_CAPACITY);
+        assert_eq!(batch.last(), Some(&msgs_changed(10, 0)));
+    }
+}
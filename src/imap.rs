@@ -3,20 +3,27 @@
 //! uses [async-email/async-imap](https://github.com/async-email/async-imap)
 //! to implement connect, fetch, delete functionality with standard IMAP servers.
 
-use std::{cmp, cmp::max, collections::BTreeMap};
+use std::convert::TryFrom;
+use std::time::Instant;
+use std::{
+    cmp,
+    cmp::max,
+    collections::{BTreeMap, HashSet},
+};
 
 use anyhow::{bail, format_err, Context as _, Result};
 use async_imap::{
     error::Result as ImapResult,
     types::{Fetch, Flag, Mailbox, Name, NameAttribute, UnsolicitedResponse},
 };
-use async_std::channel::Receiver;
+use async_std::channel::{self, Receiver};
 use async_std::prelude::*;
+use async_std::task;
 use num_traits::FromPrimitive;
 
 use crate::constants::{
-    Chattype, ShowEmails, Viewtype, DC_FETCH_EXISTING_MSGS_COUNT, DC_FOLDERS_CONFIGURED_VERSION,
-    DC_LP_AUTH_OAUTH2,
+    Chattype, ShowEmails, Viewtype, DC_CHAT_ID_TRASH, DC_FETCH_EXISTING_MSGS_COUNT,
+    DC_FOLDERS_CONFIGURED_VERSION, DC_LP_AUTH_OAUTH2, DC_MSG_ID_LAST_SPECIAL,
 };
 use crate::context::Context;
 use crate::dc_receive_imf::{
@@ -28,11 +35,12 @@
 use crate::job::{self, Action};
 use crate::login_param::{CertificateChecks, LoginParam, ServerLoginParam};
 use crate::message::{self, update_server_uid, MessageState};
+use crate::metrics;
 use crate::mimeparser;
 use crate::oauth2::dc_get_oauth2_access_token;
 use crate::param::Params;
 use crate::provider::Socket;
-use crate::scheduler::InterruptInfo;
+use crate::scheduler::{connect_limit, InterruptInfo};
 use crate::stock_str;
 use crate::{chat, constants::DC_CONTACT_ID_SELF};
 use crate::{config::Config, scheduler::connectivity::ConnectivityStore};
@@ -60,12 +68,13 @@ pub enum ImapActionResult {
 }
 
 /// Prefetch:
+/// - Message size to decide how many messages to download in one batch.
 /// - Message-ID to check if we already have the message.
 /// - In-Reply-To and References to check if message is a reply to chat message.
 /// - Chat-Version to check if a message is a chat message
 /// - Autocrypt-Setup-Message to check if a message is an autocrypt setup message,
 ///   not necessarily sent by Delta Chat.
-const PREFETCH_FLAGS: &str = "(UID BODY.PEEK[HEADER.FIELDS (\
+const PREFETCH_FLAGS: &str = "(UID RFC822.SIZE BODY.PEEK[HEADER.FIELDS (\
                               MESSAGE-ID \
                               FROM \
                               IN-REPLY-TO REFERENCES \
@@ -247,6 +256,9 @@ pub async fn connect(&mut self, context: &Context) -> Result<()> {
 
         self.connectivity.set_connecting(context).await;
 
+        // Held until the login is finished.
+        let _permit = connect_limit::acquire(&self.config.lp.server).await;
+
         let oauth2 = self.config.oauth2;
 
         let connection_res: ImapResult<Client> = if self.config.lp.security == Socket::Starttls
@@ -443,6 +455,11 @@ pub async fn fetch(&mut self, context: &Context, watch_folder: &str) -> Result<(
     /// folder at the moment. Make sure to run it in the same
     /// thread/task as other network operations on this folder to
     /// avoid race conditions.
+    ///
+    /// Only the Message-IDs of messages received since the oldest
+    /// message known to the database are fetched, so the cost depends
+    /// on the number of these messages rather than on the size of the
+    /// folder.
     pub(crate) async fn resync_folder_uids(
         &mut self,
         context: &Context,
@@ -459,23 +476,39 @@ pub(crate) async fn resync_folder_uids(
             bail!("IMAP No Connection established");
         };
 
-        match session.uid_fetch("1:*", RFC724MID_UID).await {
-            Ok(mut list) => {
-                while let Some(fetch) = list.next().await {
-                    let msg = fetch?;
+        let uid_sets = match resync_search_since(context).await? {
+            Some(since) => {
+                let uids = session
+                    .uid_search(format!("SINCE {}", since))
+                    .await
+                    .map_err(|err| format_err!("Can't resync folder {}: {}", folder, err))?
+                    .into_iter()
+                    .collect();
+                build_sequence_sets(uids)
+            }
+            // The oldest message is unknown, fetch the whole folder.
+            None => vec!["1:*".to_string()],
+        };
+
+        for uid_set in &uid_sets {
+            match session.uid_fetch(uid_set, RFC724MID_UID).await {
+                Ok(mut list) => {
+                    while let Some(fetch) = list.next().await {
+                        let msg = fetch?;
 
-                    // Get Message-ID
-                    let message_id = get_fetch_headers(&msg)
-                        .and_then(|headers| prefetch_get_message_id(&headers))
-                        .ok();
+                        // Get Message-ID
+                        let message_id = get_fetch_headers(&msg)
+                            .and_then(|headers| prefetch_get_message_id(&headers))
+                            .ok();
 
-                    if let (Some(uid), Some(rfc724_mid)) = (msg.uid, message_id) {
-                        msg_ids.insert(uid, rfc724_mid);
+                        if let (Some(uid), Some(rfc724_mid)) = (msg.uid, message_id) {
+                            msg_ids.insert(uid, rfc724_mid);
+                        }
                     }
                 }
-            }
-            Err(err) => {
-                bail!("Can't resync folder {}: {}", folder, err);
+                Err(err) => {
+                    bail!("Can't resync folder {}: {}", folder, err);
+                }
             }
         }
 
@@ -620,6 +653,7 @@ pub(crate) async fn fetch_new_messages<S: AsRef<str>>(
         folder: S,
         fetch_existing_msgs: bool,
     ) -> Result<bool> {
+        let _timer = metrics::start(metrics::Span::ImapFetch);
         let show_emails = ShowEmails::from_i32(context.get_config_int(Config::ShowEmails).await?)
             .unwrap_or_default();
 
@@ -670,7 +704,7 @@ pub(crate) async fn fetch_new_messages<S: AsRef<str>>(
             )
             .await
             {
-                uids.push(current_uid);
+                uids.push((current_uid, msg.size.unwrap_or_default()));
             } else if read_errors == 0 {
                 // If there were errors (`read_errors != 0`), stop updating largest_uid_skipped so that uid_next will
                 // not be updated and we will retry prefetching next time
@@ -830,12 +864,19 @@ async fn prefetch_existing_msgs(&mut self) -> Result<BTreeMap<u32, async_imap::t
 
     /// Fetches a list of messages by server UID.
     ///
+    /// `server_uids` contains the UIDs together with the message sizes
+    /// reported by the prefetch, 0 if the size is unknown.
+    ///
+    /// Downloading and processing are pipelined: messages are downloaded into a bounded
+    /// queue while a separate task runs `dc_receive_imf` on the messages downloaded earlier.
+    /// Messages are still processed one after another, in the order of their UIDs.
+    ///
     /// Returns the last uid fetch successfully and an error count.
     async fn fetch_many_msgs(
         &mut self,
         context: &Context,
         folder: &str,
-        server_uids: Vec<u32>,
+        server_uids: Vec<(u32, u32)>,
         fetching_existing_messages: bool,
     ) -> (Option<u32>, usize) {
         if server_uids.is_empty() {
@@ -856,124 +897,145 @@ async fn fetch_many_msgs(
 
         let session = self.session.as_mut().unwrap();
 
-        let sets = build_sequence_sets(server_uids.clone());
-        let mut read_errors = 0;
+        let requested: HashSet<u32> = server_uids.iter().map(|(uid, _)| *uid).collect();
+        let (sender, receiver) = channel::bounded(fetch_queue_len(&server_uids));
+        let receiving = task::spawn(receive_fetched_msgs(
+            context.clone(),
+            folder.to_string(),
+            receiver,
+            fetching_existing_messages,
+        ));
+
+        let start = Instant::now();
+        let mut fetch_failed = false;
         let mut count = 0;
-        let mut last_uid = None;
+        let mut bytes = 0;
 
-        for set in sets.iter() {
-            let mut msgs = match session.uid_fetch(&set, BODY_FLAGS).await {
-                Ok(msgs) => msgs,
-                Err(err) => {
-                    // TODO: maybe differentiate between IO and input/parsing problems
-                    // so we don't reconnect if we have a (rare) input/output parsing problem?
-                    self.should_reconnect = true;
-                    warn!(
-                        context,
-                        "Error on fetching messages #{} from folder \"{}\"; error={}.",
-                        &set,
-                        folder,
-                        err
-                    );
-                    return (None, server_uids.len());
-                }
-            };
-
-            let folder = folder.to_string();
-
-            while let Some(Ok(msg)) = msgs.next().await {
-                let server_uid = msg.uid.unwrap_or_default();
+        'batches: for batch in build_fetch_batches(server_uids.clone()) {
+            for set in build_sequence_sets(batch) {
+                let mut msgs = match session.uid_fetch(&set, BODY_FLAGS).await {
+                    Ok(msgs) => msgs,
+                    Err(err) => {
+                        // TODO: maybe differentiate between IO and input/parsing problems
+                        // so we don't reconnect if we have a (rare) input/output parsing problem?
+                        self.should_reconnect = true;
+                        warn!(
+                            context,
+                            "Error on fetching messages #{} from folder \"{}\"; error={}.",
+                            &set,
+                            folder,
+                            err
+                        );
+                        fetch_failed = true;
+                        break 'batches;
+                    }
+                };
 
-                if !server_uids.contains(&server_uid) {
-                    warn!(
-                        context,
-                        "Got unwanted uid {} not in {:?}, requested {:?}",
-                        &server_uid,
-                        server_uids,
-                        &sets
-                    );
-                    continue;
-                }
-                count += 1;
+                while let Some(Ok(msg)) = msgs.next().await {
+                    let server_uid = msg.uid.unwrap_or_default();
 
-                let is_deleted = msg.flags().any(|flag| flag == Flag::Deleted);
-                if is_deleted || msg.body().is_none() {
-                    info!(
-                        context,
-                        "Not processing deleted or empty msg {}", server_uid
-                    );
-                    last_uid = Some(server_uid);
-                    continue;
-                }
+                    if !requested.contains(&server_uid) {
+                        warn!(
+                            context,
+                            "Got unwanted uid {} not in {:?}, requested {:?}",
+                            &server_uid,
+                            server_uids,
+                            &set
+                        );
+                        continue;
+                    }
+                    count += 1;
+                    bytes += msg.body().map_or(0, |body| body.len());
 
-                // XXX put flags into a set and pass them to dc_receive_imf
-                let context = context.clone();
-                let folder = folder.clone();
-
-                // safe, as we checked above that there is a body.
-                let body = msg.body().unwrap();
-                let is_seen = msg.flags().any(|flag| flag == Flag::Seen);
-
-                match dc_receive_imf_inner(
-                    &context,
-                    body,
-                    &folder,
-                    server_uid,
-                    is_seen,
-                    fetching_existing_messages,
-                )
-                .await
-                {
-                    Ok(_) => last_uid = Some(server_uid),
-                    Err(err) => {
-                        warn!(context, "dc_receive_imf error: {}", err);
-                        read_errors += 1;
+                    if sender.send(msg).await.is_err() {
+                        // Receiving task has stopped, nothing to do with further messages.
+                        break 'batches;
                     }
-                };
+                }
             }
         }
+        drop(sender);
+        let (last_uid, read_errors) = receiving.await;
+
+        if fetch_failed {
+            return (None, server_uids.len());
+        }
+
+        let elapsed = start.elapsed();
+        info!(
+            context,
+            "Fetched and received {} messages ({} KiB) from \"{}\" in {:.2?} ({:.1} messages/s).",
+            count,
+            bytes / 1024,
+            folder,
+            elapsed,
+            count as f64 / elapsed.as_secs_f64().max(0.001)
+        );
 
         if count != server_uids.len() {
             warn!(
                 context,
-                "failed to fetch all uids: got {}, requested {}, we requested the UIDs {:?} using {:?}",
+                "failed to fetch all uids: got {}, requested {}, we requested the UIDs {:?}",
                 count,
                 server_uids.len(),
                 server_uids,
-                sets
             );
         }
 
         (last_uid, read_errors)
     }
 
-    pub async fn mv(
+    /// Moves the messages with the given UIDs from `folder` to `dest_folder`.
+    ///
+    /// The UIDs are sent as compressed UID sets, so moving many messages takes only a few
+    /// commands. Returns the result for each UID.
+    pub async fn mv_uids(
         &mut self,
         context: &Context,
         folder: &str,
-        uid: u32,
+        uids: Vec<u32>,
         dest_folder: &str,
-    ) -> ImapActionResult {
+    ) -> BTreeMap<u32, ImapActionResult> {
         if folder == dest_folder {
             info!(
                 context,
-                "Skip moving message; message {}/{} is already in {}...", folder, uid, dest_folder,
+                "Skip moving messages; messages in {} are already in {}...", folder, dest_folder,
             );
-            return ImapActionResult::AlreadyDone;
+            return uids
+                .into_iter()
+                .map(|uid| (uid, ImapActionResult::AlreadyDone))
+                .collect();
         }
-        if let Some(imapresult) = self
-            .prepare_imap_operation_on_msg(context, folder, uid)
-            .await
-        {
-            return imapresult;
+        let mut results = BTreeMap::new();
+        let uids = retain_valid_uids(uids, &mut results);
+        if uids.is_empty() {
+            return results;
+        }
+        if let Some(imapresult) = self.prepare_imap_operation_on_folder(context, folder).await {
+            results.extend(uids.into_iter().map(|uid| (uid, imapresult)));
+            return results;
         }
         // we are connected, and the folder is selected
-        let set = format!("{}", uid);
-        let display_folder_id = format!("{}/{}", folder, uid);
+
+        for (set, set_uids) in build_uid_batches(uids) {
+            let res = self.mv_set(context, folder, &set, dest_folder).await;
+            results.extend(set_uids.into_iter().map(|uid| (uid, res)));
+        }
+        results
+    }
+
+    async fn mv_set(
+        &mut self,
+        context: &Context,
+        folder: &str,
+        set: &str,
+        dest_folder: &str,
+    ) -> ImapActionResult {
+        let display_folder_id = format!("{}/{}", folder, set);
 
         if self.config.can_move {
             if let Some(ref mut session) = &mut self.session {
-                match session.uid_mv(&set, &dest_folder).await {
+                match session.uid_mv(set, &dest_folder).await {
                     Ok(_) => {
                         emit_event!(
                             context,
@@ -987,9 +1049,8 @@ pub async fn mv(
                     Err(err) => {
                         warn!(
                             context,
-                            "Cannot move message, fallback to COPY/DELETE {}/{} to {}: {}",
-                            folder,
-                            uid,
+                            "Cannot move message, fallback to COPY/DELETE {} to {}: {}",
+                            display_folder_id,
                             dest_folder,
                             err
                         );
@@ -1001,15 +1062,14 @@ pub async fn mv(
         } else {
             info!(
                 context,
-                "Server does not support MOVE, fallback to COPY/DELETE {}/{} to {}",
-                folder,
-                uid,
+                "Server does not support MOVE, fallback to COPY/DELETE {} to {}",
+                display_folder_id,
                 dest_folder
             );
         }
 
         if let Some(ref mut session) = &mut self.session {
-            if let Err(err) = session.uid_copy(&set, &dest_folder).await {
+            if let Err(err) = session.uid_copy(set, &dest_folder).await {
                 warn!(context, "Could not copy message: {}", err);
                 return ImapActionResult::Failed;
             }
@@ -1017,8 +1077,11 @@ pub async fn mv(
             unreachable!();
         }
 
-        if !self.add_flag_finalized(context, uid, "\\Deleted").await {
-            warn!(context, "Cannot mark {} as \"Deleted\" after copy.", uid);
+        if !self
+            .add_flag_finalized_with_set(context, set, "\\Deleted")
+            .await
+        {
+            warn!(context, "Cannot mark {} as \"Deleted\" after copy.", set);
             emit_event!(
                 context,
                 EventType::ImapMessageMoved(format!(
@@ -1040,19 +1103,6 @@ pub async fn mv(
         }
     }
 
-    async fn add_flag_finalized(&mut self, context: &Context, server_uid: u32, flag: &str) -> bool {
-        // return true if we successfully set the flag or we otherwise
-        // think add_flag should not be retried: Disconnection during setting
-        // the flag, or other imap-errors, returns true as well.
-        //
-        // returning false means that the operation can be retried.
-        if server_uid == 0 {
-            return true; // might be moved but we don't want to have a stuck job
-        }
-        let s = server_uid.to_string();
-        self.add_flag_finalized_with_set(context, &s, flag).await
-    }
-
     async fn add_flag_finalized_with_set(
         &mut self,
         context: &Context,
@@ -1083,15 +1133,14 @@ async fn add_flag_finalized_with_set(
         }
     }
 
-    pub async fn prepare_imap_operation_on_msg(
+    /// Connects if needed and selects `folder`.
+    ///
+    /// Returns `None` on success, otherwise the result to report for the operation.
+    pub async fn prepare_imap_operation_on_folder(
         &mut self,
         context: &Context,
         folder: &str,
-        uid: u32,
     ) -> Option<ImapActionResult> {
-        if uid == 0 {
-            return Some(ImapActionResult::RetryLater);
-        }
         if !self.is_connected() {
             // currently jobs are only performed on the INBOX thread
             // TODO: make INBOX/SENT/MVBOX perform the jobs on their
@@ -1123,122 +1172,190 @@ pub async fn prepare_imap_operation_on_msg(
         }
     }
 
-    pub async fn set_seen(
+    /// Marks the messages with the given UIDs in `folder` as seen.
+    ///
+    /// The UIDs are sent as compressed UID sets, so marking many messages takes only a few
+    /// `UID STORE` commands. Returns the result for each UID.
+    pub async fn set_seen_uids(
         &mut self,
         context: &Context,
         folder: &str,
-        uid: u32,
-    ) -> ImapActionResult {
-        if let Some(imapresult) = self
-            .prepare_imap_operation_on_msg(context, folder, uid)
-            .await
-        {
-            return imapresult;
+        uids: Vec<u32>,
+    ) -> BTreeMap<u32, ImapActionResult> {
+        let mut results = BTreeMap::new();
+        let uids = retain_valid_uids(uids, &mut results);
+        if uids.is_empty() {
+            return results;
+        }
+        if let Some(imapresult) = self.prepare_imap_operation_on_folder(context, folder).await {
+            results.extend(uids.into_iter().map(|uid| (uid, imapresult)));
+            return results;
         }
         // we are connected, and the folder is selected
-        info!(context, "Marking message {}/{} as seen...", folder, uid,);
+        info!(
+            context,
+            "Marking {} messages in folder {} as seen...",
+            uids.len(),
+            folder
+        );
 
-        if self.add_flag_finalized(context, uid, "\\Seen").await {
-            ImapActionResult::Success
-        } else {
-            warn!(
-                context,
-                "Cannot mark message {} in folder {} as seen, ignoring.", uid, folder
-            );
-            ImapActionResult::Failed
+        for (set, set_uids) in build_uid_batches(uids) {
+            let res = if self
+                .add_flag_finalized_with_set(context, &set, "\\Seen")
+                .await
+            {
+                ImapActionResult::Success
+            } else {
+                warn!(
+                    context,
+                    "Cannot mark messages {} in folder {} as seen, ignoring.", set, folder
+                );
+                ImapActionResult::Failed
+            };
+            results.extend(set_uids.into_iter().map(|uid| (uid, res)));
         }
+        results
     }
 
-    pub async fn delete_msg(
+    /// Marks the given messages in `folder` as deleted.
+    ///
+    /// `msgs` maps the UIDs to the Message-IDs the messages are expected to have;
+    /// messages with a different Message-ID on the server are not deleted.
+    /// The UIDs are sent as compressed UID sets, so deleting many messages
+    /// takes only a few commands. Returns the result for each UID.
+    pub async fn delete_msgs(
         &mut self,
         context: &Context,
-        message_id: &str,
         folder: &str,
-        uid: u32,
-    ) -> ImapActionResult {
-        if let Some(imapresult) = self
-            .prepare_imap_operation_on_msg(context, folder, uid)
-            .await
-        {
-            return imapresult;
+        msgs: &BTreeMap<u32, String>,
+    ) -> BTreeMap<u32, ImapActionResult> {
+        let mut results = BTreeMap::new();
+        let uids = retain_valid_uids(msgs.keys().copied().collect(), &mut results);
+        if uids.is_empty() {
+            return results;
+        }
+        if let Some(imapresult) = self.prepare_imap_operation_on_folder(context, folder).await {
+            results.extend(uids.into_iter().map(|uid| (uid, imapresult)));
+            return results;
         }
         // we are connected, and the folder is selected
 
-        let set = format!("{}", uid);
-        let display_imap_id = format!("{}/{}", folder, uid);
+        for (set, set_uids) in build_uid_batches(uids) {
+            // double-check that we are deleting the correct message-ids
+            // this comes at the expense of another imap query
+            let remote_message_ids = match self.fetch_message_ids(context, &set).await {
+                Some(remote_message_ids) => remote_message_ids,
+                None => {
+                    results.extend(
+                        set_uids
+                            .into_iter()
+                            .map(|uid| (uid, ImapActionResult::RetryLater)),
+                    );
+                    continue;
+                }
+            };
 
-        // double-check that we are deleting the correct message-id
-        // this comes at the expense of another imap query
-        if let Some(ref mut session) = &mut self.session {
-            match session.uid_fetch(set, DELETE_CHECK_FLAGS).await {
-                Ok(mut msgs) => {
-                    let mut remote_message_id = None;
-
-                    while let Some(response) = msgs.next().await {
-                        match response {
-                            Ok(fetch) => {
-                                if fetch.uid == Some(uid) {
-                                    remote_message_id = get_fetch_headers(&fetch)
-                                        .and_then(|headers| prefetch_get_message_id(&headers))
-                                        .ok();
-                                }
-                            }
-                            Err(err) => {
-                                warn!(context, "IMAP fetch error {}", err);
-                                return ImapActionResult::RetryLater;
-                            }
-                        }
+            let mut to_delete = Vec::with_capacity(set_uids.len());
+            for uid in set_uids {
+                let message_id = msgs.get(&uid).map(|s| s.as_str()).unwrap_or_default();
+                let display_imap_id = format!("{}/{}", folder, uid);
+                match remote_message_ids.get(&uid) {
+                    Some(remote_message_id) if remote_message_id == message_id => {
+                        to_delete.push(uid)
                     }
-
-                    if let Some(remote_message_id) = remote_message_id {
-                        if remote_message_id != message_id {
-                            warn!(
-                                context,
-                                "Cannot delete on IMAP, {}: remote message-id '{}' != '{}'",
-                                display_imap_id,
-                                remote_message_id,
-                                message_id,
-                            );
-                            return ImapActionResult::Failed;
-                        }
-                    } else {
+                    Some(remote_message_id) => {
+                        warn!(
+                            context,
+                            "Cannot delete on IMAP, {}: remote message-id '{}' != '{}'",
+                            display_imap_id,
+                            remote_message_id,
+                            message_id,
+                        );
+                        results.insert(uid, ImapActionResult::Failed);
+                    }
+                    None => {
                         warn!(
                             context,
                             "Cannot delete on IMAP, {}: imap entry gone '{}'",
                             display_imap_id,
                             message_id,
                         );
-                        return ImapActionResult::AlreadyDone;
+                        results.insert(uid, ImapActionResult::AlreadyDone);
                     }
                 }
-                Err(err) => {
+            }
+
+            // mark the messages for deletion
+            for (delete_set, delete_uids) in build_uid_batches(to_delete) {
+                if !self
+                    .add_flag_finalized_with_set(context, &delete_set, "\\Deleted")
+                    .await
+                {
                     warn!(
                         context,
-                        "Cannot delete on IMAP, {}: {}", display_imap_id, err,
+                        "Cannot mark messages {}/{} as \"Deleted\".", folder, delete_set
+                    );
+                    results.extend(
+                        delete_uids
+                            .into_iter()
+                            .map(|uid| (uid, ImapActionResult::RetryLater)),
+                    );
+                    continue;
+                }
+                self.config.selected_folder_needs_expunge = true;
+                for uid in delete_uids {
+                    emit_event!(
+                        context,
+                        EventType::ImapMessageDeleted(format!(
+                            "IMAP Message {}/{} marked as deleted [{}]",
+                            folder,
+                            uid,
+                            msgs.get(&uid).map(|s| s.as_str()).unwrap_or_default()
+                        ))
                     );
-                    return ImapActionResult::RetryLater;
+                    results.insert(uid, ImapActionResult::Success);
                 }
             }
         }
+        results
+    }
 
-        // mark the message for deletion
-        if !self.add_flag_finalized(context, uid, "\\Deleted").await {
-            warn!(
-                context,
-                "Cannot mark message {} as \"Deleted\".", display_imap_id
-            );
-            ImapActionResult::RetryLater
-        } else {
-            emit_event!(
-                context,
-                EventType::ImapMessageDeleted(format!(
-                    "IMAP Message {} marked as deleted [{}]",
-                    display_imap_id, message_id
-                ))
-            );
-            self.config.selected_folder_needs_expunge = true;
-            ImapActionResult::Success
+    /// Fetches the Message-IDs of the messages in the UID set `set` of the selected folder.
+    ///
+    /// Returns `None` if the fetch failed.
+    async fn fetch_message_ids(
+        &mut self,
+        context: &Context,
+        set: &str,
+    ) -> Option<BTreeMap<u32, String>> {
+        let session = self.session.as_mut()?;
+        let mut msgs = match session.uid_fetch(set, DELETE_CHECK_FLAGS).await {
+            Ok(msgs) => msgs,
+            Err(err) => {
+                warn!(context, "Cannot fetch message-ids of {}: {}", set, err);
+                return None;
+            }
+        };
+
+        let mut remote_message_ids = BTreeMap::new();
+        while let Some(response) = msgs.next().await {
+            match response {
+                Ok(fetch) => {
+                    if let Some(uid) = fetch.uid {
+                        if let Ok(message_id) = get_fetch_headers(&fetch)
+                            .and_then(|headers| prefetch_get_message_id(&headers))
+                        {
+                            remote_message_ids.insert(uid, message_id);
+                        }
+                    }
+                }
+                Err(err) => {
+                    warn!(context, "IMAP fetch error {}", err);
+                    return None;
+                }
+            }
         }
+        Some(remote_message_ids)
     }
 
     pub async fn ensure_configured_folders(
@@ -1806,11 +1923,146 @@ pub async fn get_config_last_seen_uid<S: AsRef<str>>(
     }
 }
 
+/// Runs `dc_receive_imf` on messages downloaded by [`Imap::fetch_many_msgs`]
+/// in the order they are queued.
+///
+/// Returns the last uid received successfully and an error count.
+async fn receive_fetched_msgs(
+    context: Context,
+    folder: String,
+    receiver: Receiver<Fetch>,
+    fetching_existing_messages: bool,
+) -> (Option<u32>, usize) {
+    let mut read_errors = 0;
+    let mut last_uid = None;
+
+    while let Ok(msg) = receiver.recv().await {
+        let server_uid = msg.uid.unwrap_or_default();
+
+        let is_deleted = msg.flags().any(|flag| flag == Flag::Deleted);
+        let body = match msg.body() {
+            Some(body) if !is_deleted => body,
+            _ => {
+                info!(
+                    context,
+                    "Not processing deleted or empty msg {}", server_uid
+                );
+                last_uid = Some(server_uid);
+                continue;
+            }
+        };
+
+        // XXX put flags into a set and pass them to dc_receive_imf
+        let is_seen = msg.flags().any(|flag| flag == Flag::Seen);
+
+        match dc_receive_imf_inner(
+            &context,
+            body,
+            &folder,
+            server_uid,
+            is_seen,
+            fetching_existing_messages,
+        )
+        .await
+        {
+            Ok(_) => last_uid = Some(server_uid),
+            Err(err) => {
+                warn!(context, "dc_receive_imf error: {}", err);
+                read_errors += 1;
+            }
+        };
+    }
+
+    (last_uid, read_errors)
+}
+
+/// Maximum total size of the message bodies requested with a single UID FETCH.
+///
+/// Large messages are fetched in smaller batches, so their processing can start
+/// before the remaining messages are downloaded.
+const FETCH_BATCH_BYTES: u64 = 10 * 1024 * 1024;
+
+/// Approximate size of downloaded messages that may wait for processing.
+const FETCH_QUEUE_BYTES: u64 = 20 * 1024 * 1024;
+
+/// Maximum number of downloaded messages that may wait for processing.
+const FETCH_QUEUE_MAX_LEN: usize = 100;
+
+/// Splits UIDs into batches of messages with a total size of at most [`FETCH_BATCH_BYTES`].
+///
+/// Takes pairs of UID and message size. Messages larger than the limit get a batch
+/// of their own. Returned batches are sorted by UID.
+fn build_fetch_batches(mut uids: Vec<(u32, u32)>) -> Vec<Vec<u32>> {
+    uids.sort_unstable();
+
+    let mut batches: Vec<Vec<u32>> = Vec::new();
+    let mut batch_bytes = 0;
+    for (uid, size) in uids {
+        let size = u64::from(size);
+        match batches.last_mut() {
+            Some(batch) if batch_bytes + size <= FETCH_BATCH_BYTES => {
+                batch.push(uid);
+                batch_bytes += size;
+            }
+            _ => {
+                batches.push(vec![uid]);
+                batch_bytes = size;
+            }
+        }
+    }
+    batches
+}
+
+/// Returns the number of downloaded messages that may be queued for processing,
+/// so that approximately [`FETCH_QUEUE_BYTES`] of messages are kept in memory.
+fn fetch_queue_len(uids: &[(u32, u32)]) -> usize {
+    let total: u64 = uids.iter().map(|(_, size)| u64::from(*size)).sum();
+    let average = max(total / max(uids.len() as u64, 1), 1);
+    let len = usize::try_from(FETCH_QUEUE_BYTES / average).unwrap_or(FETCH_QUEUE_MAX_LEN);
+    len.clamp(1, FETCH_QUEUE_MAX_LEN)
+}
+
 /// Builds a list of sequence/uid sets. The returned sets have each no more than around 1000
 /// characters because according to <https://tools.ietf.org/html/rfc2683#section-3.2.1.5>
 /// command lines should not be much more than 1000 chars (servers should allow at least 8000 chars)
-fn build_sequence_sets(mut uids: Vec<u32>) -> Vec<String> {
+/// Returns the date for the `SEARCH SINCE` of [Imap::resync_folder_uids],
+/// `None` if no message is known and the whole folder has to be fetched.
+///
+/// Messages may have been moved to the folder from any other folder, so the
+/// date is taken from the oldest message of all folders. Special rows and the
+/// trash are left out: their timestamp is 0 or they are deleted locally anyway.
+async fn resync_search_since(context: &Context) -> Result<Option<String>> {
+    let oldest_timestamp: Option<i64> = context
+        .sql
+        .query_get_value::<Option<i64>>(
+            "SELECT MIN(timestamp) FROM msgs WHERE id>? AND chat_id!=? AND timestamp>0",
+            paramsv![DC_MSG_ID_LAST_SPECIAL, DC_CHAT_ID_TRASH],
+        )
+        .await?
+        .flatten();
+    Ok(oldest_timestamp.map(|oldest_timestamp| {
+        // msgs.timestamp is the sort timestamp which may be later than the
+        // INTERNALDATE, e.g. if the message was sorted below a newer one,
+        // and SEARCH SINCE compares the date only, so a week is subtracted
+        // to be on the safe side.
+        chrono::NaiveDateTime::from_timestamp(oldest_timestamp - 7 * 86_400, 0)
+            .format("%d-%b-%Y")
+            .to_string()
+    }))
+}
+
+fn build_sequence_sets(uids: Vec<u32>) -> Vec<String> {
+    build_uid_batches(uids)
+        .into_iter()
+        .map(|(set, _)| set)
+        .collect()
+}
+
+/// Like [build_sequence_sets], but also returns the UIDs contained in each set,
+/// so results of commands on the sets can be assigned to single messages.
+fn build_uid_batches(mut uids: Vec<u32>) -> Vec<(String, Vec<u32>)> {
     uids.sort_unstable();
+    uids.dedup();
 
     // first, try to find consecutive ranges:
     let mut ranges: Vec<UidRange> = vec![];
@@ -1830,24 +2082,39 @@ fn build_sequence_sets(mut uids: Vec<u32>) -> Vec<String> {
     }
 
     // Second, sort the uids into uid sets that are each below ~1000 characters
-    let mut result = vec![String::new()];
+    let mut result: Vec<(String, Vec<u32>)> = vec![Default::default()];
     for range in ranges {
-        if let Some(last) = result.last_mut() {
+        if let Some((last, last_uids)) = result.last_mut() {
             if !last.is_empty() {
                 last.push(',');
             }
             last.push_str(&range.to_string());
+            last_uids.extend(range.start..=range.end);
 
             if last.len() > 990 {
-                result.push(String::new()); // Start a new uid set
+                result.push(Default::default()); // Start a new uid set
             }
         }
     }
 
-    result.retain(|s| !s.is_empty());
+    result.retain(|(s, _)| !s.is_empty());
     result
 }
 
+/// Removes UID 0 from `uids`, recording [ImapActionResult::RetryLater] for it in `results`.
+///
+/// UID 0 means that the message was moved or deleted by us and the new UID is not known yet.
+fn retain_valid_uids(
+    mut uids: Vec<u32>,
+    results: &mut BTreeMap<u32, ImapActionResult>,
+) -> Vec<u32> {
+    if uids.contains(&0) {
+        results.insert(0, ImapActionResult::RetryLater);
+        uids.retain(|uid| *uid != 0);
+    }
+    uids
+}
+
 struct UidRange {
     start: u32,
     end: u32,
@@ -1960,4 +2227,88 @@ fn test_build_sequence_sets() {
                 .any(|set| set.split(',').any(|n| n.parse::<u32>().unwrap() == *number)));
         }
     }
+
+    #[test]
+    fn test_build_uid_batches() {
+        assert!(build_uid_batches(vec![]).is_empty());
+        assert_eq!(
+            build_uid_batches(vec![5, 2, 3, 3, 9]),
+            vec![("2:3,5,9".to_string(), vec![2, 3, 5, 9])]
+        );
+
+        let numbers: Vec<_> = (30000000..=30002500).step_by(4).collect();
+        let batches = build_uid_batches(numbers.clone());
+        let uids: Vec<u32> = batches
+            .iter()
+            .flat_map(|(_, uids)| uids.iter().copied())
+            .collect();
+        assert_eq!(uids, numbers);
+        for (set, uids) in &batches {
+            assert_eq!(set.split(',').count(), uids.len());
+        }
+    }
+
+    #[test]
+    fn test_build_fetch_batches() {
+        assert!(build_fetch_batches(vec![]).is_empty());
+        assert_eq!(
+            build_fetch_batches(vec![(3, 100), (1, 100), (2, 0)]),
+            vec![vec![1, 2, 3]]
+        );
+
+        let big = FETCH_BATCH_BYTES as u32;
+        assert_eq!(
+            build_fetch_batches(vec![
+                (1, 100),
+                (2, big),
+                (3, 100),
+                (4, big / 2),
+                (5, big / 2)
+            ]),
+            vec![vec![1], vec![2], vec![3, 4], vec![5]]
+        );
+        assert_eq!(
+            build_fetch_batches(vec![(1, big * 2), (2, big * 2)]),
+            vec![vec![1], vec![2]]
+        );
+    }
+
+    #[test]
+    fn test_fetch_queue_len() {
+        assert_eq!(fetch_queue_len(&[]), FETCH_QUEUE_MAX_LEN);
+        assert_eq!(fetch_queue_len(&[(1, 0), (2, 0)]), FETCH_QUEUE_MAX_LEN);
+        assert_eq!(
+            fetch_queue_len(&[(1, 1000), (2, 3000)]),
+            FETCH_QUEUE_MAX_LEN
+        );
+        assert_eq!(fetch_queue_len(&[(1, (FETCH_QUEUE_BYTES / 4) as u32)]), 4);
+        assert_eq!(fetch_queue_len(&[(1, u32::MAX)]), 1);
+    }
+
+    #[async_std::test]
+    async fn test_resync_search_since() -> Result<()> {
+        let t = TestContext::new_alice().await;
+        // Only the special rows exist, the whole folder has to be fetched.
+        assert_eq!(resync_search_since(&t).await?, None);
+
+        let chat = t.get_self_chat().await;
+        for (rfc724_mid, chat_id, timestamp) in &[
+            ("newer@example.org", chat.id, 1_700_000_000),
+            ("oldest@example.org", chat.id, 1_600_000_000),
+            ("trashed@example.org", DC_CHAT_ID_TRASH, 1_000_000_000),
+        ] {
+            t.sql
+                .execute(
+                    "INSERT INTO msgs (rfc724_mid, chat_id, timestamp) VALUES (?, ?, ?);",
+                    paramsv![rfc724_mid, chat_id, timestamp],
+                )
+                .await?;
+        }
+        // A week before the oldest message not in the trash.
+        assert_eq!(
+            resync_search_since(&t).await?,
+            Some("06-Sep-2020".to_string())
+        );
+        Ok(())
+    }
 }
@@ -2,11 +2,13 @@
 
 use std::any::Any;
 use std::ffi::OsStr;
+use std::sync::atomic::Ordering;
 
 use ::pgp::types::KeyTrait;
 use anyhow::{bail, ensure, format_err, Context as _, Result};
 use async_std::{
     fs::{self, File},
+    io::{Read, Write},
     path::{Path, PathBuf},
     prelude::*,
 };
@@ -494,6 +496,7 @@ async fn import_backup(context: &Context, backup_to_import: &Path) -> Result<()>
         !context.scheduler.read().await.is_running(),
         "cannot import backup, IO already running"
     );
+    context.stop_housekeeping().await;
     context.sql.close().await;
     dc_delete_file(context, context.get_dbfile()).await;
     ensure!(
@@ -503,17 +506,36 @@ async fn import_backup(context: &Context, backup_to_import: &Path) -> Result<()>
 
     let backup_file = File::open(backup_to_import).await?;
     let file_size = backup_file.metadata().await?.len();
-    let archive = Archive::new(backup_file);
+    unpack_backup(context, backup_file, file_size).await?;
+
+    context
+        .sql
+        .open(context, context.get_dbfile(), false)
+        .await
+        .context("Could not re-open db")?;
+
+    delete_and_reset_all_device_msgs(context).await?;
+
+    Ok(())
+}
+
+/// Unpacks the database and the blobs from a backup archive read from `reader`.
+///
+/// `size` is the size of the archive used for progress events, 0 if unknown.
+async fn unpack_backup<R: Read + Unpin>(context: &Context, reader: R, size: u64) -> Result<()> {
+    let archive = Archive::new(reader);
 
     let mut entries = archive.entries()?;
     while let Some(file) = entries.next().await {
         let f = &mut file?;
 
-        let current_pos = f.raw_file_position();
-        let progress = 1000 * current_pos / file_size;
-        if progress > 10 && progress < 1000 {
-            // We already emitted ImexProgress(10) above
-            context.emit_event(EventType::ImexProgress(progress as usize));
+        if size > 0 {
+            let current_pos = f.raw_file_position();
+            let progress = 1000 * current_pos / size;
+            if progress > 10 && progress < 1000 {
+                // We already emitted ImexProgress(10) above
+                context.emit_event(EventType::ImexProgress(progress as usize));
+            }
         }
 
         if f.path()?.file_name() == Some(OsStr::new(DBFILE_BACKUP_NAME)) {
@@ -537,15 +559,6 @@ async fn import_backup(context: &Context, backup_to_import: &Path) -> Result<()>
             }
         }
     }
-
-    context
-        .sql
-        .open(context, context.get_dbfile(), false)
-        .await
-        .context("Could not re-open db")?;
-
-    delete_and_reset_all_device_msgs(context).await?;
-
     Ok(())
 }
 
@@ -565,6 +578,7 @@ async fn import_backup_old(context: &Context, backup_to_import: &Path) -> Result
         !context.scheduler.read().await.is_running(),
         "cannot import backup, IO already running"
     );
+    context.stop_housekeeping().await;
     context.sql.close().await;
     dc_delete_file(context, context.get_dbfile()).await;
     ensure!(
@@ -662,18 +676,84 @@ async fn import_backup_old(context: &Context, backup_to_import: &Path) -> Result
 /*******************************************************************************
  * Export backup
  ******************************************************************************/
-#[allow(unused)]
 async fn export_backup(context: &Context, dir: &Path) -> Result<()> {
     // get a fine backup file name (the name includes the date so that multiple backup instances are possible)
     let now = time();
     let (temp_path, dest_path) = get_next_backup_path(dir, now).await?;
     let _d = DeleteOnDrop(temp_path.clone());
 
+    info!(
+        context,
+        "Backup '{}' to '{}'.",
+        context.get_dbfile().display(),
+        dest_path.display(),
+    );
+
+    let file = File::create(&temp_path).await?;
+    export_backup_stream(context, file, now).await?;
+
+    fs::rename(temp_path, &dest_path).await?;
+    context.emit_event(EventType::ImexFileWritten(dest_path));
+    Ok(())
+}
+
+/// Writes a backup to `writer`, e.g. a socket or a pipe.
+///
+/// The backup has the same format as the one written by [`ImexMode::ExportBackup`],
+/// but no file is created, so no additional disk space is needed.
+/// As for [`imex`], #DC_EVENT_IMEX_PROGRESS events are sent,
+/// and the export is canceled if the future is dropped or the ongoing process is stopped.
+pub async fn export_backup_to_writer<W>(context: &Context, writer: W) -> Result<()>
+where
+    W: Write + Unpin + Send + Sync,
+{
+    let cancel = context.alloc_ongoing().await?;
+
+    let res = async {
+        ensure!(context.sql.is_open().await, "Database not opened.");
+        context.emit_event(EventType::ImexProgress(10));
+        if e2ee::ensure_secret_key_exists(context).await.is_err() {
+            bail!("Cannot create private key or private key not available.");
+        }
+        export_backup_stream(context, writer, time()).await
+    }
+    .race(async {
+        cancel.recv().await.ok();
+        Err(format_err!("canceled"))
+    })
+    .await;
+
+    context.free_ongoing().await;
+
+    match res {
+        Ok(()) => {
+            info!(context, "Backup successfully written");
+            context.emit_event(EventType::ImexProgress(1000));
+            Ok(())
+        }
+        Err(err) => {
+            cleanup_aborted_imex(context, ImexMode::ExportBackup).await;
+            error!(context, "{:#}", err);
+            context.emit_event(EventType::ImexProgress(0));
+            bail!("Backup failed: {}", err);
+        }
+    }
+}
+
+/// Closes the database, writes the backup archive to `writer` and re-opens the database.
+async fn export_backup_stream<W>(context: &Context, writer: W, now: i64) -> Result<()>
+where
+    W: Write + Unpin + Send + Sync,
+{
     context
         .sql
         .set_raw_config_int("backup_time", now as i32)
         .await?;
-    sql::housekeeping(context).await.ok_or_log(context);
+    context.stop_housekeeping().await;
+    if !context.housekeeping_running.swap(true, Ordering::SeqCst) {
+        sql::housekeeping(context).await.ok_or_log(context);
+        context.housekeeping_running.store(false, Ordering::SeqCst);
+    }
 
     context
         .sql
@@ -689,30 +769,18 @@ async fn export_backup(context: &Context, dir: &Path) -> Result<()> {
     // we close the database during the export
     context.sql.close().await;
 
-    info!(
-        context,
-        "Backup '{}' to '{}'.",
-        context.get_dbfile().display(),
-        dest_path.display(),
-    );
-
-    let res = export_backup_inner(context, &temp_path).await;
+    let res = export_backup_inner(context, writer).await;
 
     // we re-open the database after export is finished
     context.sql.open(context, context.get_dbfile(), false).await;
 
-    match &res {
-        Ok(_) => {
-            fs::rename(temp_path, &dest_path).await?;
-            context.emit_event(EventType::ImexFileWritten(dest_path));
-        }
-        Err(e) => {
-            error!(context, "backup failed: {}", e);
-        }
+    if let Err(e) = &res {
+        error!(context, "backup failed: {}", e);
     }
 
     res
 }
+
 struct DeleteOnDrop(PathBuf);
 impl Drop for DeleteOnDrop {
     fn drop(&mut self) {
@@ -722,10 +790,40 @@ fn drop(&mut self) {
     }
 }
 
-async fn export_backup_inner(context: &Context, temp_path: &PathBuf) -> Result<()> {
-    let file = File::create(temp_path).await?;
+/// Number of blobs read ahead while the backup archive is written.
+const BACKUP_READ_AHEAD: usize = 8;
 
-    let mut builder = async_tar::Builder::new(file);
+/// Blobs up to this size are read into memory ahead of time,
+/// larger blobs are copied into the archive from the opened file.
+const BACKUP_READ_AHEAD_MAX_SIZE: u64 = 1024 * 1024;
+
+/// Content of a blob to be written to the backup.
+enum BackupBlob {
+    Data(Vec<u8>, std::fs::Metadata),
+    File(File),
+}
+
+/// Opens a blobdir entry for the backup, small files are read completely.
+///
+/// Returns `None` if the entry is not a file.
+async fn read_backup_blob(entry: fs::DirEntry) -> Result<Option<BackupBlob>> {
+    if !entry.file_type().await?.is_file() {
+        return Ok(None);
+    }
+    let metadata = entry.metadata().await?;
+    let blob = if metadata.len() <= BACKUP_READ_AHEAD_MAX_SIZE {
+        BackupBlob::Data(fs::read(entry.path()).await?, metadata)
+    } else {
+        BackupBlob::File(File::open(entry.path()).await?)
+    };
+    Ok(Some(blob))
+}
+
+async fn export_backup_inner<W>(context: &Context, writer: W) -> Result<()>
+where
+    W: Write + Unpin + Send + Sync,
+{
+    let mut builder = async_tar::Builder::new(writer);
 
     // append_path_with_name() wants the source path as the first argument, append_dir_all() wants it as the second argument.
     builder
@@ -733,23 +831,45 @@ async fn export_backup_inner(context: &Context, temp_path: &PathBuf) -> Result<(
         .await?;
 
     let read_dir: Vec<_> = fs::read_dir(context.get_blobdir()).await?.collect().await;
+    let read_dir = read_dir.into_iter().collect::<std::io::Result<Vec<_>>>()?;
     let count = read_dir.len();
     let mut written_files = 0;
 
-    for entry in read_dir.into_iter() {
-        let entry = entry?;
-        let name = entry.file_name();
-        if !entry.file_type().await?.is_file() {
-            warn!(
-                context,
-                "Export: Found dir entry {} that is not a file, ignoring",
-                name.to_string_lossy()
-            );
-            continue;
+    // Read the next blobs while the current one is written to the archive.
+    let names: Vec<_> = read_dir.iter().map(|entry| entry.file_name()).collect();
+    let mut blobs = futures::StreamExt::buffered(
+        futures::stream::iter(read_dir.into_iter().map(read_backup_blob)),
+        BACKUP_READ_AHEAD,
+    );
+
+    for name in names {
+        let blob = match blobs.next().await {
+            Some(blob) => blob?,
+            None => break,
+        };
+        let path_in_archive = PathBuf::from(BLOBS_BACKUP_NAME).join(&name);
+        match blob {
+            None => {
+                warn!(
+                    context,
+                    "Export: Found dir entry {} that is not a file, ignoring",
+                    name.to_string_lossy()
+                );
+                continue;
+            }
+            Some(BackupBlob::Data(data, metadata)) => {
+                let mut header = async_tar::Header::new_gnu();
+                header.set_metadata(&metadata);
+                header.set_size(data.len() as u64);
+                header.set_cksum();
+                builder
+                    .append_data(&mut header, path_in_archive, data.as_slice())
+                    .await?;
+            }
+            Some(BackupBlob::File(mut file)) => {
+                builder.append_file(path_in_archive, &mut file).await?;
+            }
         }
-        let mut file = File::open(entry.path()).await?;
-        let path_in_archive = PathBuf::from(BLOBS_BACKUP_NAME).join(name);
-        builder.append_file(path_in_archive, &mut file).await?;
 
         written_files += 1;
         let progress = 1000 * written_files / count;
@@ -1021,6 +1141,38 @@ async fn test_export_and_import_key() {
         }
     }
 
+    #[async_std::test]
+    async fn test_export_backup_to_writer() -> Result<()> {
+        let alice = TestContext::new_alice().await;
+        let small = BlobObject::create(&alice, "small.txt", b"hello").await?;
+        let large_content = vec![42u8; BACKUP_READ_AHEAD_MAX_SIZE as usize + 1];
+        let large = BlobObject::create(&alice, "large.bin", &large_content).await?;
+
+        let mut backup = Vec::new();
+        export_backup_to_writer(&alice, &mut backup).await?;
+
+        let dir = tempfile::tempdir()?;
+        let backup_path = dir.path().join("delta-chat-backup.tar");
+        fs::write(&backup_path, &backup).await?;
+
+        let context2 = TestContext::new().await;
+        imex(&context2, ImexMode::ImportBackup, backup_path.as_ref()).await?;
+        assert_eq!(
+            context2.get_config(Config::Addr).await?,
+            Some("alice@example.com".to_string())
+        );
+        let blobdir = context2.get_blobdir();
+        assert_eq!(
+            fs::read(blobdir.join(small.as_file_name())).await?,
+            b"hello"
+        );
+        assert_eq!(
+            fs::read(blobdir.join(large.as_file_name())).await?,
+            large_content
+        );
+        Ok(())
+    }
+
     #[test]
     fn test_normalize_setup_code() {
         let norm = normalize_setup_code("123422343234423452346234723482349234");
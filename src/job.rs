@@ -2,11 +2,14 @@
 //!
 //! This module implements a job queue maintained in the SQLite database
 //! and job types.
+use std::collections::{BTreeMap, HashMap};
 use std::future::Future;
+use std::sync::atomic::Ordering;
 use std::{fmt, time::Duration};
 
 use anyhow::{bail, ensure, format_err, Context as _, Error, Result};
 use async_smtp::smtp::response::{Category, Code, Detail};
+use async_std::sync::Mutex;
 use async_std::task::sleep;
 use deltachat_derive::{FromSql, ToSql};
 use itertools::Itertools;
@@ -19,12 +22,13 @@
 use crate::contact::{normalize_name, Contact, Modifier, Origin};
 use crate::context::Context;
 use crate::dc_tools::{dc_delete_file, dc_read_file, time};
-use crate::ephemeral::load_imap_deletion_msgid;
+use crate::ephemeral::{load_imap_deletion_msgid, load_imap_deletion_msgids};
 use crate::events::EventType;
 use crate::imap::{Imap, ImapActionResult};
 use crate::location;
 use crate::log::LogExt;
 use crate::message::{self, Message, MessageState, MsgId};
+use crate::metrics;
 use crate::mimefactory::MimeFactory;
 use crate::param::{Param, Params};
 use crate::scheduler::InterruptInfo;
@@ -36,7 +40,7 @@
 
 /// Thread IDs
 #[derive(
-    Debug, Display, Copy, Clone, PartialEq, Eq, FromPrimitive, ToPrimitive, FromSql, ToSql,
+    Debug, Display, Copy, Clone, PartialEq, Eq, Hash, FromPrimitive, ToPrimitive, FromSql, ToSql,
 )]
 #[repr(u32)]
 pub(crate) enum Thread {
@@ -140,6 +144,76 @@ fn from(action: Action) -> Thread {
     }
 }
 
+/// In-memory schedule of the `jobs` table.
+///
+/// Remembers for each [Thread] when its next job is due at the earliest,
+/// so [load_next] does not query the database while no job is due
+/// and the job loops can sleep until then.
+#[derive(Debug, Default)]
+pub(crate) struct Schedule {
+    inner: Mutex<ScheduleInner>,
+}
+
+#[derive(Debug, Default)]
+struct ScheduleInner {
+    /// Incremented whenever a job is saved.
+    generation: u64,
+
+    /// Lower bound of `desired_timestamp` of the jobs of each thread,
+    /// `i64::MAX` if the thread has no jobs.
+    ///
+    /// Threads which were not loaded yet are missing.
+    next_due: HashMap<Thread, i64>,
+}
+
+impl Schedule {
+    /// Forgets the schedule, e.g. because the database was replaced.
+    pub(crate) async fn reset(&self) {
+        self.inner.lock().await.next_due.clear();
+    }
+
+    /// Returns the timestamp the next job of `thread` is due at,
+    /// `None` if there are no jobs or the schedule is not loaded.
+    pub(crate) async fn next_due(&self, thread: Thread) -> Option<i64> {
+        self.inner
+            .lock()
+            .await
+            .next_due
+            .get(&thread)
+            .copied()
+            .filter(|due| *due < i64::MAX)
+    }
+
+    /// Returns `true` if a job of `thread` may be due at `timestamp`.
+    async fn is_due(&self, thread: Thread, timestamp: i64) -> bool {
+        match self.inner.lock().await.next_due.get(&thread) {
+            Some(due) => *due <= timestamp,
+            None => true,
+        }
+    }
+
+    async fn generation(&self) -> u64 {
+        self.inner.lock().await.generation
+    }
+
+    async fn job_saved(&self, thread: Thread, desired_timestamp: i64) {
+        let mut inner = self.inner.lock().await;
+        inner.generation += 1;
+        if let Some(due) = inner.next_due.get_mut(&thread) {
+            *due = std::cmp::min(*due, desired_timestamp);
+        }
+    }
+
+    /// Stores the result of a database query started at `generation`,
+    /// unless a job was saved in the meantime.
+    async fn set_next_due(&self, thread: Thread, generation: u64, next_due: i64) {
+        let mut inner = self.inner.lock().await;
+        if inner.generation == generation {
+            inner.next_due.insert(thread, next_due);
+        }
+    }
+}
+
 #[derive(Debug, Clone, PartialEq)]
 pub struct Job {
     pub job_id: u32,
@@ -197,6 +271,7 @@ pub(crate) async fn save(self, context: &Context) -> Result<()> {
         let thread: Thread = self.action.into();
 
         info!(context, "saving job for {}-thread: {:?}", thread, self);
+        let desired_timestamp = self.desired_timestamp;
 
         if self.job_id != 0 {
             context
@@ -224,6 +299,10 @@ pub(crate) async fn save(self, context: &Context) -> Result<()> {
                 ]
             ).await?;
         }
+        context
+            .job_schedule
+            .job_saved(thread, desired_timestamp)
+            .await;
 
         Ok(())
     }
@@ -231,7 +310,7 @@ pub(crate) async fn save(self, context: &Context) -> Result<()> {
     async fn smtp_send<F, Fut>(
         &mut self,
         context: &Context,
-        recipients: Vec<async_smtp::EmailAddress>,
+        mut recipients: Vec<async_smtp::EmailAddress>,
         message: Vec<u8>,
         job_id: u32,
         smtp: &mut Smtp,
@@ -252,10 +331,23 @@ async fn smtp_send<F, Fut>(
 
         smtp.connectivity.set_working(context).await;
 
-        let status = match smtp.send(context, recipients, message, job_id).await {
+        let recipients_cnt = recipients.len();
+        let status = match smtp.send(context, &mut recipients, message, job_id).await {
             Err(crate::smtp::send::Error::SendError(err)) => {
                 // Remote error, retry later.
                 warn!(context, "SMTP failed to send: {:?}", &err);
+                if recipients.len() < recipients_cnt {
+                    // The message was sent to some of the recipients already,
+                    // resend it only to the remaining ones.
+                    info!(
+                        context,
+                        "Smtp-job #{} sent to {} of {} recipients",
+                        self.job_id,
+                        recipients_cnt - recipients.len(),
+                        recipients_cnt
+                    );
+                    set_remaining_recipients(&mut self.param, &recipients);
+                }
                 smtp.connectivity.set_err(context, &err).await;
                 self.pending_error = Some(err.to_string());
 
@@ -544,10 +636,11 @@ async fn move_msg(&mut self, context: &Context, imap: &mut Imap) -> Status {
         let msg = job_try!(Message::load_from_db(context, MsgId::new(self.foreign_id)).await);
         let server_folder = &job_try!(msg
             .server_folder
+            .clone()
             .context("Can't move message out of folder if we don't know the current folder"));
 
         let move_res = msg.id.needs_move(context, server_folder).await;
-        let dest_folder = match move_res {
+        let dest_config = match move_res {
             Err(e) => {
                 warn!(context, "could not load dest folder: {}", e);
                 return Status::RetryLater;
@@ -559,33 +652,67 @@ async fn move_msg(&mut self, context: &Context, imap: &mut Imap) -> Status {
                 );
                 return Status::Finished(Ok(()));
             }
-            Ok(Some(config)) => match context.get_config(config).await {
-                Ok(folder) => folder,
-                Err(err) => {
-                    warn!(context, "failed to load config: {}", err);
-                    return Status::RetryLater;
-                }
-            },
+            Ok(Some(config)) => config,
+        };
+        let dest_folder = match context.get_config(dest_config).await {
+            Ok(Some(folder)) => folder,
+            Ok(None) => return Status::Finished(Err(format_err!("No mvbox folder configured"))),
+            Err(err) => {
+                warn!(context, "failed to load config: {}", err);
+                return Status::RetryLater;
+            }
         };
 
-        if let Some(dest_folder) = dest_folder {
-            match imap
-                .mv(context, server_folder, msg.server_uid, &dest_folder)
-                .await
-            {
-                ImapActionResult::RetryLater => Status::RetryLater,
-                ImapActionResult::Success => {
-                    // Rust-Imap provides no target uid on mv, so just set it to 0, update again when precheck_imf() is called for the moved message
-                    message::update_server_uid(context, &msg.rfc724_mid, &dest_folder, 0).await;
-                    Status::Finished(Ok(()))
+        // Move other messages going from the same folder to the same destination
+        // with the same commands.
+        let mut batch = Vec::new();
+        if msg.server_uid != 0 {
+            for (job_id, other) in job_try!(load_pending_msgs(context, self).await) {
+                if other.server_uid != 0
+                    && other.server_folder.as_ref() == Some(server_folder)
+                    && matches!(other.id.needs_move(context, server_folder).await, Ok(Some(config)) if config == dest_config)
+                {
+                    batch.push((job_id, other));
                 }
-                ImapActionResult::Failed => {
-                    Status::Finished(Err(format_err!("IMAP action failed")))
+            }
+        }
+
+        let mut uids = vec![msg.server_uid];
+        uids.extend(batch.iter().map(|(_, other)| other.server_uid));
+        let results = imap
+            .mv_uids(context, server_folder, uids, &dest_folder)
+            .await;
+
+        let mut done_job_ids = Vec::new();
+        for (job_id, other) in &batch {
+            match results.get(&other.server_uid) {
+                Some(ImapActionResult::RetryLater) | None => {
+                    // Leave the job in the queue, it is retried on its own.
+                }
+                Some(res) => {
+                    if *res == ImapActionResult::Success {
+                        message::update_server_uid(context, &other.rfc724_mid, &dest_folder, 0)
+                            .await;
+                    }
+                    done_job_ids.push(*job_id);
                 }
-                ImapActionResult::AlreadyDone => Status::Finished(Ok(())),
             }
-        } else {
-            Status::Finished(Err(format_err!("No mvbox folder configured")))
+        }
+        job_try!(kill_ids(context, &done_job_ids).await);
+
+        match results
+            .get(&msg.server_uid)
+            .copied()
+            .unwrap_or(ImapActionResult::RetryLater)
+        {
+            ImapActionResult::RetryLater => Status::RetryLater,
+            ImapActionResult::Success => {
+                // Rust-Imap provides no target uid on mv, so just set it to 0, update again when precheck_imf() is called for the moved message
+                message::update_server_uid(context, &msg.rfc724_mid, &dest_folder, 0).await;
+                Status::Finished(Ok(()))
+            }
+            ImapActionResult::Failed => Status::Finished(Err(format_err!("IMAP action failed"))),
+            ImapActionResult::AlreadyDone => Status::Finished(Ok(())),
         }
     }
 
@@ -597,6 +724,9 @@ async fn move_msg(&mut self, context: &Context, imap: &mut Imap) -> Status {
     /// This job removes the database record. If there are no more
     /// records pointing to the same message on the server, the job
     /// also removes the message on the server.
+    ///
+    /// Other messages due for deletion from the same folder
+    /// are deleted with the same commands.
     async fn delete_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) -> Status {
         if let Err(err) = imap.prepare(context).await {
             warn!(context, "could not connect: {:?}", err);
@@ -626,14 +756,44 @@ async fn delete_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) -> St
             } else {
                 /* if this is the last existing part of the message,
                 we delete the message from the server */
-                let mid = msg.rfc724_mid;
                 let server_folder = msg.server_folder.as_ref().unwrap();
                 let res = if msg.server_uid == 0 {
                     // Message is already deleted on IMAP server.
                     ImapActionResult::AlreadyDone
                 } else {
-                    imap.delete_msg(context, &mid, server_folder, msg.server_uid)
-                        .await
+                    let batch = job_try!(load_deletion_batch(context, &msg, server_folder).await);
+                    let mut uids: BTreeMap<u32, String> = batch
+                        .iter()
+                        .map(|other| (other.server_uid, other.rfc724_mid.clone()))
+                        .collect();
+                    uids.insert(msg.server_uid, msg.rfc724_mid.clone());
+                    let results = imap.delete_msgs(context, server_folder, &uids).await;
+
+                    for other in &batch {
+                        match results.get(&other.server_uid) {
+                            Some(ImapActionResult::AlreadyDone)
+                            | Some(ImapActionResult::Success) => {
+                                job_try!(finish_imap_deletion(context, other).await)
+                            }
+                            _ => {
+                                // Postpone the deletion, like the job itself is postponed
+                                // on failure below.
+                                let mut job = Job::new(
+                                    Action::DeleteMsgOnImap,
+                                    other.id.to_u32(),
+                                    Params::new(),
+                                    get_backoff_time_offset(1),
+                                );
+                                job.tries = 1;
+                                job_try!(job.save(context).await);
+                            }
+                        }
+                    }
+
+                    results
+                        .get(&msg.server_uid)
+                        .copied()
+                        .unwrap_or(ImapActionResult::RetryLater)
                 };
                 match res {
                     ImapActionResult::AlreadyDone | ImapActionResult::Success => {}
@@ -649,27 +809,7 @@ async fn delete_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) -> St
                     }
                 }
             }
-            if msg.chat_id.is_trash() || msg.hidden {
-                // Messages are stored in trash chat only to keep
-                // their server UID and Message-ID. Once message is
-                // deleted from the server, database record can be
-                // removed as well.
-                //
-                // Hidden messages are similar to trashed, but are
-                // related to some chat. We also delete their
-                // database records.
-                job_try!(msg.id.delete_from_db(context).await)
-            } else {
-                // Remove server UID from the database record.
-                //
-                // We have either just removed the message from the
-                // server, in which case UID is not valid anymore, or
-                // we have more refernces to the same server UID, so
-                // we remove UID to reduce the number of messages
-                // pointing to the corresponding UID. Once the counter
-                // reaches zero, we will remove the message.
-                job_try!(msg.id.unlink(context).await);
-            }
+            job_try!(finish_imap_deletion(context, &msg).await);
             Status::Finished(Ok(()))
         } else {
             /* eg. device messages have no Message-ID */
@@ -795,7 +935,7 @@ async fn markseen_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) ->
         let result = if msg.server_uid == 0 {
             // The message is moved or deleted by us.
             //
-            // Do not call set_seen with zero UID, as it will return
+            // Do not call set_seen_uids with zero UID, as it will return
             // ImapActionResult::RetryLater, but we do not want to
             // retry. If the message was moved, we will create another
             // job to mark the message as seen later. If it was
@@ -803,7 +943,38 @@ async fn markseen_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) ->
             info!(context, "Can't mark message as seen: No UID");
             ImapActionResult::Failed
         } else {
-            imap.set_seen(context, folder, msg.server_uid).await
+            // Mark other messages of the same folder as seen with the same commands.
+            let batch: Vec<(u32, Message)> = job_try!(load_pending_msgs(context, self).await)
+                .into_iter()
+                .filter(|(_, other)| {
+                    other.server_uid != 0 && other.server_folder.as_ref() == Some(folder)
+                })
+                .collect();
+            let mut uids = vec![msg.server_uid];
+            uids.extend(batch.iter().map(|(_, other)| other.server_uid));
+            let results = imap.set_seen_uids(context, folder, uids).await;
+
+            let mut done_job_ids = Vec::new();
+            for (job_id, other) in &batch {
+                match results.get(&other.server_uid) {
+                    Some(ImapActionResult::RetryLater) | None => {
+                        // Leave the job in the queue, it is retried on its own.
+                    }
+                    Some(ImapActionResult::AlreadyDone) => done_job_ids.push(*job_id),
+                    Some(ImapActionResult::Success) | Some(ImapActionResult::Failed) => {
+                        if let Err(err) = markseen_send_mdn(context, other).await {
+                            warn!(context, "could not send out mdn for {}: {}", other.id, err);
+                        }
+                        done_job_ids.push(*job_id);
+                    }
+                }
+            }
+            job_try!(kill_ids(context, &done_job_ids).await);
+
+            results
+                .get(&msg.server_uid)
+                .copied()
+                .unwrap_or(ImapActionResult::RetryLater)
         };
 
         match result {
@@ -814,26 +985,9 @@ async fn markseen_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) ->
                 // we want to send out an MDN anyway
                 // The job will not be retried so locally
                 // there is no risk of double-sending MDNs.
-                //
-                // Read receipts for system messages are never
-                // sent. These messages have no place to display
-                // received read receipt anyway.  And since their text
-                // is locally generated, quoting them is dangerous as
-                // it may contain contact names. E.g., for original
-                // message "Group left by me", a read receipt will
-                // quote "Group left by <name>", and the name can be a
-                // display name stored in address book rather than
-                // the name sent in the From field by the user.
-                if msg.param.get_bool(Param::WantsMdn).unwrap_or_default()
-                    && !msg.is_system_message()
-                {
-                    let mdns_enabled = job_try!(context.get_config_bool(Config::MdnsEnabled).await);
-                    if mdns_enabled {
-                        if let Err(err) = send_mdn(context, &msg).await {
-                            warn!(context, "could not send out mdn for {}: {}", msg.id, err);
-                            return Status::Finished(Err(err));
-                        }
-                    }
+                if let Err(err) = markseen_send_mdn(context, &msg).await {
+                    warn!(context, "could not send out mdn for {}: {}", msg.id, err);
+                    return Status::Finished(Err(err));
                 }
                 Status::Finished(Ok(()))
             }
@@ -841,6 +995,107 @@ async fn markseen_msg_on_imap(&mut self, context: &Context, imap: &mut Imap) ->
     }
 }
 
+/// Sends a read receipt for a message which was marked as seen on the server, if requested.
+///
+/// Read receipts for system messages are never
+/// sent. These messages have no place to display
+/// received read receipt anyway.  And since their text
+/// is locally generated, quoting them is dangerous as
+/// it may contain contact names. E.g., for original
+/// message "Group left by me", a read receipt will
+/// quote "Group left by <name>", and the name can be a
+/// display name stored in address book rather than
+/// the name sent in the From field by the user.
+async fn markseen_send_mdn(context: &Context, msg: &Message) -> Result<()> {
+    if msg.param.get_bool(Param::WantsMdn).unwrap_or_default()
+        && !msg.is_system_message()
+        && context.get_config_bool(Config::MdnsEnabled).await?
+    {
+        send_mdn(context, msg).await?;
+    }
+    Ok(())
+}
+
+/// Maximum number of messages handled together by a single IMAP job.
+const IMAP_BATCH_MAX_MSGS: u32 = 1000;
+
+/// Loads the messages of other due jobs with the same action as `job`,
+/// together with the job IDs.
+async fn load_pending_msgs(context: &Context, job: &Job) -> Result<Vec<(u32, Message)>> {
+    let jobs: Vec<(u32, MsgId)> = context
+        .sql
+        .query_map(
+            "SELECT id, foreign_id FROM jobs
+             WHERE action=? AND id!=? AND desired_timestamp<=?
+             ORDER BY id LIMIT ?;",
+            paramsv![job.action, job.job_id, time(), IMAP_BATCH_MAX_MSGS],
+            |row| Ok((row.get(0)?, row.get(1)?)),
+            |rows| rows.collect::<Result<Vec<_>, _>>().map_err(Into::into),
+        )
+        .await?;
+    let job_ids: HashMap<MsgId, u32> = jobs
+        .into_iter()
+        .filter(|(_, msg_id)| *msg_id != MsgId::new(job.foreign_id))
+        .map(|(job_id, msg_id)| (msg_id, job_id))
+        .collect();
+    let msg_ids: Vec<MsgId> = job_ids.keys().copied().collect();
+    let msgs = Message::load_many(context, &msg_ids).await?;
+    Ok(msgs
+        .into_iter()
+        .filter_map(|msg| job_ids.get(&msg.id).map(|job_id| (*job_id, msg)))
+        .collect())
+}
+
+/// Loads other messages that are due for deletion from `folder` on the server
+/// and can be deleted together with `msg`.
+async fn load_deletion_batch(
+    context: &Context,
+    msg: &Message,
+    folder: &str,
+) -> Result<Vec<Message>> {
+    let msg_ids: Vec<MsgId> = load_imap_deletion_msgids(context, IMAP_BATCH_MAX_MSGS)
+        .await?
+        .into_iter()
+        .filter(|id| *id != msg.id)
+        .collect();
+    let mut batch = Vec::new();
+    for other in Message::load_many(context, &msg_ids).await? {
+        if other.server_uid != 0
+            && other.server_folder.as_deref() == Some(folder)
+            && !other.rfc724_mid.is_empty()
+            && message::rfc724_mid_cnt(context, &other.rfc724_mid).await == 1
+        {
+            batch.push(other);
+        }
+    }
+    Ok(batch)
+}
+
+/// Updates the database after `msg` was deleted from the server.
+async fn finish_imap_deletion(context: &Context, msg: &Message) -> Result<()> {
+    if msg.chat_id.is_trash() || msg.hidden {
+        // Messages are stored in trash chat only to keep
+        // their server UID and Message-ID. Once message is
+        // deleted from the server, database record can be
+        // removed as well.
+        //
+        // Hidden messages are similar to trashed, but are
+        // related to some chat. We also delete their
+        // database records.
+        msg.id.delete_from_db(context).await
+    } else {
+        // Remove server UID from the database record.
+        //
+        // We have either just removed the message from the
+        // server, in which case UID is not valid anymore, or
+        // we have more refernces to the same server UID, so
+        // we remove UID to reduce the number of messages
+        // pointing to the corresponding UID. Once the counter
+        // reaches zero, we will remove the message.
+        msg.id.unlink(context).await
+    }
+}
+
 /// Delete all pending jobs with the given action.
 pub async fn kill_action(context: &Context, action: Action) -> bool {
     context
@@ -874,6 +1129,15 @@ pub async fn action_exists(context: &Context, action: Action) -> bool {
         .unwrap_or_default()
 }
 
+/// Stores the recipients a partially sent message still has to be sent to,
+/// so that retrying the job does not send it to the other recipients again.
+fn set_remaining_recipients(param: &mut Params, recipients: &[async_smtp::EmailAddress]) {
+    param.set(
+        Param::Recipients,
+        recipients.iter().map(|addr| addr.to_string()).join("\x1e"),
+    );
+}
+
 async fn set_delivered(context: &Context, msg_id: MsgId) -> Result<()> {
     message::update_msg_state(context, msg_id, MessageState::OutDelivered).await;
     let chat_id: ChatId = context
@@ -1095,6 +1359,7 @@ fn smtp(&mut self) -> &mut Smtp {
 }
 
 pub(crate) async fn perform_job(context: &Context, mut connection: Connection<'_>, mut job: Job) {
+    let _timer = metrics::start(metrics::Span::Job);
     info!(context, "{}-job {} started...", &connection, &job);
 
     let try_res = match perform_job_action(context, &mut job, &mut connection, 0).await {
@@ -1183,7 +1448,16 @@ async fn perform_job_action(
         Action::MoveMsg => job.move_msg(context, connection.inbox()).await,
         Action::FetchExistingMsgs => job.fetch_existing_msgs(context, connection.inbox()).await,
         Action::Housekeeping => {
-            sql::housekeeping(context).await.ok_or_log(context);
+            // Housekeeping may take long with many files,
+            // it runs in the background so it does not delay fetching messages.
+            if !context.housekeeping_running.swap(true, Ordering::SeqCst) {
+                let ctx = context.clone();
+                let housekeeping_task = async_std::task::spawn(async move {
+                    sql::housekeeping(&ctx).await.ok_or_log(&ctx);
+                    ctx.housekeeping_running.store(false, Ordering::SeqCst);
+                });
+                *context.housekeeping_task.write().await = Some(housekeeping_task);
+            }
             Status::Finished(Ok(()))
         }
     };
@@ -1236,9 +1510,16 @@ pub fn create(action: Action, foreign_id: u32, param: Params, delay_seconds: i64
 pub async fn add(context: &Context, job: Job) {
     let action = job.action;
     let delay_seconds = job.delay_seconds();
-    job.save(context).await.unwrap_or_else(|err| {
-        error!(context, "failed to save job: {}", err);
-    });
+    if is_pending(context, action, job.foreign_id).await {
+        info!(
+            context,
+            "not adding {} job for {}, it is already pending", action, job.foreign_id
+        );
+    } else {
+        job.save(context).await.unwrap_or_else(|err| {
+            error!(context, "failed to save job: {}", err);
+        });
+    }
 
     if delay_seconds == 0 {
         match action {
@@ -1267,7 +1548,29 @@ pub async fn add(context: &Context, job: Job) {
     }
 }
 
+/// Returns true if a job which needs to run only once per message is already pending
+/// for `foreign_id`.
+///
+/// Marking a message as seen or moving it twice has no effect, so these jobs are
+/// not added again.
+async fn is_pending(context: &Context, action: Action, foreign_id: u32) -> bool {
+    match action {
+        Action::MarkseenMsgOnImap | Action::MoveMsg => context
+            .sql
+            .exists(
+                "SELECT COUNT(*) FROM jobs WHERE action=? AND foreign_id=?;",
+                paramsv![action, foreign_id],
+            )
+            .await
+            .unwrap_or_default(),
+        _ => false,
+    }
+}
+
 async fn load_housekeeping_job(context: &Context) -> Option<Job> {
+    if context.housekeeping_running.load(Ordering::SeqCst) {
+        return None;
+    }
     let last_time = match context.get_config_i64(Config::LastHousekeeping).await {
         Ok(last_time) => last_time,
         Err(err) => {
@@ -1285,6 +1588,62 @@ async fn load_housekeeping_job(context: &Context) -> Option<Job> {
     }
 }
 
+/// Loads the first job matching `query`, removing jobs which can not be loaded.
+async fn load_next_from_db(
+    context: &Context,
+    query: &str,
+    params: impl rusqlite::Params + Clone,
+) -> Option<Job> {
+    loop {
+        let job_res = context
+            .sql
+            .query_row_optional(query, params.clone(), |row| {
+                let job = Job {
+                    job_id: row.get("id")?,
+                    action: row.get("action")?,
+                    foreign_id: row.get("foreign_id")?,
+                    desired_timestamp: row.get("desired_timestamp")?,
+                    added_timestamp: row.get("added_timestamp")?,
+                    tries: row.get("tries")?,
+                    param: row.get::<_, String>("param")?.parse().unwrap_or_default(),
+                    pending_error: None,
+                };
+
+                Ok(job)
+            })
+            .await;
+
+        match job_res {
+            Ok(job) => break job,
+            Err(err) => {
+                // Remove invalid job from the DB
+                info!(context, "cleaning up job, because of {}", err);
+
+                // TODO: improve by only doing a single query
+                match context
+                    .sql
+                    .query_row(query, params.clone(), |row| row.get::<_, i32>(0))
+                    .await
+                {
+                    Ok(id) => {
+                        if let Err(err) = context
+                            .sql
+                            .execute("DELETE FROM jobs WHERE id=?;", paramsv![id])
+                            .await
+                        {
+                            warn!(context, "failed to delete job {}: {:?}", id, err);
+                        }
+                    }
+                    Err(err) => {
+                        error!(context, "failed to retrieve invalid job from DB: {}", err);
+                        break None;
+                    }
+                }
+            }
+        }
+    }
+}
+
 /// Load jobs from the database.
 ///
 /// Load jobs for this "[Thread]", i.e. either load SMTP jobs or load
@@ -1315,6 +1674,11 @@ pub(crate) async fn load_next(
     let m;
     let thread_i = thread as i64;
 
+    // Only the regular query for due jobs is answered by the schedule,
+    // interrupts for a message or after network changes always query the database.
+    let use_schedule = info.msg_id.is_none() && !info.probe_network;
+    let generation = context.job_schedule.generation().await;
+
     if let Some(msg_id) = info.msg_id {
         query = r#"
 SELECT id, action, foreign_id, param, added_timestamp, desired_timestamp, tries
@@ -1350,53 +1714,29 @@ pub(crate) async fn load_next(
         params = paramsv![thread_i];
     };
 
-    let job = loop {
-        let job_res = context
-            .sql
-            .query_row_optional(query, params.clone(), |row| {
-                let job = Job {
-                    job_id: row.get("id")?,
-                    action: row.get("action")?,
-                    foreign_id: row.get("foreign_id")?,
-                    desired_timestamp: row.get("desired_timestamp")?,
-                    added_timestamp: row.get("added_timestamp")?,
-                    tries: row.get("tries")?,
-                    param: row.get::<_, String>("param")?.parse().unwrap_or_default(),
-                    pending_error: None,
-                };
-
-                Ok(job)
-            })
-            .await;
-
-        match job_res {
-            Ok(job) => break job,
-            Err(err) => {
-                // Remove invalid job from the DB
-                info!(context, "cleaning up job, because of {}", err);
-
-                // TODO: improve by only doing a single query
-                match context
-                    .sql
-                    .query_row(query, params.clone(), |row| row.get::<_, i32>(0))
-                    .await
-                {
-                    Ok(id) => {
-                        if let Err(err) = context
-                            .sql
-                            .execute("DELETE FROM jobs WHERE id=?;", paramsv![id])
-                            .await
-                        {
-                            warn!(context, "failed to delete job {}: {:?}", id, err);
-                        }
-                    }
-                    Err(err) => {
-                        error!(context, "failed to retrieve invalid job from DB: {}", err);
-                        break None;
-                    }
+    let job = if use_schedule && !context.job_schedule.is_due(thread, t).await {
+        None
+    } else {
+        let job = load_next_from_db(context, query, params).await;
+        if use_schedule && job.is_none() {
+            match context
+                .sql
+                .query_get_value::<i64>(
+                    "SELECT MIN(desired_timestamp) FROM jobs WHERE thread=?;",
+                    paramsv![thread_i],
+                )
+                .await
+            {
+                Ok(next_due) => {
+                    context
+                        .job_schedule
+                        .set_next_due(thread, generation, next_due.unwrap_or(i64::MAX))
+                        .await
                 }
+                Err(err) => warn!(context, "failed to load next job timestamp: {:#}", err),
             }
         }
+        job
     };
 
     match thread {
@@ -1428,6 +1768,8 @@ pub(crate) async fn load_next(
 mod tests {
     use super::*;
 
+    use crate::constants::DEFAULT_MAX_SMTP_RCPT_TO;
+    use crate::smtp::send::{next_recipients_chunk, recipients_chunk_sent, recipients_chunk_size};
     use crate::test_utils::TestContext;
 
     async fn insert_job(context: &Context, foreign_id: i64, valid: bool) {
@@ -1449,6 +1791,8 @@ async fn insert_job(context: &Context, foreign_id: i64, valid: bool) {
             )
             .await
             .unwrap();
+        // The job was not added using `job::add`.
+        context.job_schedule.reset().await;
     }
 
     #[async_std::test]
@@ -1491,4 +1835,94 @@ async fn test_load_next_job_one() {
         .await;
         assert!(jobs.is_some());
     }
+
+    #[async_std::test]
+    async fn test_schedule() {
+        let t = TestContext::new().await;
+        let info = InterruptInfo::new(false, None);
+
+        assert!(load_next(&t, Thread::Smtp, &info).await.is_none());
+        assert_eq!(t.job_schedule.next_due(Thread::Smtp).await, None);
+
+        let job = Job::new(Action::SendMdn, 1, Params::new(), 100);
+        let due = job.desired_timestamp;
+        add(&t, job).await;
+        assert_eq!(t.job_schedule.next_due(Thread::Smtp).await, Some(due));
+        assert!(load_next(&t, Thread::Smtp, &info).await.is_none());
+
+        // Jobs added without delay are due at once.
+        add(&t, Job::new(Action::SendMdn, 2, Params::new(), 0)).await;
+        let job = load_next(&t, Thread::Smtp, &info).await.unwrap();
+        assert_eq!(job.foreign_id, 2);
+    }
+
+    #[async_std::test]
+    async fn test_add_coalesces_jobs() {
+        let t = TestContext::new().await;
+        for _ in 0..3 {
+            add(
+                &t,
+                Job::new(Action::MarkseenMsgOnImap, 42, Params::new(), 0),
+            )
+            .await;
+        }
+        add(
+            &t,
+            Job::new(Action::MarkseenMsgOnImap, 43, Params::new(), 0),
+        )
+        .await;
+        let cnt = t
+            .sql
+            .count(
+                "SELECT COUNT(*) FROM jobs WHERE action=?;",
+                paramsv![Action::MarkseenMsgOnImap],
+            )
+            .await
+            .unwrap();
+        assert_eq!(cnt, 2);
+    }
+
+    #[test]
+    #[allow(clippy::indexing_slicing)]
+    fn test_remaining_recipients_after_failed_chunk() {
+        let all: Vec<async_smtp::EmailAddress> = (0..5)
+            .map(|i| async_smtp::EmailAddress::new(format!("rcpt{}@example.org", i)).unwrap())
+            .collect();
+        let to_strings = |addrs: &[async_smtp::EmailAddress]| {
+            addrs
+                .iter()
+                .map(|addr| addr.to_string())
+                .collect::<Vec<_>>()
+        };
+        let chunk_size = recipients_chunk_size(Some(2));
+        assert_eq!(chunk_size, 2);
+
+        // The first chunk is accepted.
+        let mut recipients = all.clone();
+        let chunk = next_recipients_chunk(&recipients, chunk_size);
+        assert_eq!(to_strings(&chunk), to_strings(&all[..2]));
+        recipients_chunk_sent(&mut recipients, chunk.len());
+
+        // Sending the second chunk fails, so it is not removed.
+        let chunk = next_recipients_chunk(&recipients, chunk_size);
+        assert_eq!(to_strings(&chunk), to_strings(&all[2..4]));
+        assert_eq!(to_strings(&recipients), to_strings(&all[2..]));
+
+        let mut param = Params::new();
+        set_remaining_recipients(&mut param, &recipients);
+        assert_eq!(
+            param.get(Param::Recipients),
+            Some("rcpt2@example.org\x1ercpt3@example.org\x1ercpt4@example.org")
+        );
+
+        // The last chunk is shorter than the chunk size.
+        recipients_chunk_sent(&mut recipients, chunk.len());
+        let chunk = next_recipients_chunk(&recipients, chunk_size);
+        assert_eq!(to_strings(&chunk), to_strings(&all[4..]));
+        recipients_chunk_sent(&mut recipients, chunk.len());
+        assert!(recipients.is_empty());
+
+        assert_eq!(recipients_chunk_size(Some(0)), 1);
+        assert_eq!(recipients_chunk_size(None), DEFAULT_MAX_SMTP_RCPT_TO);
+    }
 }
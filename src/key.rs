@@ -1,12 +1,14 @@
 //! Cryptographic key module
 
-use std::collections::BTreeMap;
+use std::collections::{BTreeMap, HashMap};
 use std::fmt;
 use std::io::Cursor;
+use std::sync::Mutex;
 
 use anyhow::{format_err, Result};
 use async_trait::async_trait;
 use num_traits::FromPrimitive;
+use once_cell::sync::Lazy;
 use pgp::composed::Deserializable;
 use pgp::ser::Serialize;
 use pgp::types::{KeyTrait, SecretKeyTrait};
@@ -36,6 +38,16 @@ fn from_slice(bytes: &[u8]) -> Result<Self::KeyType> {
         ))?)
     }
 
+    /// Create a key from some bytes, reusing a previously parsed key if possible.
+    ///
+    /// Use this for keys loaded from the database, as the same keys
+    /// are loaded for every sent or received message.  Only public keys
+    /// are kept in the process-wide cache, secret keys are parsed every
+    /// time; [DcKey::load_self] caches them per account instead.
+    fn from_slice_cached(bytes: &[u8]) -> Result<Self::KeyType> {
+        Self::from_slice(bytes)
+    }
+
     /// Create a key from a base64 string.
     fn from_base64(data: &str) -> Result<Self::KeyType> {
         // strip newlines and other whitespace
@@ -91,6 +103,10 @@ fn fingerprint(&self) -> Fingerprint {
 impl DcKey for SignedPublicKey {
     type KeyType = SignedPublicKey;
 
+    fn from_slice_cached(bytes: &[u8]) -> Result<Self::KeyType> {
+        PUBLIC_KEY_CACHE.get_or_parse(bytes, Self::from_slice)
+    }
+
     async fn load_self(context: &Context) -> Result<Self::KeyType> {
         match context
             .sql
@@ -109,7 +125,7 @@ async fn load_self(context: &Context) -> Result<Self::KeyType> {
             )
             .await?
         {
-            Some(bytes) => Self::from_slice(&bytes),
+            Some(bytes) => Self::from_slice_cached(&bytes),
             None => {
                 let keypair = generate_keypair(context).await?;
                 Ok(keypair.public)
@@ -156,7 +172,10 @@ async fn load_self(context: &Context) -> Result<Self::KeyType> {
             )
             .await?
         {
-            Some(bytes) => Self::from_slice(&bytes),
+            Some(bytes) => context
+                .sql
+                .secret_key_cache
+                .get_or_parse(&bytes, Self::from_slice),
             None => {
                 let keypair = generate_keypair(context).await?;
                 Ok(keypair.secret)
@@ -181,6 +200,71 @@ fn to_asc(&self, header: Option<(&str, &str)>) -> String {
     }
 }
 
+/// Maximum number of parsed keys of each type kept in memory.
+const KEY_CACHE_CAPACITY: usize = 256;
+
+static PUBLIC_KEY_CACHE: Lazy<KeyCache<SignedPublicKey>> = Lazy::new(KeyCache::new);
+
+/// Cache of parsed keys.
+///
+/// The keys are looked up by their serialized form, so a changed key
+/// is simply a different entry and the cache never returns outdated
+/// keys.  When the cache is full, it is cleared.
+///
+/// Public keys are cached process-wide, secret keys only per account
+/// in [crate::sql::Sql], so they are not kept in memory after the
+/// account is removed or its keys are replaced.
+pub(crate) struct KeyCache<T> {
+    keys: Mutex<HashMap<Vec<u8>, T>>,
+}
+
+impl<T> fmt::Debug for KeyCache<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        // Do not print the keys, they may be secret.
+        f.debug_struct("KeyCache")
+            .field("len", &self.keys.lock().unwrap().len())
+            .finish()
+    }
+}
+
+impl<T> Default for KeyCache<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T> KeyCache<T> {
+    pub(crate) fn new() -> Self {
+        Self {
+            keys: Mutex::new(HashMap::new()),
+        }
+    }
+
+    pub(crate) fn clear(&self) {
+        self.keys.lock().unwrap().clear();
+    }
+}
+
+impl<T: Clone> KeyCache<T> {
+    pub(crate) fn get_or_parse(
+        &self,
+        bytes: &[u8],
+        parse: impl FnOnce(&[u8]) -> Result<T>,
+    ) -> Result<T> {
+        if let Some(key) = self.keys.lock().unwrap().get(bytes) {
+            return Ok(key.clone());
+        }
+
+        let key = parse(bytes)?;
+        let mut keys = self.keys.lock().unwrap();
+        if keys.len() >= KEY_CACHE_CAPACITY {
+            keys.clear();
+        }
+        keys.insert(bytes.to_vec(), key.clone());
+        Ok(key)
+    }
+}
+
 /// Deltachat extension trait for secret keys.
 ///
 /// Provides some convenience wrappers only applicable to [SignedSecretKey].
@@ -314,6 +398,8 @@ pub async fn store_self_keypair(
         )
         .await
         .map_err(|err| err.context("failed to insert keypair"))?;
+    // Do not keep replaced secret keys in memory.
+    context.sql.secret_key_cache.clear();
 
     Ok(())
 }
@@ -455,6 +541,36 @@ fn test_from_armored_string() {
         SignedSecretKey::from_slice(&binary).expect("invalid private key");
     }
 
+    #[test]
+    fn test_from_slice_cached() {
+        let public = DcKey::to_bytes(&KEYPAIR.public);
+        let secret = DcKey::to_bytes(&KEYPAIR.secret);
+        for _ in 0..2 {
+            assert_eq!(
+                SignedPublicKey::from_slice_cached(&public).unwrap(),
+                KEYPAIR.public
+            );
+            assert_eq!(
+                SignedSecretKey::from_slice_cached(&secret).unwrap(),
+                KEYPAIR.secret
+            );
+        }
+        assert!(SignedPublicKey::from_slice_cached(b"bad key").is_err());
+    }
+
+    #[test]
+    fn test_key_cache_capacity() {
+        let cache = KeyCache::new();
+        for i in 0..KEY_CACHE_CAPACITY + 1 {
+            let bytes = i.to_string();
+            let key = cache
+                .get_or_parse(bytes.as_bytes(), |b| Ok(b.to_vec()))
+                .unwrap();
+            assert_eq!(key, bytes.as_bytes());
+        }
+        assert_eq!(cache.keys.lock().unwrap().len(), 1);
+    }
+
     #[test]
     fn test_asc_roundtrip() {
         let key = KEYPAIR.public.clone();
@@ -516,6 +632,13 @@ async fn test_load_self_existing() {
         assert_eq!(alice.public, pubkey);
         let seckey = SignedSecretKey::load_self(&t).await.unwrap();
         assert_eq!(alice.secret, seckey);
+        assert_eq!(t.sql.secret_key_cache.keys.lock().unwrap().len(), 1);
+
+        // Storing a keypair drops the cached secret keys.
+        store_self_keypair(&t, &alice, KeyPairUse::Default)
+            .await
+            .unwrap();
+        assert!(t.sql.secret_key_cache.keys.lock().unwrap().is_empty());
     }
 
     #[async_std::test]
@@ -58,11 +58,15 @@ impl<T: rusqlite::ToSql + Send + Sync> ToSql for T {}
 pub mod job;
 mod format_flowed;
 pub mod key;
+#[cfg(feature = "internals")]
+pub mod keyring;
+#[cfg(not(feature = "internals"))]
 mod keyring;
 pub mod location;
 mod login_param;
 pub mod lot;
 pub mod message;
+pub mod metrics;
 mod mimefactory;
 pub mod mimeparser;
 pub mod oauth2;
@@ -71,11 +75,19 @@ impl<T: rusqlite::ToSql + Send + Sync> ToSql for T {}
 pub mod pgp;
 pub mod provider;
 pub mod qr;
+mod read_cache;
 pub mod securejoin;
+#[cfg(feature = "internals")]
+pub mod simplify;
+#[cfg(not(feature = "internals"))]
 mod simplify;
 mod smtp;
 pub mod stock_str;
 mod token;
+#[cfg(feature = "internals")]
+#[macro_use]
+pub mod dehtml;
+#[cfg(not(feature = "internals"))]
 #[macro_use]
 mod dehtml;
 mod color;
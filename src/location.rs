@@ -1,5 +1,6 @@
 //! Location handling
 use std::convert::TryFrom;
+use std::fmt::Write;
 
 use anyhow::{ensure, Error};
 use bitflags::bitflags;
@@ -280,43 +281,48 @@ pub async fn set(context: &Context, latitude: f64, longitude: f64, accuracy: f64
     if latitude == 0.0 && longitude == 0.0 {
         return true;
     }
-    let mut continue_streaming = false;
 
-    if let Ok(chats) = context
+    // The location is stored for all chats it is streamed to in a single transaction.
+    let now = time();
+    let stored = context
         .sql
-        .query_map(
-            "SELECT id FROM chats WHERE locations_send_until>?;",
-            paramsv![time()],
-            |row| row.get::<_, i32>(0),
-            |chats| chats.collect::<Result<Vec<_>, _>>().map_err(Into::into),
-        )
-        .await
-    {
-        for chat_id in chats {
-            if let Err(err) = context.sql.execute(
-                    "INSERT INTO locations  \
-                     (latitude, longitude, accuracy, timestamp, chat_id, from_id) VALUES (?,?,?,?,?,?);",
-                    paramsv![
-                        latitude,
-                        longitude,
-                        accuracy,
-                        time(),
-                        chat_id,
-                        DC_CONTACT_ID_SELF,
-                    ]
-            ).await {
-                warn!(context, "failed to store location {:?}", err);
-            } else {
-                continue_streaming = true;
+        .transaction(move |transaction| {
+            let chat_ids = transaction
+                .prepare_cached("SELECT id FROM chats WHERE locations_send_until>?;")?
+                .query_map(paramsv![now], |row| row.get::<_, ChatId>(0))?
+                .collect::<rusqlite::Result<Vec<_>>>()?;
+            let mut stmt = transaction.prepare_cached(
+                "INSERT INTO locations \
+                 (latitude, longitude, accuracy, timestamp, chat_id, from_id) VALUES (?,?,?,?,?,?);",
+            )?;
+            for chat_id in &chat_ids {
+                stmt.execute(paramsv![
+                    latitude,
+                    longitude,
+                    accuracy,
+                    now,
+                    chat_id,
+                    DC_CONTACT_ID_SELF,
+                ])?;
             }
+            Ok(chat_ids.len())
+        })
+        .await;
+
+    match stored {
+        Ok(count) => {
+            let continue_streaming = count > 0;
+            if continue_streaming {
+                context.emit_event(EventType::LocationChanged(Some(DC_CONTACT_ID_SELF)));
+            };
+            schedule_maybe_send_locations(context, false).await;
+            continue_streaming
+        }
+        Err(err) => {
+            warn!(context, "failed to store location {:?}", err);
+            false
         }
-        if continue_streaming {
-            context.emit_event(EventType::LocationChanged(Some(DC_CONTACT_ID_SELF)));
-        };
-        schedule_maybe_send_locations(context, false).await;
     }
-
-    continue_streaming
 }
 
 pub async fn get_range(
@@ -330,31 +336,28 @@ pub async fn get_range(
         timestamp_to = time() + 10;
     }
 
-    let (disable_chat_id, chat_id) = match chat_id {
-        Some(chat_id) => (0, chat_id),
-        None => (1, ChatId::new(0)), // this ChatId is unused
-    };
-    let (disable_contact_id, contact_id) = match contact_id {
-        Some(contact_id) => (0, contact_id),
-        None => (1, 0), // this contact_id is unused
+    // Only the used filters are added to the query,
+    // so the (chat_id, timestamp) and (from_id, timestamp) indexes can be used.
+    let filter = match (chat_id, contact_id) {
+        (Some(_), Some(_)) => "l.chat_id=?1 AND l.from_id=?2 AND",
+        (Some(_), None) => "l.chat_id=?1 AND",
+        (None, Some(_)) => "l.from_id=?2 AND",
+        (None, None) => "",
     };
+    let chat_id = chat_id.unwrap_or_else(|| ChatId::new(0)); // unused if not set
+    let contact_id = contact_id.unwrap_or_default(); // unused if not set
     let list = context
         .sql
         .query_map(
-            "SELECT l.id, l.latitude, l.longitude, l.accuracy, l.timestamp, l.independent, \
-             COALESCE(m.id, 0) AS msg_id, l.from_id, l.chat_id, COALESCE(m.txt, '') AS txt \
-             FROM locations l  LEFT JOIN msgs m ON l.id=m.location_id  WHERE (? OR l.chat_id=?) \
-             AND (? OR l.from_id=?) \
-             AND (l.independent=1 OR (l.timestamp>=? AND l.timestamp<=?)) \
-             ORDER BY l.timestamp DESC, l.id DESC, msg_id DESC;",
-            paramsv![
-                disable_chat_id,
-                chat_id,
-                disable_contact_id,
-                contact_id as i32,
-                timestamp_from,
-                timestamp_to,
-            ],
+            format!(
+                "SELECT l.id, l.latitude, l.longitude, l.accuracy, l.timestamp, l.independent, \
+                 COALESCE(m.id, 0) AS msg_id, l.from_id, l.chat_id, COALESCE(m.txt, '') AS txt \
+                 FROM locations l  LEFT JOIN msgs m ON l.id=m.location_id \
+                 WHERE {} (l.independent=1 OR (l.timestamp>=?3 AND l.timestamp<=?4)) \
+                 ORDER BY l.timestamp DESC, l.id DESC, msg_id DESC;",
+                filter
+            ),
+            paramsv![chat_id, contact_id as i32, timestamp_from, timestamp_to],
             |row| {
                 let msg_id = row.get(6)?;
                 let txt: String = row.get(9)?;
@@ -432,11 +435,12 @@ pub async fn get_kml(context: &Context, chat_id: ChatId) -> Result<(String, u32)
     let mut location_count = 0;
     let mut ret = String::new();
     if locations_send_begin != 0 && now <= locations_send_until {
-        ret += &format!(
+        write!(
+            ret,
             "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\
             <kml xmlns=\"http://www.opengis.net/kml/2.2\">\n<Document addr=\"{}\">\n",
             self_addr,
-        );
+        )?;
 
         context
             .sql
@@ -460,20 +464,24 @@ pub async fn get_kml(context: &Context, chat_id: ChatId) -> Result<(String, u32)
                     let latitude: f64 = row.get(1)?;
                     let longitude: f64 = row.get(2)?;
                     let accuracy: f64 = row.get(3)?;
-                    let timestamp = get_kml_timestamp(row.get(4)?);
+                    let timestamp: i64 = row.get(4)?;
 
                     Ok((location_id, latitude, longitude, accuracy, timestamp))
                 },
                 |rows| {
                     for row in rows {
                         let (location_id, latitude, longitude, accuracy, timestamp) = row?;
-                        ret += &format!(
+                        write!(
+                            ret,
                             "<Placemark>\
                 <Timestamp><when>{}</when></Timestamp>\
                 <Point><coordinates accuracy=\"{}\">{},{}</coordinates></Point>\
                 </Placemark>\n",
-                            timestamp, accuracy, longitude, latitude
-                        );
+                            get_kml_timestamp(timestamp),
+                            accuracy,
+                            longitude,
+                            latitude
+                        )?;
                         location_count += 1;
                         last_added_location_id = location_id as u32;
                     }
@@ -489,11 +497,9 @@ pub async fn get_kml(context: &Context, chat_id: ChatId) -> Result<(String, u32)
     Ok((ret, last_added_location_id))
 }
 
-fn get_kml_timestamp(utc: i64) -> String {
-    // Returns a string formatted as YYYY-MM-DDTHH:MM:SSZ. The trailing `Z` indicates UTC.
-    chrono::NaiveDateTime::from_timestamp(utc, 0)
-        .format("%Y-%m-%dT%H:%M:%SZ")
-        .to_string()
+fn get_kml_timestamp(utc: i64) -> impl std::fmt::Display {
+    // Returns a timestamp formatted as YYYY-MM-DDTHH:MM:SSZ. The trailing `Z` indicates UTC.
+    chrono::NaiveDateTime::from_timestamp(utc, 0).format("%Y-%m-%dT%H:%M:%SZ")
 }
 
 pub fn get_message_kml(timestamp: i64, latitude: f64, longitude: f64) -> String {
@@ -556,9 +562,16 @@ pub async fn save(
     let mut newest_timestamp = 0;
     let mut newest_location_id = 0;
 
-    let stmt_insert = "INSERT INTO locations\
-             (timestamp, from_id, chat_id, latitude, longitude, accuracy, independent) \
-             VALUES (?,?,?,?,?,?,?);";
+    // All locations of a message are stored in a single transaction.
+    let mut conn = context.sql.get_write_conn().await?;
+    let transaction = conn.transaction()?;
+    let mut stmt_test =
+        transaction.prepare_cached("SELECT id FROM locations WHERE timestamp=? AND from_id=?")?;
+    let mut stmt_insert = transaction.prepare_cached(
+        "INSERT INTO locations\
+         (timestamp, from_id, chat_id, latitude, longitude, accuracy, independent) \
+         VALUES (?,?,?,?,?,?,?);",
+    )?;
 
     for location in locations {
         let &Location {
@@ -569,11 +582,6 @@ pub async fn save(
             ..
         } = location;
 
-        let conn = context.sql.get_conn().await?;
-        let mut stmt_test =
-            conn.prepare_cached("SELECT id FROM locations WHERE timestamp=? AND from_id=?")?;
-        let mut stmt_insert = conn.prepare_cached(stmt_insert)?;
-
         let exists = stmt_test.exists(paramsv![timestamp, contact_id as i32])?;
 
         if independent || !exists {
@@ -588,14 +596,14 @@ pub async fn save(
             ])?;
 
             if timestamp > newest_timestamp {
-                // okay to drop, as we use cached prepared statements
-                drop(stmt_test);
-                drop(stmt_insert);
                 newest_timestamp = timestamp;
-                newest_location_id = conn.last_insert_rowid();
+                newest_location_id = transaction.last_insert_rowid();
             }
         }
     }
+    drop(stmt_test);
+    drop(stmt_insert);
+    transaction.commit()?;
 
     Ok(u32::try_from(newest_location_id)?)
 }
@@ -781,6 +789,43 @@ async fn test_kml_parse() {
         assert_eq!(locations_ref[1].timestamp, 1544739072);
     }
 
+    #[async_std::test]
+    async fn test_set_and_get_range() {
+        let t = TestContext::new_alice().await;
+        let chat1 = t.create_chat_with_contact("Bob", "bob@example.net").await;
+        let chat2 = t
+            .create_chat_with_contact("Claire", "claire@example.net")
+            .await;
+
+        // No chat is streaming yet.
+        assert!(!set(&t, 1.0, 2.0, 3.0).await);
+
+        send_locations_to_chat(&t, chat1.id, 1000).await;
+        assert!(set(&t, 1.0, 2.0, 3.0).await);
+
+        let locations = get_range(&t, Some(chat1.id), None, 0, 0).await.unwrap();
+        assert_eq!(locations.len(), 1);
+        assert_eq!(locations[0].contact_id, DC_CONTACT_ID_SELF);
+        assert_eq!(locations[0].chat_id, chat1.id);
+        assert!(get_range(&t, Some(chat2.id), None, 0, 0)
+            .await
+            .unwrap()
+            .is_empty());
+        let locations = get_range(&t, Some(chat1.id), Some(DC_CONTACT_ID_SELF), 0, 0)
+            .await
+            .unwrap();
+        assert_eq!(locations.len(), 1);
+        let locations = get_range(&t, None, Some(DC_CONTACT_ID_SELF), 0, 0)
+            .await
+            .unwrap();
+        assert_eq!(locations.len(), 1);
+        assert_eq!(get_range(&t, None, None, 0, 0).await.unwrap().len(), 1);
+
+        let (kml, location_id) = get_kml(&t, chat1.id).await.unwrap();
+        assert!(kml.contains("<coordinates accuracy=\"3\">2,1</coordinates>"));
+        assert_eq!(location_id, locations[0].location_id);
+    }
+
     #[async_std::test]
     async fn test_get_message_kml() {
         let context = TestContext::new().await;
@@ -1,6 +1,6 @@
 //! # Messages and their identifiers
 
-use std::collections::BTreeMap;
+use std::collections::{BTreeMap, HashMap};
 use std::convert::TryInto;
 
 use anyhow::{ensure, format_err, Result};
@@ -322,6 +322,42 @@ pub struct Message {
     pub(crate) param: Params,
 }
 
+/// Query prefix selecting all columns needed by [`Message::from_row`].
+///
+/// Callers append a `WHERE` clause on `m.id`.
+const MESSAGE_SELECT: &str = concat!(
+    "SELECT",
+    "    m.id AS id,",
+    "    rfc724_mid AS rfc724mid,",
+    "    m.mime_in_reply_to AS mime_in_reply_to,",
+    "    m.server_folder AS server_folder,",
+    "    m.server_uid AS server_uid,",
+    "    m.chat_id AS chat_id,",
+    "    m.from_id AS from_id,",
+    "    m.to_id AS to_id,",
+    "    m.timestamp AS timestamp,",
+    "    m.timestamp_sent AS timestamp_sent,",
+    "    m.timestamp_rcvd AS timestamp_rcvd,",
+    "    m.ephemeral_timer AS ephemeral_timer,",
+    "    m.ephemeral_timestamp AS ephemeral_timestamp,",
+    "    m.type AS type,",
+    "    m.state AS state,",
+    "    m.error AS error,",
+    "    m.msgrmsg AS msgrmsg,",
+    "    m.mime_modified AS mime_modified,",
+    "    m.txt AS txt,",
+    "    m.subject AS subject,",
+    "    m.param AS param,",
+    "    m.hidden AS hidden,",
+    "    m.location_id AS location,",
+    "    c.blocked AS blocked",
+    " FROM msgs m LEFT JOIN chats c ON c.id=m.chat_id"
+);
+
+/// Maximum number of message IDs bound to a single query by [`Message::load_many`],
+/// keeping well below SQLite's limit of 999 host parameters.
+const LOAD_MANY_CHUNK_SIZE: usize = 500;
+
 impl Message {
     pub fn new(viewtype: Viewtype) -> Self {
         Message {
@@ -339,95 +375,99 @@ pub async fn load_from_db(context: &Context, id: MsgId) -> Result<Message> {
         let msg = context
             .sql
             .query_row(
-                concat!(
-                    "SELECT",
-                    "    m.id AS id,",
-                    "    rfc724_mid AS rfc724mid,",
-                    "    m.mime_in_reply_to AS mime_in_reply_to,",
-                    "    m.server_folder AS server_folder,",
-                    "    m.server_uid AS server_uid,",
-                    "    m.chat_id AS chat_id,",
-                    "    m.from_id AS from_id,",
-                    "    m.to_id AS to_id,",
-                    "    m.timestamp AS timestamp,",
-                    "    m.timestamp_sent AS timestamp_sent,",
-                    "    m.timestamp_rcvd AS timestamp_rcvd,",
-                    "    m.ephemeral_timer AS ephemeral_timer,",
-                    "    m.ephemeral_timestamp AS ephemeral_timestamp,",
-                    "    m.type AS type,",
-                    "    m.state AS state,",
-                    "    m.error AS error,",
-                    "    m.msgrmsg AS msgrmsg,",
-                    "    m.mime_modified AS mime_modified,",
-                    "    m.txt AS txt,",
-                    "    m.subject AS subject,",
-                    "    m.param AS param,",
-                    "    m.hidden AS hidden,",
-                    "    m.location_id AS location,",
-                    "    c.blocked AS blocked",
-                    " FROM msgs m LEFT JOIN chats c ON c.id=m.chat_id",
-                    " WHERE m.id=?;"
-                ),
+                format!("{} WHERE m.id=?;", MESSAGE_SELECT),
                 paramsv![id],
-                |row| {
-                    let text = match row.get_ref("txt")? {
-                        rusqlite::types::ValueRef::Text(buf) => {
-                            match String::from_utf8(buf.to_vec()) {
-                                Ok(t) => t,
-                                Err(_) => {
-                                    warn!(
-                                        context,
-                                        concat!(
-                                            "dc_msg_load_from_db: could not get ",
-                                            "text column as non-lossy utf8 id {}"
-                                        ),
-                                        id
-                                    );
-                                    String::from_utf8_lossy(buf).into_owned()
-                                }
-                            }
-                        }
-                        _ => String::new(),
-                    };
-                    let msg = Message {
-                        id: row.get("id")?,
-                        rfc724_mid: row.get::<_, String>("rfc724mid")?,
-                        in_reply_to: row
-                            .get::<_, Option<String>>("mime_in_reply_to")?
-                            .and_then(|in_reply_to| parse_message_id(&in_reply_to).ok()),
-                        server_folder: row.get::<_, Option<String>>("server_folder")?,
-                        server_uid: row.get("server_uid")?,
-                        chat_id: row.get("chat_id")?,
-                        from_id: row.get("from_id")?,
-                        to_id: row.get("to_id")?,
-                        timestamp_sort: row.get("timestamp")?,
-                        timestamp_sent: row.get("timestamp_sent")?,
-                        timestamp_rcvd: row.get("timestamp_rcvd")?,
-                        ephemeral_timer: row.get("ephemeral_timer")?,
-                        ephemeral_timestamp: row.get("ephemeral_timestamp")?,
-                        viewtype: row.get("type")?,
-                        state: row.get("state")?,
-                        error: Some(row.get::<_, String>("error")?)
-                            .filter(|error| !error.is_empty()),
-                        is_dc_message: row.get("msgrmsg")?,
-                        mime_modified: row.get("mime_modified")?,
-                        text: Some(text),
-                        subject: row.get("subject")?,
-                        param: row.get::<_, String>("param")?.parse().unwrap_or_default(),
-                        hidden: row.get("hidden")?,
-                        location_id: row.get("location")?,
-                        chat_blocked: row
-                            .get::<_, Option<Blocked>>("blocked")?
-                            .unwrap_or_default(),
-                    };
-                    Ok(msg)
-                },
+                |row| Message::from_row(context, row),
             )
             .await?;
 
         Ok(msg)
     }
 
+    /// Loads several messages from the database at once.
+    ///
+    /// All messages are read using one query per chunk of IDs instead of one query per
+    /// message, which makes this the preferred way to load the visible messages of a chat.
+    /// Messages are returned in the order of `ids`, repeated IDs are returned repeatedly,
+    /// special and non-existent message IDs are skipped.
+    pub async fn load_many(context: &Context, ids: &[MsgId]) -> Result<Vec<Message>> {
+        let ids: Vec<MsgId> = ids.iter().copied().filter(|id| !id.is_special()).collect();
+        let mut loaded: HashMap<MsgId, Message> = HashMap::with_capacity(ids.len());
+        for chunk in ids.chunks(LOAD_MANY_CHUNK_SIZE) {
+            let msgs = context
+                .sql
+                .query_map(
+                    format!(
+                        "{} WHERE m.id IN({});",
+                        MESSAGE_SELECT,
+                        chunk.iter().map(|_| "?").join(",")
+                    ),
+                    rusqlite::params_from_iter(chunk),
+                    |row| Message::from_row(context, row),
+                    |rows| rows.collect::<Result<Vec<_>, _>>().map_err(Into::into),
+                )
+                .await?;
+            for msg in msgs {
+                loaded.insert(msg.id, msg);
+            }
+        }
+
+        Ok(ids.iter().filter_map(|id| loaded.get(id).cloned()).collect())
+    }
+
+    /// Creates a message from a row selected with [`MESSAGE_SELECT`].
+    fn from_row(context: &Context, row: &rusqlite::Row) -> rusqlite::Result<Message> {
+        let id: MsgId = row.get("id")?;
+        let text = match row.get_ref("txt")? {
+            rusqlite::types::ValueRef::Text(buf) => match String::from_utf8(buf.to_vec()) {
+                Ok(t) => t,
+                Err(_) => {
+                    warn!(
+                        context,
+                        concat!(
+                            "dc_msg_load_from_db: could not get ",
+                            "text column as non-lossy utf8 id {}"
+                        ),
+                        id
+                    );
+                    String::from_utf8_lossy(buf).into_owned()
+                }
+            },
+            _ => String::new(),
+        };
+        let msg = Message {
+            id,
+            rfc724_mid: row.get::<_, String>("rfc724mid")?,
+            in_reply_to: row
+                .get::<_, Option<String>>("mime_in_reply_to")?
+                .and_then(|in_reply_to| parse_message_id(&in_reply_to).ok()),
+            server_folder: row.get::<_, Option<String>>("server_folder")?,
+            server_uid: row.get("server_uid")?,
+            chat_id: row.get("chat_id")?,
+            from_id: row.get("from_id")?,
+            to_id: row.get("to_id")?,
+            timestamp_sort: row.get("timestamp")?,
+            timestamp_sent: row.get("timestamp_sent")?,
+            timestamp_rcvd: row.get("timestamp_rcvd")?,
+            ephemeral_timer: row.get("ephemeral_timer")?,
+            ephemeral_timestamp: row.get("ephemeral_timestamp")?,
+            viewtype: row.get("type")?,
+            state: row.get("state")?,
+            error: Some(row.get::<_, String>("error")?).filter(|error| !error.is_empty()),
+            is_dc_message: row.get("msgrmsg")?,
+            mime_modified: row.get("mime_modified")?,
+            text: Some(text),
+            subject: row.get("subject")?,
+            param: row.get::<_, String>("param")?.parse().unwrap_or_default(),
+            hidden: row.get("hidden")?,
+            location_id: row.get("location")?,
+            chat_blocked: row
+                .get::<_, Option<Blocked>>("blocked")?
+                .unwrap_or_default(),
+        };
+        Ok(msg)
+    }
+
     pub fn get_filemime(&self) -> Option<String> {
         if let Some(m) = self.param.get(Param::MimeType) {
             return Some(m.to_string());
@@ -2689,6 +2729,46 @@ async fn test_get_chat_id() {
         assert_eq!(msg.get_text().unwrap(), "hello".to_string());
     }
 
+    #[async_std::test]
+    async fn test_load_many() -> Result<()> {
+        let t = TestContext::new_alice().await;
+        let self_chat = t.get_self_chat().await;
+        let mut ids = Vec::new();
+        for i in 0..3 {
+            ids.push(chat::send_text_msg(&t, self_chat.id, format!("msg {}", i)).await?);
+        }
+
+        // order of the requested ids is kept, special and unknown ids are skipped
+        let request = vec![
+            ids[2],
+            MsgId::new(DC_MSG_ID_LAST_SPECIAL),
+            ids[0],
+            MsgId::new(u32::MAX),
+            ids[1],
+        ];
+        let msgs = Message::load_many(&t, &request).await?;
+        assert_eq!(msgs.len(), 3);
+        assert_eq!(msgs[0].get_id(), ids[2]);
+        assert_eq!(msgs[1].get_id(), ids[0]);
+        assert_eq!(msgs[2].get_id(), ids[1]);
+        for msg in &msgs {
+            let single = Message::load_from_db(&t, msg.get_id()).await?;
+            assert_eq!(msg.get_text(), single.get_text());
+            assert_eq!(msg.get_timestamp(), single.get_timestamp());
+            assert_eq!(msg.get_state(), single.get_state());
+        }
+
+        // repeated ids are returned repeatedly
+        let msgs = Message::load_many(&t, &[ids[0], ids[1], ids[0]]).await?;
+        assert_eq!(msgs.len(), 3);
+        assert_eq!(msgs[0].get_id(), ids[0]);
+        assert_eq!(msgs[1].get_id(), ids[1]);
+        assert_eq!(msgs[2].get_id(), ids[0]);
+
+        assert!(Message::load_many(&t, &[]).await?.is_empty());
+        Ok(())
+    }
+
     #[async_std::test]
     async fn test_set_override_sender_name() {
         // send message with overridden sender name
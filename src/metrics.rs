@@ -0,0 +1,234 @@
+//! # Metrics
+//!
+//! Counters and latency histograms of the hot paths, such as fetching,
+//! receiving, decrypting and sending messages and SQL queries.
+//!
+//! Recording is disabled by default. While disabled, a [Timer] costs a
+//! single atomic load, so the instrumentation is compiled into release
+//! builds and can be enabled at runtime with [set_enabled]. The metrics
+//! are shared by all contexts of the process, [snapshot_json] returns
+//! them as JSON.
+
+use std::collections::BTreeMap;
+use std::convert::TryFrom;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+use once_cell::sync::Lazy;
+use serde::Serialize;
+use strum::IntoEnumIterator;
+use strum_macros::{EnumIter, IntoStaticStr};
+
+/// Number of histogram buckets.
+///
+/// Bucket `i` counts durations below `2^i` microseconds which do not fit
+/// into bucket `i - 1`, the last bucket also counts all longer durations.
+const BUCKETS: usize = 26;
+
+/// Instrumented operations.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, EnumIter, IntoStaticStr)]
+#[strum(serialize_all = "snake_case")]
+pub(crate) enum Span {
+    /// `Imap::fetch_new_messages`
+    ImapFetch,
+
+    /// `dc_receive_imf_inner`
+    ReceiveImf,
+
+    /// `MimeMessage::from_bytes`
+    MimeParse,
+
+    /// `pgp::pk_decrypt`
+    Decrypt,
+
+    /// `MimeFactory::render`
+    Render,
+
+    /// `Smtp::send`
+    SmtpSend,
+
+    /// `job::perform_job`
+    Job,
+
+    /// `Sql` helpers reading from the database.
+    SqlRead,
+
+    /// `Sql` helpers writing to the database, including waiting for the write lock.
+    SqlWrite,
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+static STATS: Lazy<Vec<SpanStats>> =
+    Lazy::new(|| Span::iter().map(|_| SpanStats::default()).collect());
+
+#[derive(Debug, Default)]
+struct SpanStats {
+    count: AtomicU64,
+    total_us: AtomicU64,
+    max_us: AtomicU64,
+    buckets: [AtomicU64; BUCKETS],
+}
+
+impl SpanStats {
+    fn record(&self, duration: Duration) {
+        let us = u64::try_from(duration.as_micros()).unwrap_or(u64::MAX);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.total_us.fetch_add(us, Ordering::Relaxed);
+        self.max_us.fetch_max(us, Ordering::Relaxed);
+        let bucket = (64 - us.leading_zeros() as usize).min(BUCKETS - 1);
+        if let Some(bucket) = self.buckets.get(bucket) {
+            bucket.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    fn reset(&self) {
+        self.count.store(0, Ordering::Relaxed);
+        self.total_us.store(0, Ordering::Relaxed);
+        self.max_us.store(0, Ordering::Relaxed);
+        for bucket in &self.buckets {
+            bucket.store(0, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Measures the time until it is dropped and records it for its [Span].
+#[derive(Debug)]
+#[must_use = "the time is measured until the timer is dropped"]
+pub(crate) struct Timer {
+    span: Span,
+    start: Option<Instant>,
+}
+
+impl Drop for Timer {
+    fn drop(&mut self) {
+        if let Some(start) = self.start {
+            if let Some(stats) = STATS.get(self.span as usize) {
+                stats.record(start.elapsed());
+            }
+        }
+    }
+}
+
+/// Starts measuring `span`, see [Timer].
+pub(crate) fn start(span: Span) -> Timer {
+    let start = if ENABLED.load(Ordering::Relaxed) {
+        Some(Instant::now())
+    } else {
+        None
+    };
+    Timer { span, start }
+}
+
+/// Enables or disables recording of the metrics.
+///
+/// Disabling keeps the already recorded metrics.
+pub fn set_enabled(enabled: bool) {
+    ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+/// Returns true if the metrics are recorded.
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Clears the recorded metrics.
+pub fn reset() {
+    for stats in STATS.iter() {
+        stats.reset();
+    }
+}
+
+#[derive(Debug, Serialize)]
+struct Snapshot {
+    enabled: bool,
+    spans: BTreeMap<&'static str, SpanSnapshot>,
+}
+
+#[derive(Debug, Serialize)]
+struct SpanSnapshot {
+    count: u64,
+    total_us: u64,
+    max_us: u64,
+    /// Non-empty histogram buckets as `[upper bound in microseconds, count]`,
+    /// the upper bound of the last bucket is `null`.
+    histogram: Vec<(Option<u64>, u64)>,
+}
+
+/// Returns the recorded metrics as JSON.
+///
+/// The result has the form
+/// `{"enabled":true,"spans":{"sql_read":{"count":3,"total_us":120,"max_us":80,"histogram":[[32,1],[128,2]]},...}}`.
+/// A histogram entry `[32,1]` means that one operation took at least 16, but less than 32
+/// microseconds.
+pub fn snapshot_json() -> String {
+    let spans = Span::iter()
+        .zip(STATS.iter())
+        .map(|(span, stats)| {
+            let histogram = stats
+                .buckets
+                .iter()
+                .enumerate()
+                .filter_map(|(i, bucket)| {
+                    let count = bucket.load(Ordering::Relaxed);
+                    if count == 0 {
+                        return None;
+                    }
+                    let upper_bound = if i + 1 < BUCKETS {
+                        Some(1u64 << i)
+                    } else {
+                        None
+                    };
+                    Some((upper_bound, count))
+                })
+                .collect();
+            let snapshot = SpanSnapshot {
+                count: stats.count.load(Ordering::Relaxed),
+                total_us: stats.total_us.load(Ordering::Relaxed),
+                max_us: stats.max_us.load(Ordering::Relaxed),
+                histogram,
+            };
+            (<&'static str>::from(span), snapshot)
+        })
+        .collect();
+    let snapshot = Snapshot {
+        enabled: is_enabled(),
+        spans,
+    };
+    serde_json::to_string(&snapshot).unwrap_or_default()
+}
+
+#[cfg(test)]
+mod tests {
+    #![allow(clippy::indexing_slicing)]
+
+    use super::*;
+
+    #[test]
+    fn test_record() {
+        let stats = SpanStats::default();
+        stats.record(Duration::from_micros(0));
+        stats.record(Duration::from_micros(20));
+        stats.record(Duration::from_micros(31));
+        stats.record(Duration::from_secs(3600));
+        assert_eq!(stats.count.load(Ordering::Relaxed), 4);
+        assert_eq!(stats.max_us.load(Ordering::Relaxed), 3_600_000_000);
+        assert_eq!(stats.buckets[0].load(Ordering::Relaxed), 1);
+        // 16..32 microseconds
+        assert_eq!(stats.buckets[5].load(Ordering::Relaxed), 2);
+        assert_eq!(stats.buckets[BUCKETS - 1].load(Ordering::Relaxed), 1);
+    }
+
+    #[test]
+    fn test_snapshot_json() {
+        let was_enabled = is_enabled();
+        set_enabled(true);
+        drop(start(Span::Render));
+        let snapshot: serde_json::Value = serde_json::from_str(&snapshot_json()).unwrap();
+        // Restore the state before asserting, so other tests are not affected if this one fails.
+        set_enabled(was_enabled);
+        assert_eq!(snapshot["enabled"], true);
+        assert!(snapshot["spans"]["render"]["count"].as_u64().unwrap() >= 1);
+        assert!(snapshot["spans"]["sql_write"].is_object());
+    }
+}
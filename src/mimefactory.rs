@@ -2,6 +2,7 @@
 
 use anyhow::{bail, ensure, format_err, Result};
 use chrono::TimeZone;
+use itertools::Itertools;
 use lettre_email::{mime, Address, Header, MimeMultipartType, PartBuilder};
 
 use crate::blob::BlobObject;
@@ -21,6 +22,7 @@
 use crate::html::new_html_mimepart;
 use crate::location;
 use crate::message::{self, Message, MsgId};
+use crate::metrics;
 use crate::mimeparser::SystemMessage;
 use crate::param::Param;
 use crate::peerstate::{Peerstate, PeerstateVerifiedStatus};
@@ -262,16 +264,16 @@ async fn peerstates_for_recipients(
             .await?
             .ok_or_else(|| format_err!("Not configured"))?;
 
-        let mut res = Vec::new();
-        for (_, addr) in self
+        let addrs: Vec<&str> = self
             .recipients
             .iter()
             .filter(|(_, addr)| addr != &self_addr)
-        {
-            res.push((Peerstate::from_addr(context, addr).await?, addr.as_str()));
-        }
+            .map(|(_, addr)| addr.as_str())
+            .unique_by(|addr| addr.to_ascii_lowercase())
+            .collect();
+        let peerstates = Peerstate::from_addrs(context, &addrs).await?;
 
-        Ok(res)
+        Ok(peerstates.into_iter().zip(addrs).collect())
     }
 
     fn is_e2ee_guaranteed(&self) -> bool {
@@ -436,6 +438,7 @@ pub fn recipients(&self) -> Vec<String> {
     }
 
     pub async fn render(mut self, context: &Context) -> Result<RenderedEmail> {
+        let _timer = metrics::start(metrics::Span::Render);
         let mut headers: MessageHeaders = Default::default();
 
         let from = Address::new_mailbox_with_name(
@@ -1,3 +1,4 @@
+use std::borrow::Cow;
 use std::collections::{HashMap, HashSet};
 use std::future::Future;
 use std::pin::Pin;
@@ -5,6 +6,7 @@
 use anyhow::{bail, Result};
 use deltachat_derive::{FromSql, ToSql};
 use lettre_email::mime::{self, Mime};
+use mailparse::body::Body;
 use mailparse::{addrparse_header, DispositionType, MailHeader, MailHeaderMap, SingleInfo};
 use once_cell::sync::Lazy;
 
@@ -13,7 +15,7 @@
 use crate::constants::{Viewtype, DC_DESIRED_TEXT_LEN, DC_ELLIPSE};
 use crate::contact::addr_normalize;
 use crate::context::Context;
-use crate::dc_tools::{dc_get_filemeta, dc_truncate};
+use crate::dc_tools::{dc_delete_file, dc_get_filemeta, dc_truncate};
 use crate::dehtml::dehtml;
 use crate::e2ee;
 use crate::events::EventType;
@@ -22,6 +24,7 @@
 use crate::key::Fingerprint;
 use crate::location;
 use crate::message;
+use crate::metrics;
 use crate::param::{Param, Params};
 use crate::peerstate::Peerstate;
 use crate::simplify::simplify;
@@ -134,6 +137,7 @@ fn default() -> Self {
 
 impl MimeMessage {
     pub async fn from_bytes(context: &Context, body: &[u8]) -> Result<Self> {
+        let _timer = metrics::start(metrics::Span::MimeParse);
         let mail = mailparse::parse_mail(body)?;
 
         let message_time = mail
@@ -823,16 +827,29 @@ async fn add_single_part_if_known(
 
         match filename {
             Some(filename) => {
-                self.do_add_single_file_part(
-                    context,
-                    msg_type,
-                    mime_type,
-                    &raw_mime,
-                    &mail.get_body_raw()?,
-                    &filename,
-                    is_related,
-                )
-                .await;
+                if !self
+                    .add_streamed_file_part(
+                        context,
+                        msg_type,
+                        mime_type.clone(),
+                        &raw_mime,
+                        mail,
+                        &filename,
+                        is_related,
+                    )
+                    .await
+                {
+                    self.do_add_single_file_part(
+                        context,
+                        msg_type,
+                        mime_type,
+                        &raw_mime,
+                        &mail.get_body_raw()?,
+                        &filename,
+                        is_related,
+                    )
+                    .await;
+                }
             }
             None => {
                 match mime_type.type_() {
@@ -969,7 +986,7 @@ async fn do_add_single_file_part(
         /* we have a regular file attachment,
         write decoded data to new blob object */
 
-        let blob = match BlobObject::create(context, filename, decoded_data).await {
+        let blob = match BlobObject::create_deduplicated(context, filename, decoded_data).await {
             Ok(blob) => blob,
             Err(err) => {
                 error!(
@@ -981,19 +998,108 @@ async fn do_add_single_file_part(
         };
         info!(context, "added blobfile: {:?}", blob.as_name());
 
-        /* create and register Mime part referencing the new Blob object */
-        let mut part = Part::default();
-        if mime_type.type_() == mime::IMAGE {
-            if let Ok((width, height)) = dc_get_filemeta(decoded_data) {
-                part.param.set_int(Param::Width, width as i32);
-                part.param.set_int(Param::Height, height as i32);
+        let dimensions = if mime_type.type_() == mime::IMAGE {
+            dc_get_filemeta(decoded_data).ok()
+        } else {
+            None
+        };
+        self.do_add_blob_part(
+            msg_type,
+            mime_type,
+            raw_mime,
+            &blob,
+            decoded_data.len(),
+            dimensions,
+            filename,
+            is_related,
+        );
+    }
+
+    /// Decodes a large attachment directly into a blob file and adds it.
+    ///
+    /// Only the raw message is kept in memory, the attachment is decoded chunk by chunk.
+    /// Returns false if the attachment is small, needs to be parsed or can not be
+    /// decoded this way; it should be added with [MimeMessage::do_add_single_file_part] then.
+    #[allow(clippy::too_many_arguments)]
+    async fn add_streamed_file_part(
+        &mut self,
+        context: &Context,
+        msg_type: Viewtype,
+        mime_type: Mime,
+        raw_mime: &str,
+        mail: &mailparse::ParsedMail<'_>,
+        filename: &str,
+        is_related: bool,
+    ) -> bool {
+        if filename.ends_with(".kml") {
+            return false;
+        }
+        let body = mail.get_body_encoded();
+        let chunks = match &body {
+            Body::Base64(body) => DecodedChunks::new(body.get_raw(), true),
+            Body::SevenBit(body) | Body::EightBit(body) => {
+                DecodedChunks::new(body.get_raw(), false)
+            }
+            Body::Binary(body) => DecodedChunks::new(body.get_raw(), false),
+            Body::QuotedPrintable(_) => return false,
+        };
+        if chunks.raw.len() < STREAMED_ATTACHMENT_MIN_SIZE {
+            return false;
+        }
+
+        let (blob, bytes) = match BlobObject::create_from_chunks(context, filename, chunks).await {
+            Ok(res) => res,
+            Err(err) => {
+                warn!(
+                    context,
+                    "Could not decode mime part {} into blob: {}", filename, err
+                );
+                return false;
             }
+        };
+        if bytes == 0 {
+            dc_delete_file(context, blob.as_name()).await;
+            return true;
+        }
+        info!(context, "added blobfile: {:?}", blob.as_name());
+
+        let dimensions = if mime_type.type_() == mime::IMAGE {
+            image::io::Reader::open(blob.to_abs_path())
+                .and_then(|reader| reader.with_guessed_format())
+                .ok()
+                .and_then(|reader| reader.into_dimensions().ok())
+        } else {
+            None
+        };
+        self.do_add_blob_part(
+            msg_type, mime_type, raw_mime, &blob, bytes, dimensions, filename, is_related,
+        );
+        true
+    }
+
+    /// Creates and registers a Mime part referencing the new Blob object.
+    #[allow(clippy::too_many_arguments)]
+    fn do_add_blob_part(
+        &mut self,
+        msg_type: Viewtype,
+        mime_type: Mime,
+        raw_mime: &str,
+        blob: &BlobObject<'_>,
+        bytes: usize,
+        dimensions: Option<(u32, u32)>,
+        filename: &str,
+        is_related: bool,
+    ) {
+        let mut part = Part::default();
+        if let Some((width, height)) = dimensions {
+            part.param.set_int(Param::Width, width as i32);
+            part.param.set_int(Param::Height, height as i32);
         }
 
         part.typ = msg_type;
         part.org_filename = Some(filename.to_string());
         part.mimetype = Some(mime_type);
-        part.bytes = decoded_data.len();
+        part.bytes = bytes;
         part.param.set(Param::File, blob.as_name());
         part.param.set(Param::MimeType, raw_mime);
         part.is_related = is_related;
@@ -1404,6 +1510,60 @@ pub(crate) fn parse_message_id(ids: &str) -> Result<String> {
     }
 }
 
+/// Attachments with a larger encoded body are decoded directly into
+/// the blob file instead of into memory first.
+const STREAMED_ATTACHMENT_MIN_SIZE: usize = 1024 * 1024;
+
+/// Number of base64 characters decoded at once, a multiple of 4.
+const BASE64_CHUNK_SIZE: usize = 256 * 1024;
+
+/// Iterator over the decoded data of a base64-encoded or unencoded body.
+struct DecodedChunks<'a> {
+    raw: &'a [u8],
+    base64: bool,
+}
+
+impl<'a> DecodedChunks<'a> {
+    fn new(raw: &'a [u8], base64: bool) -> Self {
+        Self { raw, base64 }
+    }
+}
+
+impl<'a> Iterator for DecodedChunks<'a> {
+    type Item = std::io::Result<Cow<'a, [u8]>>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.raw.is_empty() {
+            return None;
+        }
+        if !self.base64 {
+            return Some(Ok(Cow::Borrowed(std::mem::take(&mut self.raw))));
+        }
+
+        // Collect the next base64 characters, skipping line breaks.
+        let mut encoded = Vec::with_capacity(BASE64_CHUNK_SIZE);
+        let mut consumed = 0;
+        for c in self.raw {
+            consumed += 1;
+            if !c.is_ascii_whitespace() {
+                encoded.push(*c);
+                if encoded.len() == BASE64_CHUNK_SIZE {
+                    break;
+                }
+            }
+        }
+        self.raw = self.raw.get(consumed..).unwrap_or_default();
+        if encoded.is_empty() {
+            return None;
+        }
+        Some(
+            base64::decode(&encoded)
+                .map(Cow::Owned)
+                .map_err(|err| std::io::Error::new(std::io::ErrorKind::InvalidData, err)),
+        )
+    }
+}
+
 fn is_known(key: &str) -> bool {
     matches!(
         key,
@@ -2322,6 +2482,68 @@ async fn test_parse_inline_attachment() {
         assert_eq!(message.parts[0].msg, "Mail with inline attachment – Hello!");
     }
 
+    #[async_std::test]
+    async fn test_parse_large_attachment() {
+        let context = TestContext::new().await;
+        let data: Vec<u8> = (0..STREAMED_ATTACHMENT_MIN_SIZE as u32)
+            .map(|i| (i % 251) as u8)
+            .collect();
+        let encoded = base64::encode(&data);
+        let mut raw = b"From: sender@example.com
+To: receiver@example.com
+Subject: Mail with large attachment
+MIME-Version: 1.0
+Content-Type: multipart/mixed; boundary=\"==break==\"
+
+--==break==
+Content-Type: text/plain; charset=utf-8
+
+Hello!
+
+--==break==
+Content-Type: application/octet-stream; name=\"data.bin\"
+Content-Transfer-Encoding: base64
+Content-Disposition: attachment; filename=\"data.bin\"
+
+"
+        .to_vec();
+        for line in encoded.as_bytes().chunks(76) {
+            raw.extend_from_slice(line);
+            raw.extend_from_slice(b"\r\n");
+        }
+        raw.extend_from_slice(b"--==break==--\n");
+
+        let message = MimeMessage::from_bytes(&context.ctx, &raw).await.unwrap();
+        assert_eq!(message.parts.len(), 1);
+        let part = &message.parts[0];
+        assert_eq!(part.typ, Viewtype::File);
+        assert_eq!(part.bytes, data.len());
+        let blob = part
+            .param
+            .get_blob(Param::File, &context, false)
+            .await
+            .unwrap()
+            .unwrap();
+        assert_eq!(async_std::fs::read(blob.to_abs_path()).await.unwrap(), data);
+    }
+
+    #[test]
+    fn test_decoded_chunks() {
+        let data: Vec<u8> = (0..BASE64_CHUNK_SIZE as u32 * 2).map(|i| i as u8).collect();
+        let encoded = base64::encode(&data).replace("A", "A\r\n");
+        let decoded: Vec<u8> = DecodedChunks::new(encoded.as_bytes(), true)
+            .map(|chunk| chunk.unwrap().into_owned())
+            .flatten()
+            .collect();
+        assert_eq!(decoded, data);
+
+        assert!(DecodedChunks::new(b"not base64!", true)
+            .next()
+            .unwrap()
+            .is_err());
+        assert_eq!(DecodedChunks::new(b"", true).count(), 0);
+    }
+
     #[async_std::test]
     async fn test_hide_html_without_content() {
         let t = TestContext::new().await;
@@ -1,12 +1,14 @@
+use std::borrow::Cow;
 use std::collections::BTreeMap;
 use std::fmt;
+use std::ops::Range;
 use std::str;
 
 use anyhow::{bail, Error};
 use async_std::path::PathBuf;
-use itertools::Itertools;
 use num_traits::FromPrimitive;
-use serde::{Deserialize, Serialize};
+use serde::{Deserialize, Deserializer, Serialize, Serializer};
+use smallvec::SmallVec;
 
 use crate::blob::{BlobError, BlobObject};
 use crate::context::Context;
@@ -145,24 +147,66 @@ pub enum Param {
 ///
 /// The structure is serialized by calling `to_string()` on it.
 ///
+/// All values are stored in a single string buffer,
+/// so parsing a parameter list allocates at most once
+/// no matter how many keys it contains.
+/// To read a single value from a serialized parameter list
+/// without parsing all of it, use [Params::lookup].
+///
 /// Only for library-internal use.
-#[derive(Debug, Clone, PartialEq, Eq, Default, Serialize, Deserialize)]
+#[derive(Clone, Default)]
 pub struct Params {
-    inner: BTreeMap<Param, String>,
+    /// Concatenated values. May contain stale values of removed or overwritten keys.
+    buf: String,
+
+    /// Keys sorted by [Param], with the range of the value in `buf`.
+    entries: SmallVec<[(Param, Range<usize>); 4]>,
+}
+
+impl fmt::Debug for Params {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_map().entries(self.iter()).finish()
+    }
+}
+
+impl PartialEq for Params {
+    fn eq(&self, other: &Self) -> bool {
+        self.iter().eq(other.iter())
+    }
+}
+
+impl Eq for Params {}
+
+impl Serialize for Params {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        serializer.collect_map(self.iter())
+    }
+}
+
+impl<'de> Deserialize<'de> for Params {
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+        let map = BTreeMap::<Param, String>::deserialize(deserializer)?;
+        let mut params = Params::new();
+        for (key, value) in map {
+            params.set(key, value);
+        }
+        Ok(params)
+    }
 }
 
 impl fmt::Display for Params {
     fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
-        for (i, (key, value)) in self.inner.iter().enumerate() {
+        for (i, (key, value)) in self.iter().enumerate() {
             if i > 0 {
                 writeln!(f)?;
             }
-            write!(
-                f,
-                "{}={}",
-                *key as u8 as char,
-                value.split('\n').join("\n\n")
-            )?;
+            write!(f, "{}=", key as u8 as char)?;
+            for (j, part) in value.split('\n').enumerate() {
+                if j > 0 {
+                    f.write_str("\n\n")?;
+                }
+                f.write_str(part)?;
+            }
         }
         Ok(())
     }
@@ -172,24 +216,28 @@ impl str::FromStr for Params {
     type Err = Error;
 
     fn from_str(s: &str) -> std::result::Result<Self, Self::Err> {
-        let mut inner = BTreeMap::new();
+        let mut params = Params {
+            buf: String::with_capacity(s.len()),
+            entries: SmallVec::new(),
+        };
         let mut lines = s.lines().peekable();
 
         while let Some(line) = lines.next() {
-            if let [key, value] = line.splitn(2, '=').collect::<Vec<_>>()[..] {
-                let key = key.to_string();
-                let mut value = value.to_string();
+            if let Some((key, value)) = split_key_value(line) {
+                let start = params.buf.len();
+                params.buf.push_str(value);
                 while let Some(s) = lines.peek() {
                     if !s.is_empty() {
                         break;
                     }
                     lines.next();
-                    value.push('\n');
-                    value += lines.next().unwrap_or_default();
+                    params.buf.push('\n');
+                    params.buf += lines.next().unwrap_or_default();
                 }
 
                 if let Some(key) = key.as_bytes().first().and_then(|key| Param::from_u8(*key)) {
-                    inner.insert(key, value);
+                    let end = params.buf.len();
+                    params.insert_range(key, start..end);
                 } else {
                     bail!("Unknown key: {}", key);
                 }
@@ -198,46 +246,131 @@ fn from_str(s: &str) -> std::result::Result<Self, Self::Err> {
             }
         }
 
-        Ok(Params { inner })
+        Ok(params)
     }
 }
 
+/// Splits a serialized `key=value` line at the first `=`.
+fn split_key_value(line: &str) -> Option<(&str, &str)> {
+    let pos = line.find('=')?;
+    Some((line.get(..pos)?, line.get(pos + 1..)?))
+}
+
 impl Params {
     /// Create new empty params.
     pub fn new() -> Self {
         Default::default()
     }
 
+    /// Reads the value of the given key directly from a serialized parameter list.
+    ///
+    /// This avoids parsing the whole list when only one value is needed,
+    /// e.g. when filtering many database rows by a single parameter.
+    /// Unlike parsing, unknown keys and malformed lines are skipped.
+    /// If the key is set more than once, the last value is returned.
+    pub fn lookup(serialized: &str, key: Param) -> Option<Cow<'_, str>> {
+        let mut found = None;
+        let mut lines = serialized.lines().peekable();
+        while let Some(line) = lines.next() {
+            let (line_key, value) = match split_key_value(line) {
+                Some(key_value) => key_value,
+                None => continue,
+            };
+            let mut value = Cow::Borrowed(value);
+            while let Some(s) = lines.peek() {
+                if !s.is_empty() {
+                    break;
+                }
+                lines.next();
+                let value = value.to_mut();
+                value.push('\n');
+                *value += lines.next().unwrap_or_default();
+            }
+            if line_key.as_bytes().first() == Some(&(key as u8)) {
+                found = Some(value);
+            }
+        }
+        found
+    }
+
+    /// Iterates over all keys and their values, ordered by key.
+    pub fn iter(&self) -> impl Iterator<Item = (Param, &str)> {
+        self.entries
+            .iter()
+            .map(move |(key, range)| (*key, self.buf.get(range.clone()).unwrap_or_default()))
+    }
+
+    fn position(&self, key: Param) -> Result<usize, usize> {
+        self.entries.binary_search_by_key(&key, |(k, _)| *k)
+    }
+
+    fn insert_range(&mut self, key: Param, range: Range<usize>) {
+        match self.position(key) {
+            Ok(i) => {
+                if let Some(entry) = self.entries.get_mut(i) {
+                    entry.1 = range;
+                }
+            }
+            Err(i) => self.entries.insert(i, (key, range)),
+        }
+    }
+
+    /// Drops stale values from the buffer once they take up most of it.
+    fn compact(&mut self) {
+        let used: usize = self.entries.iter().map(|(_, range)| range.len()).sum();
+        if self.buf.len() <= 2 * used + 64 {
+            return;
+        }
+        let mut buf = String::with_capacity(used);
+        for (_, range) in self.entries.iter_mut() {
+            let start = buf.len();
+            buf.push_str(self.buf.get(range.clone()).unwrap_or_default());
+            *range = start..buf.len();
+        }
+        self.buf = buf;
+    }
+
     /// Get the value of the given key, return `None` if no value is set.
     pub fn get(&self, key: Param) -> Option<&str> {
-        self.inner.get(&key).map(|s| s.as_str())
+        let i = self.position(key).ok()?;
+        let (_, range) = self.entries.get(i)?;
+        self.buf.get(range.clone())
     }
 
     /// Check if the given key is set.
     pub fn exists(&self, key: Param) -> bool {
-        self.inner.contains_key(&key)
+        self.position(key).is_ok()
     }
 
     /// Set the given key to the passed in value.
     pub fn set(&mut self, key: Param, value: impl AsRef<str>) -> &mut Self {
-        self.inner.insert(key, value.as_ref().to_string());
+        let start = self.buf.len();
+        self.buf.push_str(value.as_ref());
+        let end = self.buf.len();
+        self.insert_range(key, start..end);
+        self.compact();
         self
     }
 
     /// Removes the given key, if it exists.
     pub fn remove(&mut self, key: Param) -> &mut Self {
-        self.inner.remove(&key);
+        if let Ok(i) = self.position(key) {
+            self.entries.remove(i);
+            if self.entries.is_empty() {
+                self.buf.clear();
+            }
+        }
         self
     }
 
     /// Check if there are any values in this.
     pub fn is_empty(&self) -> bool {
-        self.inner.is_empty()
+        self.entries.is_empty()
     }
 
     /// Returns how many key-value pairs are set.
     pub fn len(&self) -> usize {
-        self.inner.len()
+        self.entries.len()
     }
 
     /// Get the given parameter and parse as `i32`.
@@ -432,6 +565,45 @@ fn test_roundtrip() {
         assert_eq!(params.to_string().parse::<Params>().unwrap(), params);
     }
 
+    #[test]
+    fn test_lookup() {
+        let mut params = Params::new();
+        params.set(Param::Height, "foo\nbar=baz");
+        params.set_int(Param::Cmd, 5);
+        let serialized = params.to_string();
+
+        assert_eq!(
+            Params::lookup(&serialized, Param::Height).as_deref(),
+            Some("foo\nbar=baz")
+        );
+        assert_eq!(
+            Params::lookup(&serialized, Param::Cmd).as_deref(),
+            Some("5")
+        );
+        assert_eq!(Params::lookup(&serialized, Param::Width), None);
+        assert_eq!(Params::lookup("", Param::Width), None);
+        assert_eq!(
+            Params::lookup("w=1\nw=2", Param::Width).as_deref(),
+            Some("2")
+        );
+    }
+
+    #[test]
+    fn test_overwrite() {
+        let mut params = Params::new();
+        for i in 0..1000 {
+            params.set_int(Param::Width, i).set_int(Param::Height, -i);
+        }
+        assert_eq!(params.get_int(Param::Width), Some(999));
+        assert_eq!(params.get_int(Param::Height), Some(-999));
+        assert_eq!(params.len(), 2);
+        assert!(params.buf.len() < 100);
+        assert_eq!(params.to_string(), "h=-999\nw=999");
+
+        let parsed: Params = "w=1\nh=2\nw=3".parse().unwrap();
+        assert_eq!(parsed.to_string(), "h=2\nw=3");
+    }
+
     #[async_std::test]
     async fn test_params_file_fs_path() {
         let t = TestContext::new().await;
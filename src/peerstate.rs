@@ -1,7 +1,8 @@
 //! # [Autocrypt Peer State](https://autocrypt.org/level1.html#peer-state-management) module
 
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
 use std::fmt;
+use std::sync::Mutex;
 
 use crate::aheader::{Aheader, EncryptPreference};
 use crate::chat::{self, ChatIdBlocked};
@@ -12,6 +13,7 @@
 use crate::sql::Sql;
 use crate::stock_str;
 use anyhow::{bail, Result};
+use itertools::Itertools;
 use num_traits::FromPrimitive;
 
 #[derive(Debug)]
@@ -29,6 +31,7 @@ pub enum PeerstateVerifiedStatus {
 }
 
 /// Peerstate represents the state of an Autocrypt peer.
+#[derive(Clone)]
 pub struct Peerstate {
     pub addr: String,
     pub last_seen: i64,
@@ -92,6 +95,131 @@ pub enum ToSave {
     All = 0x02,
 }
 
+/// Maximum number of addresses looked up with a single query by [Peerstate::from_addrs].
+const FROM_ADDRS_CHUNK_SIZE: usize = 500;
+
+/// Maximum number of addresses in a [PeerstateCache].
+const PEERSTATE_CACHE_CAPACITY: usize = 1000;
+
+/// Cache of the peerstates loaded from the database.
+///
+/// Entries are looked up by lower-cased address, `None` entries cache addresses
+/// without peerstate. [Peerstate::save_to_db] invalidates the entry of the address,
+/// when the cache is full, the least recently used entry is removed.
+#[derive(Debug, Default)]
+pub(crate) struct PeerstateCache {
+    inner: Mutex<PeerstateCacheInner>,
+}
+
+#[derive(Debug, Default)]
+struct PeerstateCacheInner {
+    entries: HashMap<String, PeerstateCacheEntry>,
+
+    /// Addresses of the cached peerstates by public key fingerprint.
+    ///
+    /// May point to outdated entries, lookups check the fingerprint of the entry.
+    by_fingerprint: HashMap<Fingerprint, String>,
+
+    /// Incremented on every invalidation.
+    ///
+    /// Peerstates loaded before an invalidation may be outdated and are not inserted.
+    generation: u64,
+
+    /// Incremented on every access, used to find the least recently used entry.
+    tick: u64,
+}
+
+#[derive(Debug)]
+struct PeerstateCacheEntry {
+    peerstate: Option<Peerstate>,
+    last_used: u64,
+}
+
+impl PeerstateCache {
+    /// Returns the cached peerstate of `addr`, `None` if `addr` is not cached.
+    fn get(&self, addr: &str) -> Option<Option<Peerstate>> {
+        let mut inner = self.inner.lock().unwrap();
+        inner.tick += 1;
+        let tick = inner.tick;
+        let entry = inner.entries.get_mut(&addr.to_ascii_lowercase())?;
+        entry.last_used = tick;
+        Some(entry.peerstate.clone())
+    }
+
+    /// Returns the cached peerstate with the public key `fingerprint`.
+    fn get_by_fingerprint(&self, fingerprint: &Fingerprint) -> Option<Peerstate> {
+        let addr = self
+            .inner
+            .lock()
+            .unwrap()
+            .by_fingerprint
+            .get(fingerprint)?
+            .clone();
+        self.get(&addr)
+            .flatten()
+            .filter(|peerstate| peerstate.public_key_fingerprint.as_ref() == Some(fingerprint))
+    }
+
+    fn generation(&self) -> u64 {
+        self.inner.lock().unwrap().generation
+    }
+
+    /// Caches the peerstate of `addr` loaded from the database.
+    ///
+    /// `generation` is the [PeerstateCache::generation] before loading, if the
+    /// cache was invalidated since then, the peerstate is not cached.
+    fn insert(&self, addr: &str, peerstate: Option<Peerstate>, generation: u64) {
+        let mut inner = self.inner.lock().unwrap();
+        if inner.generation != generation {
+            return;
+        }
+        let key = addr.to_ascii_lowercase();
+        if inner.entries.len() >= PEERSTATE_CACHE_CAPACITY && !inner.entries.contains_key(&key) {
+            let lru = inner
+                .entries
+                .iter()
+                .min_by_key(|(_, entry)| entry.last_used)
+                .map(|(addr, _)| addr.clone());
+            if let Some(lru) = lru {
+                inner.entries.remove(&lru);
+                inner.by_fingerprint.retain(|_, addr| addr != &lru);
+            }
+        }
+        if let Some(fingerprint) = peerstate
+            .as_ref()
+            .and_then(|peerstate| peerstate.public_key_fingerprint.clone())
+        {
+            inner.by_fingerprint.insert(fingerprint, key.clone());
+        }
+        inner.tick += 1;
+        let last_used = inner.tick;
+        inner.entries.insert(
+            key,
+            PeerstateCacheEntry {
+                peerstate,
+                last_used,
+            },
+        );
+    }
+
+    /// Removes the peerstate of `addr` from the cache.
+    fn invalidate(&self, addr: &str) {
+        let key = addr.to_ascii_lowercase();
+        let mut inner = self.inner.lock().unwrap();
+        inner.generation += 1;
+        inner.entries.remove(&key);
+        inner.by_fingerprint.retain(|_, addr| addr != &key);
+    }
+
+    /// Removes all peerstates from the cache, e.g. because the database is replaced.
+    pub(crate) fn clear(&self) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.generation += 1;
+        inner.entries.clear();
+        inner.by_fingerprint.clear();
+    }
+}
+
 impl Peerstate {
     pub fn from_header(header: &Aheader, message_time: i64) -> Self {
         Peerstate {
@@ -138,12 +266,82 @@ pub fn from_gossip(gossip_header: &Aheader, message_time: i64) -> Self {
     }
 
     pub async fn from_addr(context: &Context, addr: &str) -> Result<Option<Peerstate>> {
+        let cache = &context.sql.peerstate_cache;
+        if let Some(peerstate) = cache.get(addr) {
+            return Ok(peerstate);
+        }
+
+        let generation = cache.generation();
         let query = "SELECT addr, last_seen, last_seen_autocrypt, prefer_encrypted, public_key, \
                      gossip_timestamp, gossip_key, public_key_fingerprint, gossip_key_fingerprint, \
                      verified_key, verified_key_fingerprint \
                      FROM acpeerstates \
                      WHERE addr=? COLLATE NOCASE;";
-        Self::from_stmt(context, query, paramsv![addr]).await
+        let peerstate = Self::from_stmt(context, query, paramsv![addr]).await?;
+        cache.insert(addr, peerstate.clone(), generation);
+        Ok(peerstate)
+    }
+
+    /// Loads the peerstates of all `addrs` at once.
+    ///
+    /// Returns the peerstates in the order of `addrs`, `None` for addresses without peerstate.
+    /// `addrs` should not contain duplicates, a peerstate is only returned once.
+    pub async fn from_addrs(context: &Context, addrs: &[&str]) -> Result<Vec<Option<Peerstate>>> {
+        let cache = &context.sql.peerstate_cache;
+        let mut cached = HashMap::new();
+        let mut missing = Vec::new();
+        for addr in addrs {
+            match cache.get(addr) {
+                Some(peerstate) => {
+                    cached.insert(addr.to_ascii_lowercase(), peerstate);
+                }
+                None => missing.push(*addr),
+            }
+        }
+
+        let generation = cache.generation();
+        let mut peerstates: HashMap<String, Peerstate> = HashMap::with_capacity(missing.len());
+        for chunk in missing.chunks(FROM_ADDRS_CHUNK_SIZE) {
+            let query = format!(
+                "SELECT addr, last_seen, last_seen_autocrypt, prefer_encrypted, public_key, \
+                 gossip_timestamp, gossip_key, public_key_fingerprint, gossip_key_fingerprint, \
+                 verified_key, verified_key_fingerprint \
+                 FROM acpeerstates \
+                 WHERE addr COLLATE NOCASE IN({});",
+                chunk.iter().map(|_| "?").join(",")
+            );
+            context
+                .sql
+                .query_map(
+                    query,
+                    rusqlite::params_from_iter(chunk),
+                    Self::from_row,
+                    |rows| {
+                        for row in rows {
+                            let peerstate = row?;
+                            peerstates.insert(peerstate.addr.to_ascii_lowercase(), peerstate);
+                        }
+                        Ok(())
+                    },
+                )
+                .await?;
+        }
+
+        for addr in missing {
+            let key = addr.to_ascii_lowercase();
+            if cached.contains_key(&key) {
+                // Duplicate address.
+                continue;
+            }
+            let peerstate = peerstates.remove(&key);
+            cache.insert(addr, peerstate.clone(), generation);
+            cached.insert(key, peerstate);
+        }
+
+        Ok(addrs
+            .iter()
+            .map(|addr| cached.remove(&addr.to_ascii_lowercase()).flatten())
+            .collect())
     }
 
     pub async fn from_fingerprint(
@@ -158,8 +356,18 @@ pub async fn from_fingerprint(
                      WHERE public_key_fingerprint=? COLLATE NOCASE \
                      OR gossip_key_fingerprint=? COLLATE NOCASE  \
                      ORDER BY public_key_fingerprint=? DESC;";
+        let cache = &context.sql.peerstate_cache;
+        if let Some(peerstate) = cache.get_by_fingerprint(fingerprint) {
+            return Ok(Some(peerstate));
+        }
+
+        let generation = cache.generation();
         let fp = fingerprint.hex();
-        Self::from_stmt(context, query, paramsv![fp, fp, fp]).await
+        let peerstate = Self::from_stmt(context, query, paramsv![fp, fp, fp]).await?;
+        if let Some(ref peerstate) = peerstate {
+            cache.insert(&peerstate.addr, Some(peerstate.clone()), generation);
+        }
+        Ok(peerstate)
     }
 
     async fn from_stmt(
@@ -169,55 +377,57 @@ async fn from_stmt(
     ) -> Result<Option<Peerstate>> {
         let peerstate = context
             .sql
-            .query_row_optional(query, params, |row| {
-                // all the above queries start with this: SELECT
-                //   addr, last_seen, last_seen_autocrypt, prefer_encrypted,
-                //   public_key, gossip_timestamp, gossip_key, public_key_fingerprint,
-                //   gossip_key_fingerprint, verified_key, verified_key_fingerprint
-
-                let res = Peerstate {
-                    addr: row.get(0)?,
-                    last_seen: row.get(1)?,
-                    last_seen_autocrypt: row.get(2)?,
-                    prefer_encrypt: EncryptPreference::from_i32(row.get(3)?).unwrap_or_default(),
-                    public_key: row
-                        .get(4)
-                        .ok()
-                        .and_then(|blob: Vec<u8>| SignedPublicKey::from_slice(&blob).ok()),
-                    public_key_fingerprint: row
-                        .get::<_, Option<String>>(7)?
-                        .map(|s| s.parse::<Fingerprint>())
-                        .transpose()
-                        .unwrap_or_default(),
-                    gossip_key: row
-                        .get(6)
-                        .ok()
-                        .and_then(|blob: Vec<u8>| SignedPublicKey::from_slice(&blob).ok()),
-                    gossip_key_fingerprint: row
-                        .get::<_, Option<String>>(8)?
-                        .map(|s| s.parse::<Fingerprint>())
-                        .transpose()
-                        .unwrap_or_default(),
-                    gossip_timestamp: row.get(5)?,
-                    verified_key: row
-                        .get(9)
-                        .ok()
-                        .and_then(|blob: Vec<u8>| SignedPublicKey::from_slice(&blob).ok()),
-                    verified_key_fingerprint: row
-                        .get::<_, Option<String>>(10)?
-                        .map(|s| s.parse::<Fingerprint>())
-                        .transpose()
-                        .unwrap_or_default(),
-                    to_save: None,
-                    fingerprint_changed: false,
-                };
-
-                Ok(res)
-            })
+            .query_row_optional(query, params, Self::from_row)
             .await?;
         Ok(peerstate)
     }
 
+    fn from_row(row: &rusqlite::Row) -> rusqlite::Result<Peerstate> {
+        // all the above queries start with this: SELECT
+        //   addr, last_seen, last_seen_autocrypt, prefer_encrypted,
+        //   public_key, gossip_timestamp, gossip_key, public_key_fingerprint,
+        //   gossip_key_fingerprint, verified_key, verified_key_fingerprint
+
+        let res = Peerstate {
+            addr: row.get(0)?,
+            last_seen: row.get(1)?,
+            last_seen_autocrypt: row.get(2)?,
+            prefer_encrypt: EncryptPreference::from_i32(row.get(3)?).unwrap_or_default(),
+            public_key: row
+                .get(4)
+                .ok()
+                .and_then(|b: Vec<u8>| SignedPublicKey::from_slice_cached(&b).ok()),
+            public_key_fingerprint: row
+                .get::<_, Option<String>>(7)?
+                .map(|s| s.parse::<Fingerprint>())
+                .transpose()
+                .unwrap_or_default(),
+            gossip_key: row
+                .get(6)
+                .ok()
+                .and_then(|b: Vec<u8>| SignedPublicKey::from_slice_cached(&b).ok()),
+            gossip_key_fingerprint: row
+                .get::<_, Option<String>>(8)?
+                .map(|s| s.parse::<Fingerprint>())
+                .transpose()
+                .unwrap_or_default(),
+            gossip_timestamp: row.get(5)?,
+            verified_key: row
+                .get(9)
+                .ok()
+                .and_then(|b: Vec<u8>| SignedPublicKey::from_slice_cached(&b).ok()),
+            verified_key_fingerprint: row
+                .get::<_, Option<String>>(10)?
+                .map(|s| s.parse::<Fingerprint>())
+                .transpose()
+                .unwrap_or_default(),
+            to_save: None,
+            fingerprint_changed: false,
+        };
+
+        Ok(res)
+    }
+
     pub fn recalc_fingerprint(&mut self) {
         if let Some(ref public_key) = self.public_key {
             let old_public_fingerprint = self.public_key_fingerprint.take();
@@ -480,6 +690,7 @@ pub async fn save_to_db(&self, sql: &Sql, create: bool) -> Result<()> {
             )
             .await?;
         }
+        sql.peerstate_cache.invalidate(&self.addr);
 
         Ok(())
     }
@@ -541,6 +752,13 @@ async fn test_peerstate_save_to_db() {
                 .expect("failed to load peerstate from db")
                 .expect("no peerstate found in the database");
         assert_eq!(peerstate, peerstate_new2);
+
+        let peerstates = Peerstate::from_addrs(&ctx.ctx, &["unknown@mail.com", "Hello@Mail.com"])
+            .await
+            .expect("failed to load peerstates from db");
+        assert_eq!(peerstates.len(), 2);
+        assert!(peerstates[0].is_none());
+        assert_eq!(peerstates[1].as_ref(), Some(&peerstate));
     }
 
     #[async_std::test]
@@ -641,6 +859,53 @@ async fn test_peerstate_load_db_defaults() {
         assert_eq!(peerstate.verified_key_fingerprint, None);
     }
 
+    #[async_std::test]
+    async fn test_peerstate_cache() -> Result<()> {
+        let t = crate::test_utils::TestContext::new().await;
+        let addr = "hello@mail.com";
+        let pub_key = alice_keypair().public;
+
+        // Missing peerstates are cached as well.
+        assert!(Peerstate::from_addr(&t, addr).await?.is_none());
+        let header = Aheader::new(addr.to_string(), pub_key.clone(), EncryptPreference::Mutual);
+        let mut peerstate = Peerstate::from_header(&header, 100);
+        peerstate.save_to_db(&t.sql, true).await?;
+
+        // Saving invalidates the cached entry.
+        let loaded = Peerstate::from_addr(&t, "Hello@Mail.com").await?.unwrap();
+        assert_eq!(loaded.last_seen, 100);
+        peerstate.last_seen = 200;
+        peerstate.to_save = Some(ToSave::Timestamps);
+        peerstate.save_to_db(&t.sql, false).await?;
+        let loaded = Peerstate::from_fingerprint(&t, &t.sql, &pub_key.fingerprint())
+            .await?
+            .unwrap();
+        assert_eq!(loaded.last_seen, 200);
+        let loaded = Peerstate::from_addr(&t, addr).await?.unwrap();
+        assert_eq!(loaded.last_seen, 200);
+
+        // Outdated peerstates are not cached.
+        let cache = PeerstateCache::default();
+        let generation = cache.generation();
+        cache.invalidate(addr);
+        cache.insert(addr, Some(loaded.clone()), generation);
+        assert!(cache.get(addr).is_none());
+
+        // The least recently used entry is removed when the cache is full.
+        let generation = cache.generation();
+        cache.insert(addr, Some(loaded), generation);
+        for i in 1..PEERSTATE_CACHE_CAPACITY {
+            cache.insert(&format!("{}@example.org", i), None, generation);
+        }
+        assert!(cache.get(addr).is_some());
+        cache.insert("new@example.org", None, generation);
+        assert!(cache.get(addr).is_some());
+        assert!(cache.get("1@example.org").is_none());
+        assert!(cache.get_by_fingerprint(&pub_key.fingerprint()).is_some());
+
+        Ok(())
+    }
+
     #[async_std::test]
     async fn test_peerstate_degrade_reordering() {
         let addr = "example@example.org";
@@ -20,6 +20,7 @@
 use crate::dc_tools::EmailAddress;
 use crate::key::{DcKey, Fingerprint};
 use crate::keyring::Keyring;
+use crate::metrics;
 
 pub const HEADER_AUTOCRYPT: &str = "autocrypt-prefer-encrypt";
 pub const HEADER_SETUPCODE: &str = "passphrase-begin";
@@ -287,6 +288,7 @@ pub async fn pk_decrypt(
     public_keys_for_validation: Keyring<SignedPublicKey>,
     ret_signature_fingerprints: Option<&mut HashSet<Fingerprint>>,
 ) -> Result<Vec<u8>> {
+    let _timer = metrics::start(metrics::Span::Decrypt);
     let msgs = async_std::task::spawn_blocking(move || {
         let cursor = Cursor::new(ctext);
         let (msg, _) = Message::from_armor_single(cursor)?;
@@ -0,0 +1,215 @@
+//! # Read cache
+//!
+//! Snapshots of chats and contacts as shown by the UI, see [Chat::load_cached] and
+//! [Contact::get_by_id_cached]. UIs load the same chats and contacts again and again while
+//! rendering the chatlist and the chat, the cache avoids a database query for each of them.
+//!
+//! Entries are invalidated by the events emitted for the changed chats and contacts, see
+//! [ReadCache::invalidate], and by the functions changing them without emitting an event. As
+//! the name of a 1:1 chat is the name of the contact, changing a contact invalidates all chats.
+
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::sync::Mutex;
+
+use crate::chat::{Chat, ChatId};
+use crate::contact::Contact;
+use crate::events::EventType;
+
+/// Maximum number of chats and of contacts in the [ReadCache] each.
+const READ_CACHE_CAPACITY: usize = 500;
+
+#[derive(Debug, Default)]
+pub(crate) struct ReadCache {
+    chats: Mutex<Entries<ChatId, Chat>>,
+    contacts: Mutex<Entries<u32, Contact>>,
+}
+
+/// Cached values with least-recently-used eviction.
+#[derive(Debug)]
+struct Entries<K, V> {
+    entries: HashMap<K, (V, u64)>,
+
+    /// Incremented on every invalidation.
+    ///
+    /// Values loaded before an invalidation may be outdated and are not inserted.
+    generation: u64,
+
+    /// Incremented on every access, used to find the least recently used entry.
+    tick: u64,
+}
+
+impl<K, V> Default for Entries<K, V> {
+    fn default() -> Self {
+        Self {
+            entries: HashMap::new(),
+            generation: 0,
+            tick: 0,
+        }
+    }
+}
+
+impl<K: Copy + Eq + Hash, V: Clone> Entries<K, V> {
+    fn get(&mut self, key: K) -> Option<V> {
+        self.tick += 1;
+        let tick = self.tick;
+        let (value, last_used) = self.entries.get_mut(&key)?;
+        *last_used = tick;
+        Some(value.clone())
+    }
+
+    fn insert(&mut self, key: K, value: V, generation: u64) {
+        if self.generation != generation {
+            return;
+        }
+        if self.entries.len() >= READ_CACHE_CAPACITY && !self.entries.contains_key(&key) {
+            let lru = self
+                .entries
+                .iter()
+                .min_by_key(|(_, (_, last_used))| *last_used)
+                .map(|(key, _)| *key);
+            if let Some(lru) = lru {
+                self.entries.remove(&lru);
+            }
+        }
+        self.tick += 1;
+        self.entries.insert(key, (value, self.tick));
+    }
+
+    fn remove(&mut self, key: K) {
+        self.generation += 1;
+        self.entries.remove(&key);
+    }
+
+    fn clear(&mut self) {
+        self.generation += 1;
+        self.entries.clear();
+    }
+}
+
+impl ReadCache {
+    pub(crate) fn get_chat(&self, chat_id: ChatId) -> Option<Chat> {
+        self.chats.lock().unwrap().get(chat_id)
+    }
+
+    /// Returns the generation to pass to [ReadCache::insert_chat], get it before loading the chat.
+    pub(crate) fn chat_generation(&self) -> u64 {
+        self.chats.lock().unwrap().generation
+    }
+
+    /// Caches a chat loaded from the database.
+    ///
+    /// If any chat was invalidated since `generation` was returned, the chat is not cached.
+    pub(crate) fn insert_chat(&self, chat: Chat, generation: u64) {
+        self.chats.lock().unwrap().insert(chat.id, chat, generation);
+    }
+
+    pub(crate) fn get_contact(&self, contact_id: u32) -> Option<Contact> {
+        self.contacts.lock().unwrap().get(contact_id)
+    }
+
+    /// Returns the generation to pass to [ReadCache::insert_contact], get it before loading the
+    /// contact.
+    pub(crate) fn contact_generation(&self) -> u64 {
+        self.contacts.lock().unwrap().generation
+    }
+
+    /// Caches a contact loaded from the database.
+    ///
+    /// If any contact was invalidated since `generation` was returned, the contact is not cached.
+    pub(crate) fn insert_contact(&self, contact: Contact, generation: u64) {
+        self.contacts
+            .lock()
+            .unwrap()
+            .insert(contact.id, contact, generation);
+    }
+
+    /// Removes a chat, e.g. because it was modified without emitting [EventType::ChatModified].
+    pub(crate) fn invalidate_chat(&self, chat_id: ChatId) {
+        self.chats.lock().unwrap().remove(chat_id);
+    }
+
+    /// Removes a contact and all chats, as a 1:1 chat shows the name of its contact.
+    pub(crate) fn invalidate_contact(&self, contact_id: u32) {
+        self.contacts.lock().unwrap().remove(contact_id);
+        self.chats.lock().unwrap().clear();
+    }
+
+    /// Removes everything, e.g. because the database is replaced.
+    pub(crate) fn clear(&self) {
+        self.contacts.lock().unwrap().clear();
+        self.chats.lock().unwrap().clear();
+    }
+
+    /// Removes the chats and contacts affected by an emitted event.
+    pub(crate) fn invalidate(&self, event: &EventType) {
+        match event {
+            EventType::ChatModified(chat_id)
+            | EventType::ChatEphemeralTimerModified { chat_id, .. }
+            | EventType::MsgsChanged { chat_id, .. }
+            | EventType::IncomingMsg { chat_id, .. }
+            | EventType::MsgsNoticed(chat_id) => {
+                if chat_id.is_unset() {
+                    self.chats.lock().unwrap().clear();
+                } else {
+                    self.invalidate_chat(*chat_id);
+                }
+            }
+            EventType::ContactsChanged(Some(contact_id)) => self.invalidate_contact(*contact_id),
+            EventType::ContactsChanged(None) => self.clear(),
+            _ => {}
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::test_utils::TestContext;
+
+    #[async_std::test]
+    async fn test_read_cache() {
+        let t = TestContext::new_alice().await;
+        let chat = t.create_chat_with_contact("Bob", "bob@example.net").await;
+        let cache = &t.sql.read_cache;
+
+        let loaded = Chat::load_cached(&t, chat.id).await.unwrap();
+        assert_eq!(loaded.get_name(), "Bob");
+        assert!(cache.get_chat(chat.id).is_some());
+
+        // Renaming the contact emits ContactsChanged, this invalidates the 1:1 chat.
+        let contact_id = Contact::create(&t, "Robert", "bob@example.net")
+            .await
+            .unwrap();
+        assert!(cache.get_chat(chat.id).is_none());
+        let loaded = Chat::load_cached(&t, chat.id).await.unwrap();
+        assert_eq!(loaded.get_name(), "Robert");
+
+        let contact = Contact::get_by_id_cached(&t, contact_id).await.unwrap();
+        assert_eq!(contact.get_display_name(), "Robert");
+        assert!(cache.get_contact(contact_id).is_some());
+        t.emit_event(EventType::ContactsChanged(None));
+        assert!(cache.get_contact(contact_id).is_none());
+
+        // Values loaded before an invalidation are not cached.
+        let generation = cache.chat_generation();
+        t.emit_event(EventType::ChatModified(chat.id));
+        cache.insert_chat(loaded, generation);
+        assert!(cache.get_chat(chat.id).is_none());
+    }
+
+    #[test]
+    fn test_read_cache_capacity() {
+        let mut entries = Entries::default();
+        for i in 0..READ_CACHE_CAPACITY as u32 {
+            entries.insert(i, i, 0);
+        }
+        // Use the first entry, so the second one is the least recently used.
+        assert_eq!(entries.get(0), Some(0));
+        entries.insert(READ_CACHE_CAPACITY as u32, 0, 0);
+        assert_eq!(entries.entries.len(), READ_CACHE_CAPACITY);
+        assert_eq!(entries.get(0), Some(0));
+        assert_eq!(entries.get(1), None);
+    }
+}
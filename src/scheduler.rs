@@ -1,3 +1,6 @@
+use std::convert::TryFrom;
+use std::time::Duration;
+
 use anyhow::{bail, Result};
 use async_std::prelude::*;
 use async_std::{
@@ -7,7 +10,7 @@
 
 use crate::config::Config;
 use crate::context::Context;
-use crate::dc_tools::maybe_add_time_based_warnings;
+use crate::dc_tools::{maybe_add_time_based_warnings, time};
 use crate::imap::Imap;
 use crate::job::{self, Thread};
 use crate::message::MsgId;
@@ -15,6 +18,7 @@
 
 use self::connectivity::ConnectivityStore;
 
+pub(crate) mod connect_limit;
 pub(crate) mod connectivity;
 
 pub(crate) struct StopToken;
@@ -289,10 +293,27 @@ async fn smtp_loop(ctx: Context, started: Sender<()>, smtp_handlers: SmtpConnect
                     interrupt_info = Default::default();
                 }
                 None => {
-                    // Fake Idle
+                    // Fake Idle until interrupted or until the next job is due.
                     info!(ctx, "smtp fake idle - started");
                     connection.connectivity.set_connected(&ctx).await;
-                    interrupt_info = idle_interrupt_receiver.recv().await.unwrap_or_default();
+                    interrupt_info = match ctx.job_schedule.next_due(Thread::Smtp).await {
+                        Some(next_due) => {
+                            let wait = u64::try_from(next_due - time()).unwrap_or_default();
+                            match async_std::future::timeout(
+                                Duration::from_secs(wait),
+                                idle_interrupt_receiver.recv(),
+                            )
+                            .await
+                            {
+                                Ok(info) => info.unwrap_or_default(),
+                                Err(_) => {
+                                    info!(ctx, "smtp fake idle - next job is due");
+                                    Default::default()
+                                }
+                            }
+                        }
+                        None => idle_interrupt_receiver.recv().await.unwrap_or_default(),
+                    };
                     info!(ctx, "smtp fake idle - interrupted")
                 }
             }
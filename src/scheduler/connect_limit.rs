@@ -0,0 +1,99 @@
+//! # Connection attempt limits
+//!
+//! When many accounts of the same provider are started at once, e.g. by
+//! [`Accounts::start_io`](crate::accounts::Accounts::start_io), every account
+//! would otherwise connect, do the TLS handshake and log in at the same time.
+//! The limits are shared by all contexts in the process, so the connection
+//! attempts to a server are queued and the startup is staggered.
+
+use std::collections::HashMap;
+use std::sync::Mutex;
+
+use async_std::channel::{self, Receiver, Sender};
+use once_cell::sync::Lazy;
+
+/// Maximum number of concurrent connection attempts to a single server.
+pub(crate) const MAX_CONCURRENT_CONNECTS: usize = 4;
+
+/// Token pools, one per server.
+///
+/// Each pool contains [`MAX_CONCURRENT_CONNECTS`] tokens initially. A connection attempt
+/// takes a token out of the pool and puts it back when it is finished.
+static POOLS: Lazy<Mutex<HashMap<String, (Sender<()>, Receiver<()>)>>> =
+    Lazy::new(Default::default);
+
+/// Permission to connect to a server, returned by [`acquire`].
+///
+/// The permission is given back when the permit is dropped.
+#[derive(Debug)]
+pub(crate) struct ConnectPermit {
+    sender: Sender<()>,
+}
+
+impl Drop for ConnectPermit {
+    fn drop(&mut self) {
+        self.sender.try_send(()).ok();
+    }
+}
+
+/// Waits until a connection attempt to `server` is allowed.
+///
+/// The returned permit should be held until the connection is set up and logged in.
+pub(crate) async fn acquire(server: &str) -> ConnectPermit {
+    let (sender, receiver) = {
+        let mut pools = POOLS.lock().unwrap();
+        pools
+            .entry(server.to_lowercase())
+            .or_insert_with(|| {
+                let (sender, receiver) = channel::bounded(MAX_CONCURRENT_CONNECTS);
+                for _ in 0..MAX_CONCURRENT_CONNECTS {
+                    sender.try_send(()).ok();
+                }
+                (sender, receiver)
+            })
+            .clone()
+    };
+
+    // The pool holds a sender itself, so it is never closed.
+    receiver.recv().await.ok();
+    ConnectPermit { sender }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use std::time::Duration;
+
+    #[async_std::test]
+    async fn test_acquire() {
+        let server = "connect-limit.example.org";
+        let mut permits = Vec::new();
+        for _ in 0..MAX_CONCURRENT_CONNECTS {
+            permits.push(acquire(server).await);
+        }
+
+        // All permits are taken.
+        assert!(
+            async_std::future::timeout(Duration::from_millis(100), acquire(server))
+                .await
+                .is_err()
+        );
+
+        // Other servers are not affected, server names are case-insensitive.
+        drop(acquire("other.example.org").await);
+        assert!(async_std::future::timeout(
+            Duration::from_millis(100),
+            acquire("CONNECT-LIMIT.example.org")
+        )
+        .await
+        .is_err());
+
+        permits.pop();
+        assert!(
+            async_std::future::timeout(Duration::from_secs(10), acquire(server))
+                .await
+                .is_ok()
+        );
+    }
+}
@@ -81,7 +81,9 @@ pub fn simplify(
 ) -> (String, bool, bool, Option<String>, Option<String>) {
     let mut is_cut = false;
 
-    input.retain(|c| c != '\r');
+    if input.contains('\r') {
+        input.retain(|c| c != '\r');
+    }
     let lines = split_lines(&input);
     let (lines, is_forwarded) = skip_forward_header(&lines);
 
@@ -211,7 +213,7 @@ fn remove_top_quote<'a>(lines: &'a [&str]) -> (&'a [&'a str], Option<String>) {
 }
 
 fn render_message(lines: &[&str], is_cut_at_end: bool) -> String {
-    let mut ret = String::new();
+    let mut ret = String::with_capacity(lines.iter().map(|line| line.len() + 1).sum());
     /* we write empty lines only in case and non-empty line follows */
     let mut pending_linebreaks = 0;
     let mut empty_body = true;
@@ -224,12 +226,12 @@ fn render_message(lines: &[&str], is_cut_at_end: bool) -> String {
                     pending_linebreaks = 2
                 }
                 while 0 != pending_linebreaks {
-                    ret += "\n";
+                    ret.push('\n');
                     pending_linebreaks -= 1
                 }
             }
             // the incoming message might contain invalid UTF8
-            ret += line;
+            ret.push_str(line);
             empty_body = false;
             pending_linebreaks = 1
         }
@@ -238,7 +240,11 @@ fn render_message(lines: &[&str], is_cut_at_end: bool) -> String {
         ret += " [...]";
     }
     // redo escaping done by escape_message_footer_marks()
-    ret.replace("\u{200B}", "")
+    if ret.contains('\u{200B}') {
+        ret.replace('\u{200B}', "")
+    } else {
+        ret
+    }
 }
 
 /**
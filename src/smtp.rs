@@ -8,11 +8,12 @@
 use async_smtp::{error, smtp, EmailAddress};
 
 use crate::constants::DC_LP_AUTH_OAUTH2;
+use crate::context::Context;
 use crate::events::EventType;
 use crate::login_param::{dc_build_tls, CertificateChecks, LoginParam, ServerLoginParam};
 use crate::oauth2::dc_get_oauth2_access_token;
 use crate::provider::Socket;
-use crate::{context::Context, scheduler::connectivity::ConnectivityStore};
+use crate::scheduler::{connect_limit, connectivity::ConnectivityStore};
 
 /// SMTP write and read timeout in seconds.
 const SMTP_TIMEOUT: u64 = 30;
@@ -190,6 +191,9 @@ pub async fn connect(
             _ => smtp::ClientSecurity::Wrapper(tls_parameters),
         };
 
+        // Held until the login is finished.
+        let _permit = connect_limit::acquire(domain).await;
+
         let client = smtp::SmtpClient::with_security((domain.as_str(), port), security)
             .await
             .map_err(Error::ConnectionSetupFailure)?;
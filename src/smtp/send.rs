@@ -6,7 +6,9 @@
 use crate::constants::DEFAULT_MAX_SMTP_RCPT_TO;
 use crate::context::Context;
 use crate::events::EventType;
+use crate::metrics;
 use itertools::Itertools;
+use std::cmp::{max, min};
 use std::time::Duration;
 
 pub type Result<T> = std::result::Result<T, Error>;
@@ -26,28 +28,33 @@ pub enum Error {
 impl Smtp {
     /// Send a prepared mail to recipients.
     /// On successful send out Ok() is returned.
+    ///
+    /// Recipients are removed from `recipients` as soon as the mail is sent to them,
+    /// so on error `recipients` contains the recipients the mail still has to be sent to.
     pub async fn send(
         &mut self,
         context: &Context,
-        recipients: Vec<EmailAddress>,
+        recipients: &mut Vec<EmailAddress>,
         message: Vec<u8>,
         job_id: u32,
     ) -> Result<()> {
+        let _timer = metrics::start(metrics::Span::SmtpSend);
         let message_len_bytes = message.len();
 
-        let mut chunk_size = DEFAULT_MAX_SMTP_RCPT_TO;
-        if let Some(provider) = context.get_configured_provider().await? {
-            if let Some(max_smtp_rcpt_to) = provider.max_smtp_rcpt_to {
-                chunk_size = max_smtp_rcpt_to as usize;
-            }
-        }
+        let chunk_size = recipients_chunk_size(
+            context
+                .get_configured_provider()
+                .await?
+                .and_then(|provider| provider.max_smtp_rcpt_to),
+        );
 
-        for recipients_chunk in recipients.chunks(chunk_size).into_iter() {
-            let recipients = recipients_chunk.to_vec();
-            let recipients_display = recipients.iter().map(|x| x.to_string()).join(",");
+        while !recipients.is_empty() {
+            let recipients_chunk = next_recipients_chunk(recipients, chunk_size);
+            let chunk_len = recipients_chunk.len();
+            let recipients_display = recipients_chunk.iter().map(|x| x.to_string()).join(",");
 
             let envelope =
-                Envelope::new(self.from.clone(), recipients).map_err(Error::EnvelopeError)?;
+                Envelope::new(self.from.clone(), recipients_chunk).map_err(Error::EnvelopeError)?;
             let mail = SendableEmail::new(
                 envelope,
                 format!("{}", job_id), // only used for internal logging
@@ -67,6 +74,7 @@ pub async fn send(
                     message_len_bytes, recipients_display
                 )));
                 self.last_success = Some(std::time::SystemTime::now());
+                recipients_chunk_sent(recipients, chunk_len);
             } else {
                 warn!(
                     context,
@@ -78,3 +86,24 @@ pub async fn send(
         Ok(())
     }
 }
+
+/// Returns the maximum number of recipients of one SMTP transaction
+/// for the `max_smtp_rcpt_to` of the provider.
+///
+/// Zero is treated as one, so that sending always makes progress.
+pub(crate) fn recipients_chunk_size(max_smtp_rcpt_to: Option<u16>) -> usize {
+    max_smtp_rcpt_to.map_or(DEFAULT_MAX_SMTP_RCPT_TO, |max_smtp_rcpt_to| {
+        max(max_smtp_rcpt_to as usize, 1)
+    })
+}
+
+/// Returns the recipients of the next SMTP transaction.
+pub(crate) fn next_recipients_chunk<T: Clone>(recipients: &[T], chunk_size: usize) -> Vec<T> {
+    recipients.iter().take(chunk_size).cloned().collect()
+}
+
+/// Removes the `chunk_len` recipients which accepted the mail,
+/// leaving the ones it still has to be sent to.
+pub(crate) fn recipients_chunk_sent<T>(recipients: &mut Vec<T>, chunk_len: usize) {
+    recipients.drain(..min(chunk_len, recipients.len()));
+}
@@ -1,10 +1,12 @@
 //! # SQLite wrapper
 
 use async_std::path::Path;
-use async_std::sync::RwLock;
+use async_std::sync::{Mutex, MutexGuard, RwLock};
 
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
 use std::convert::TryFrom;
+use std::ops::{Deref, DerefMut};
+use std::sync::atomic::{AtomicUsize, Ordering};
 use std::time::Duration;
 
 use anyhow::{bail, format_err, Context as _, Result};
@@ -18,9 +20,12 @@
 use crate::context::Context;
 use crate::dc_tools::{dc_delete_file, time};
 use crate::ephemeral::start_ephemeral_timers;
+use crate::key::{KeyCache, SignedSecretKey};
 use crate::message::Message;
+use crate::metrics;
 use crate::param::{Param, Params};
-use crate::peerstate::Peerstate;
+use crate::peerstate::{Peerstate, PeerstateCache};
+use crate::read_cache::ReadCache;
 use crate::stock_str;
 
 #[macro_export]
@@ -35,16 +40,51 @@ macro_rules! paramsv {
 
 mod migrations;
 
+/// Number of prepared statements cached per connection.
+const STATEMENT_CACHE_CAPACITY: usize = 128;
+
 /// A wrapper around the underlying Sqlite3 object.
 #[derive(Debug)]
 pub struct Sql {
     pool: RwLock<Option<r2d2::Pool<r2d2_sqlite::SqliteConnectionManager>>>,
+
+    /// Lock held by the single writer, see [`Sql::get_write_conn`].
+    write_lock: Mutex<()>,
+
+    /// Cache of the `config` table, `None` values cache missing keys.
+    ///
+    /// [`Sql::set_raw_config`] updates the cache while holding the write lock.
+    /// Migrations write to the `config` table directly, so the cache is cleared
+    /// after running them and when the database is closed.
+    config_cache: RwLock<HashMap<String, Option<String>>>,
+
+    /// Number of [`Sql::get_raw_config`] calls answered from the cache.
+    config_cache_hits: AtomicUsize,
+
+    /// Number of [`Sql::get_raw_config`] calls which had to query the database.
+    config_cache_misses: AtomicUsize,
+
+    /// Cache of the `acpeerstates` table, see [`Peerstate::save_to_db`].
+    pub(crate) peerstate_cache: PeerstateCache,
+
+    /// Chats and contacts loaded for the UI, see [`crate::chat::Chat::load_cached`].
+    pub(crate) read_cache: ReadCache,
+
+    /// Parsed secret keys of this account, see [`crate::key::DcKey::load_self`].
+    pub(crate) secret_key_cache: KeyCache<SignedSecretKey>,
 }
 
 impl Default for Sql {
     fn default() -> Self {
         Self {
             pool: RwLock::new(None),
+            write_lock: Mutex::new(()),
+            config_cache: RwLock::new(HashMap::new()),
+            config_cache_hits: AtomicUsize::new(0),
+            config_cache_misses: AtomicUsize::new(0),
+            peerstate_cache: PeerstateCache::default(),
+            read_cache: ReadCache::default(),
+            secret_key_cache: KeyCache::default(),
         }
     }
 }
@@ -63,6 +103,12 @@ pub async fn is_open(&self) -> bool {
     pub async fn close(&self) {
         let _ = self.pool.write().await.take();
         // drop closes the connection
+
+        // The database may be replaced before it is opened again, e.g. by a backup.
+        self.config_cache.write().await.clear();
+        self.peerstate_cache.clear();
+        self.read_cache.clear();
+        self.secret_key_cache.clear();
     }
 
     pub fn new_pool(
@@ -77,8 +123,10 @@ pub fn new_pool(
             open_flags.insert(OpenFlags::SQLITE_OPEN_CREATE);
         }
 
-        // this actually creates min_idle database handles just now.
-        // therefore, with_init() must not try to modify the database as otherwise
+        // Database handles are created on demand, so opening many accounts is fast
+        // and accounts which are not used do not keep idle handles open
+        // after the pool's idle timeout.
+        // with_init() must not try to modify the database as otherwise
         // we easily get busy-errors (eg. table-creation, journal_mode etc. should be done on only one handle)
         let mgr = r2d2_sqlite::SqliteConnectionManager::file(dbfile)
             .with_flags(open_flags)
@@ -90,11 +138,12 @@ pub fn new_pool(
                      ",
                     Duration::from_secs(10).as_millis()
                 ))?;
+                c.set_prepared_statement_cache_capacity(STATEMENT_CACHE_CAPACITY);
                 Ok(())
             });
 
         let pool = r2d2::Pool::builder()
-            .min_idle(Some(2))
+            .min_idle(Some(0))
             .max_size(10)
             .connection_timeout(Duration::from_secs(60))
             .build(mgr)
@@ -136,6 +185,11 @@ pub async fn open(
 
             let (recalc_fingerprints, update_icons, disable_server_delete, recode_avatar) =
                 migrations::run(context, self).await?;
+            // Migrations may modify the `config` and `acpeerstates` tables directly.
+            self.config_cache.write().await.clear();
+            self.peerstate_cache.clear();
+            self.read_cache.clear();
+            self.secret_key_cache.clear();
 
             // (2) updates that require high-level objects
             // the structure is complete now and all objects are usable
@@ -209,8 +263,10 @@ pub async fn execute(
         query: impl AsRef<str>,
         params: impl rusqlite::Params,
     ) -> Result<usize> {
-        let conn = self.get_conn().await?;
-        let res = conn.execute(query.as_ref(), params)?;
+        let _timer = metrics::start(metrics::Span::SqlWrite);
+        let conn = self.get_write_conn().await?;
+        let mut stmt = conn.prepare_cached(query.as_ref())?;
+        let res = stmt.execute(params)?;
         Ok(res)
     }
 
@@ -220,8 +276,10 @@ pub async fn insert(
         query: impl AsRef<str>,
         params: impl rusqlite::Params,
     ) -> anyhow::Result<usize> {
-        let conn = self.get_conn().await?;
-        conn.execute(query.as_ref(), params)?;
+        let _timer = metrics::start(metrics::Span::SqlWrite);
+        let conn = self.get_write_conn().await?;
+        let mut stmt = conn.prepare_cached(query.as_ref())?;
+        stmt.execute(params)?;
         Ok(usize::try_from(conn.last_insert_rowid())?)
     }
 
@@ -241,8 +299,9 @@ pub async fn query_map<T, F, G, H>(
     {
         let sql = sql.as_ref();
 
+        let _timer = metrics::start(metrics::Span::SqlRead);
         let conn = self.get_conn().await?;
-        let mut stmt = conn.prepare(sql)?;
+        let mut stmt = conn.prepare_cached(sql)?;
         let res = stmt.query_map(params, f)?;
         g(res)
     }
@@ -259,6 +318,24 @@ pub async fn get_conn(
         Ok(conn)
     }
 
+    /// Returns a connection for writing to the database.
+    ///
+    /// All writes done through the `Sql` API go through such a connection,
+    /// so there is only a single writer at any time.
+    /// Concurrent writers wait for the lock asynchronously
+    /// instead of blocking a thread in SQLite's busy handler.
+    ///
+    /// The connection should be used for a sequence of writes and dropped afterwards;
+    /// other writing `Sql` methods must not be awaited while it is held.
+    pub async fn get_write_conn(&self) -> Result<WriteConnection<'_>> {
+        let guard = self.write_lock.lock().await;
+        let conn = self.get_conn().await?;
+        Ok(WriteConnection {
+            conn,
+            _guard: guard,
+        })
+    }
+
     /// Used for executing `SELECT COUNT` statements only. Returns the resulting count.
     pub async fn count(
         &self,
@@ -286,8 +363,10 @@ pub async fn query_row<T, F>(
     where
         F: FnOnce(&rusqlite::Row) -> rusqlite::Result<T>,
     {
+        let _timer = metrics::start(metrics::Span::SqlRead);
         let conn = self.get_conn().await?;
-        let res = conn.query_row(query.as_ref(), params, f)?;
+        let mut stmt = conn.prepare_cached(query.as_ref())?;
+        let res = stmt.query_row(params, f)?;
         Ok(res)
     }
 
@@ -300,7 +379,8 @@ pub async fn transaction<G, H>(&self, callback: G) -> anyhow::Result<H>
         H: Send + 'static,
         G: Send + 'static + FnOnce(&mut rusqlite::Transaction<'_>) -> anyhow::Result<H>,
     {
-        let mut conn = self.get_conn().await?;
+        let _timer = metrics::start(metrics::Span::SqlWrite);
+        let mut conn = self.get_write_conn().await?;
         let mut transaction = conn.transaction()?;
         let ret = callback(&mut transaction);
 
@@ -356,8 +436,10 @@ pub async fn query_row_optional<T, F>(
     where
         F: FnOnce(&rusqlite::Row) -> rusqlite::Result<T>,
     {
+        let _timer = metrics::start(metrics::Span::SqlRead);
         let conn = self.get_conn().await?;
-        let res = match conn.query_row(sql.as_ref(), params, f) {
+        let mut stmt = conn.prepare_cached(sql.as_ref())?;
+        let res = match stmt.query_row(params, f) {
             Ok(res) => Ok(Some(res)),
             Err(rusqlite::Error::QueryReturnedNoRows) => Ok(None),
             Err(rusqlite::Error::InvalidColumnType(_, _, rusqlite::types::Type::Null)) => Ok(None),
@@ -387,6 +469,18 @@ pub async fn query_get_value<T>(
     /// will already have been logged.
     pub async fn set_raw_config(&self, key: impl AsRef<str>, value: Option<&str>) -> Result<()> {
         let key = key.as_ref();
+        let mut cache = self.config_cache.write().await;
+        let res = self.set_raw_config_uncached(key, value).await;
+        if res.is_ok() {
+            cache.insert(key.to_string(), value.map(|s| s.to_string()));
+        } else {
+            // The value stored in the database is unknown now.
+            cache.remove(key);
+        }
+        res
+    }
+
+    async fn set_raw_config_uncached(&self, key: &str, value: Option<&str>) -> Result<()> {
         if let Some(value) = value {
             let exists = self
                 .exists(
@@ -417,18 +511,42 @@ pub async fn set_raw_config(&self, key: impl AsRef<str>, value: Option<&str>) ->
     }
 
     /// Get configuration options from the database.
+    ///
+    /// Values are cached in memory, so only the first call for each key queries the database.
     pub async fn get_raw_config(&self, key: impl AsRef<str>) -> Result<Option<String>> {
-        let value = self
-            .query_get_value(
-                "SELECT value FROM config WHERE keyname=?;",
-                paramsv![key.as_ref()],
-            )
+        let key = key.as_ref();
+        if let Some(value) = self.config_cache.read().await.get(key) {
+            self.config_cache_hits.fetch_add(1, Ordering::Relaxed);
+            return Ok(value.clone());
+        }
+
+        // Hold the write lock while reading from the database,
+        // so a concurrent `set_raw_config` cannot be overwritten with an old value.
+        let mut cache = self.config_cache.write().await;
+        if let Some(value) = cache.get(key) {
+            self.config_cache_hits.fetch_add(1, Ordering::Relaxed);
+            return Ok(value.clone());
+        }
+        self.config_cache_misses.fetch_add(1, Ordering::Relaxed);
+
+        let value: Option<String> = self
+            .query_get_value("SELECT value FROM config WHERE keyname=?;", paramsv![key])
             .await
-            .context(format!("failed to fetch raw config: {}", key.as_ref()))?;
+            .context(format!("failed to fetch raw config: {}", key))?;
+        cache.insert(key.to_string(), value.clone());
 
         Ok(value)
     }
 
+    /// Returns the numbers of cache hits and misses of [`Sql::get_raw_config`]
+    /// since the creation of this object.
+    pub fn config_cache_stats(&self) -> (usize, usize) {
+        (
+            self.config_cache_hits.load(Ordering::Relaxed),
+            self.config_cache_misses.load(Ordering::Relaxed),
+        )
+    }
+
     pub async fn set_raw_config_int(&self, key: impl AsRef<str>, value: i32) -> Result<()> {
         self.set_raw_config(key, Some(&format!("{}", value))).await
     }
@@ -465,15 +583,130 @@ pub async fn get_raw_config_int64(&self, key: impl AsRef<str>) -> Result<Option<
     }
 }
 
+/// A database connection holding the write lock of [`Sql`].
+///
+/// Returned by [`Sql::get_write_conn`], the lock is released when it is dropped.
+pub struct WriteConnection<'a> {
+    conn: r2d2::PooledConnection<r2d2_sqlite::SqliteConnectionManager>,
+    _guard: MutexGuard<'a, ()>,
+}
+
+impl Deref for WriteConnection<'_> {
+    type Target = rusqlite::Connection;
+
+    fn deref(&self) -> &Self::Target {
+        &self.conn
+    }
+}
+
+impl DerefMut for WriteConnection<'_> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        &mut self.conn
+    }
+}
+
+/// Config key of the next [HousekeepingStep] while housekeeping is not finished.
+const HOUSEKEEPING_STEP_CFG: &str = "housekeeping_step";
+
+/// Number of blobdir entries checked between two yields to other tasks.
+const HOUSEKEEPING_BLOBS_CHUNK: usize = 100;
+
+/// Steps of [housekeeping], in the order they are run.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum HousekeepingStep {
+    DeleteExpiredMessages,
+    DeleteUnreferencedFiles,
+    StartEphemeralTimers,
+    PruneTombstones,
+    Optimize,
+}
+
+const HOUSEKEEPING_STEPS: [HousekeepingStep; 5] = [
+    HousekeepingStep::DeleteExpiredMessages,
+    HousekeepingStep::DeleteUnreferencedFiles,
+    HousekeepingStep::StartEphemeralTimers,
+    HousekeepingStep::PruneTombstones,
+    HousekeepingStep::Optimize,
+];
+
+/// Runs the housekeeping steps.
+///
+/// The index of the next step is stored in the database after each step,
+/// so housekeeping which was interrupted, e.g. because the app was killed,
+/// continues with the interrupted step the next time.
+/// Other tasks are not blocked for long, the steps yield regularly.
 pub async fn housekeeping(context: &Context) -> Result<()> {
-    if let Err(err) = crate::ephemeral::delete_expired_messages(context).await {
-        warn!(context, "Failed to delete expired messages: {}", err);
+    info!(context, "Start housekeeping...");
+    let first_step = context
+        .sql
+        .get_raw_config_int(HOUSEKEEPING_STEP_CFG)
+        .await?
+        .and_then(|step| usize::try_from(step).ok())
+        .filter(|step| *step < HOUSEKEEPING_STEPS.len())
+        .unwrap_or_default();
+
+    for (i, step) in HOUSEKEEPING_STEPS.iter().enumerate().skip(first_step) {
+        context
+            .sql
+            .set_raw_config_int(HOUSEKEEPING_STEP_CFG, i32::try_from(i)?)
+            .await?;
+        info!(context, "Housekeeping: {:?}", step);
+        match step {
+            HousekeepingStep::DeleteExpiredMessages => {
+                if let Err(err) = crate::ephemeral::delete_expired_messages(context).await {
+                    warn!(context, "Failed to delete expired messages: {}", err);
+                }
+            }
+            HousekeepingStep::DeleteUnreferencedFiles => {
+                delete_unreferenced_files(context).await?;
+            }
+            HousekeepingStep::StartEphemeralTimers => {
+                if let Err(err) = start_ephemeral_timers(context).await {
+                    warn!(
+                        context,
+                        "Housekeeping: cannot start ephemeral timers: {}", err
+                    );
+                }
+            }
+            HousekeepingStep::PruneTombstones => {
+                if let Err(err) = prune_tombstones(&context.sql).await {
+                    warn!(
+                        context,
+                        "Housekeeping: Cannot prune message tombstones: {}", err
+                    );
+                }
+            }
+            HousekeepingStep::Optimize => {
+                // Updates the statistics of the query planner if needed,
+                // this is cheap if nothing changed since the last run.
+                if let Err(err) = context.sql.execute("PRAGMA optimize;", paramsv![]).await {
+                    warn!(context, "Housekeeping: Cannot optimize database: {}", err);
+                }
+            }
+        }
+        async_std::task::yield_now().await;
+    }
+    context
+        .sql
+        .set_raw_config(HOUSEKEEPING_STEP_CFG, None)
+        .await?;
+
+    if let Err(e) = context
+        .set_config(Config::LastHousekeeping, Some(&time().to_string()))
+        .await
+    {
+        warn!(context, "Can't set config: {}", e);
     }
 
+    info!(context, "Housekeeping done.");
+    Ok(())
+}
+
+/// Deletes the files in the blobdir which are not referenced from the database.
+async fn delete_unreferenced_files(context: &Context) -> Result<()> {
     let mut files_in_use = HashSet::new();
     let mut unreferenced_count = 0;
 
-    info!(context, "Start housekeeping...");
     maybe_add_from_param(
         &context.sql,
         &mut files_in_use,
@@ -528,10 +761,15 @@ pub async fn housekeeping(context: &Context) -> Result<()> {
             let diff = std::time::Duration::from_secs(60 * 60);
             let keep_files_newer_than = std::time::SystemTime::now().checked_sub(diff).unwrap();
 
+            let mut checked_count = 0;
             while let Some(entry) = dir_handle.next().await {
                 if entry.is_err() {
                     break;
                 }
+                checked_count += 1;
+                if checked_count % HOUSEKEEPING_BLOBS_CHUNK == 0 {
+                    async_std::task::yield_now().await;
+                }
                 let entry = entry.unwrap();
                 let name_f = entry.file_name();
                 let name_s = name_f.to_string_lossy();
@@ -571,7 +809,16 @@ pub async fn housekeeping(context: &Context) -> Result<()> {
                     entry.file_name()
                 );
                 let path = entry.path();
-                dc_delete_file(context, path).await;
+                if dc_delete_file(context, path).await {
+                    context
+                        .sql
+                        .execute(
+                            "DELETE FROM blobs WHERE name=?;",
+                            paramsv![name_s.to_string()],
+                        )
+                        .await
+                        .ok();
+                }
             }
         }
         Err(err) => {
@@ -583,29 +830,6 @@ pub async fn housekeeping(context: &Context) -> Result<()> {
             );
         }
     }
-
-    if let Err(err) = start_ephemeral_timers(context).await {
-        warn!(
-            context,
-            "Housekeeping: cannot start ephemeral timers: {}", err
-        );
-    }
-
-    if let Err(err) = prune_tombstones(&context.sql).await {
-        warn!(
-            context,
-            "Housekeeping: Cannot prune message tombstones: {}", err
-        );
-    }
-
-    if let Err(e) = context
-        .set_config(Config::LastHousekeeping, Some(&time().to_string()))
-        .await
-    {
-        warn!(context, "Can't set config: {}", e);
-    }
-
-    info!(context, "Housekeeping done.");
     Ok(())
 }
 
@@ -719,6 +943,73 @@ async fn test_col_exists() {
         assert!(!t.ctx.sql.col_exists("foobar", "foobar").await.unwrap());
     }
 
+    #[async_std::test]
+    async fn test_write_conn_serializes_writes() -> Result<()> {
+        let t = TestContext::new().await;
+
+        let conn = t.sql.get_write_conn().await?;
+        conn.execute(
+            "INSERT INTO config (keyname, value) VALUES ('foo', 'bar');",
+            paramsv![],
+        )?;
+
+        // Other writers wait until the write connection is dropped.
+        let write = t.sql.set_raw_config("foo", Some("baz"));
+        assert!(
+            async_std::future::timeout(Duration::from_millis(100), write)
+                .await
+                .is_err()
+        );
+        // Readers do not.
+        assert!(
+            t.sql
+                .exists(
+                    "SELECT COUNT(*) FROM config WHERE keyname='foo';",
+                    paramsv![]
+                )
+                .await?
+        );
+        drop(conn);
+
+        t.sql.set_raw_config("foo", Some("baz")).await?;
+        assert_eq!(t.sql.get_raw_config("foo").await?, Some("baz".to_string()));
+        Ok(())
+    }
+
+    #[async_std::test]
+    async fn test_config_cache() -> Result<()> {
+        let t = TestContext::new().await;
+        let (hits, misses) = t.sql.config_cache_stats();
+
+        assert_eq!(t.sql.get_raw_config("foo").await?, None);
+        assert_eq!(t.sql.get_raw_config("foo").await?, None);
+        assert_eq!(t.sql.config_cache_stats(), (hits + 1, misses + 1));
+
+        // Writes update the cache.
+        t.sql.set_raw_config("foo", Some("bar")).await?;
+        assert_eq!(t.sql.get_raw_config("foo").await?, Some("bar".to_string()));
+        t.sql.set_raw_config_int("foo", 42).await?;
+        assert_eq!(t.sql.get_raw_config_int("foo").await?, Some(42));
+        assert_eq!(t.sql.config_cache_stats(), (hits + 3, misses + 1));
+
+        // Cached value matches the database.
+        let value: Option<String> = t
+            .sql
+            .query_get_value("SELECT value FROM config WHERE keyname=?;", paramsv!("foo"))
+            .await?;
+        assert_eq!(value, Some("42".to_string()));
+
+        // Closing the database drops the cache.
+        t.sql.close().await;
+        t.sql.open(&t, t.get_dbfile(), false).await?;
+        t.sql
+            .execute("DELETE FROM config WHERE keyname=?;", paramsv!("foo"))
+            .await?;
+        assert_eq!(t.sql.get_raw_config("foo").await?, None);
+
+        Ok(())
+    }
+
     #[async_std::test]
     async fn test_housekeeping_db_closed() {
         let t = TestContext::new().await;
@@ -759,6 +1050,40 @@ async fn test_housekeeping_db_closed() {
         assert_eq!(avatar_bytes, &async_std::fs::read(&a).await.unwrap()[..]);
     }
 
+    #[async_std::test]
+    async fn test_housekeeping_resume() -> Result<()> {
+        let t = TestContext::new().await;
+        t.sql
+            .execute(
+                "INSERT INTO msgs (chat_id, server_uid) VALUES (?, 0);",
+                paramsv![DC_CHAT_ID_TRASH],
+            )
+            .await?;
+
+        // Continue interrupted housekeeping with pruning tombstones.
+        let step = HOUSEKEEPING_STEPS
+            .iter()
+            .position(|step| *step == HousekeepingStep::PruneTombstones)
+            .unwrap();
+        t.sql
+            .set_raw_config_int(HOUSEKEEPING_STEP_CFG, step as i32)
+            .await?;
+        housekeeping(&t).await?;
+
+        assert_eq!(t.sql.get_raw_config(HOUSEKEEPING_STEP_CFG).await?, None);
+        assert!(t.get_config_i64(Config::LastHousekeeping).await? > 0);
+        let tombstones: i32 = t
+            .sql
+            .query_get_value(
+                "SELECT COUNT(*) FROM msgs WHERE chat_id=?;",
+                paramsv![DC_CHAT_ID_TRASH],
+            )
+            .await?
+            .unwrap_or_default();
+        assert_eq!(tombstones, 0);
+        Ok(())
+    }
+
     /// Regression test.
     ///
     /// Previously the code checking for existence of `config` table
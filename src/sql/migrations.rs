@@ -10,6 +10,8 @@
 
 const DBVERSION: i32 = 68;
 const VERSION_CFG: &str = "dbversion";
+const FTS_BACKFILL_CFG: &str = "fts_backfill_last_id";
+const FTS_BACKFILL_CHUNK: i64 = 5000;
 const TABLES: &str = include_str!("./tables.sql");
 
 pub async fn run(context: &Context, sql: &Sql) -> Result<(bool, bool, bool, bool)> {
@@ -468,6 +470,168 @@ pub async fn run(context: &Context, sql: &Sql) -> Result<(bool, bool, bool, bool
         recode_avatar = true;
         sql.set_db_version(77).await?;
     }
+    if dbversion < 78 {
+        info!(context, "[migration] v78");
+        // The trigram tokenizer allows substring search like `LIKE '%query%'` did before,
+        // but it needs SQLite 3.34 or newer compiled with FTS5.
+        // If the library does not support it, search falls back to `LIKE`.
+        let fts_created = sql
+            .transaction(move |transaction| {
+                transaction.execute_batch(
+                    r#"
+CREATE VIRTUAL TABLE IF NOT EXISTS msgs_fts USING fts5(
+  txt, subject,
+  content='msgs', content_rowid='id',
+  tokenize='trigram'
+);
+CREATE TRIGGER IF NOT EXISTS msgs_fts_insert AFTER INSERT ON msgs BEGIN
+  INSERT INTO msgs_fts(rowid, txt, subject) VALUES (new.id, new.txt, new.subject);
+END;
+CREATE TRIGGER IF NOT EXISTS msgs_fts_delete AFTER DELETE ON msgs BEGIN
+  INSERT INTO msgs_fts(msgs_fts, rowid, txt, subject) VALUES ('delete', old.id, old.txt, old.subject);
+END;
+CREATE TRIGGER IF NOT EXISTS msgs_fts_update AFTER UPDATE OF txt, subject ON msgs BEGIN
+  INSERT INTO msgs_fts(msgs_fts, rowid, txt, subject) VALUES ('delete', old.id, old.txt, old.subject);
+  INSERT INTO msgs_fts(rowid, txt, subject) VALUES (new.id, new.txt, new.subject);
+END;"#,
+                )?;
+                Ok(())
+            })
+            .await;
+        match fts_created {
+            Ok(()) => backfill_msgs_fts(context, sql).await?,
+            Err(err) => warn!(context, "Cannot create full-text search index: {:#}", err),
+        }
+        sql.set_db_version(78).await?;
+    }
+    if dbversion < 79 {
+        info!(context, "[migration] v79");
+        // Keep the last message of each chat in `chats`, so loading the chatlist
+        // does not need to look up the last message of every chat.
+        // 19 is MessageState::OutDraft, drafts are shown in the chatlist although hidden.
+        sql.execute_migration(
+            r#"
+ALTER TABLE chats ADD COLUMN last_msg_id INTEGER DEFAULT NULL;
+ALTER TABLE chats ADD COLUMN last_msg_timestamp INTEGER DEFAULT NULL;
+CREATE INDEX IF NOT EXISTS msgs_index8 ON msgs (chat_id, timestamp);
+UPDATE chats SET last_msg_id=(
+  SELECT id FROM msgs
+  WHERE chat_id=chats.id AND (hidden=0 OR state=19)
+  ORDER BY timestamp DESC, id DESC LIMIT 1
+) WHERE id>9;
+UPDATE chats SET last_msg_timestamp=(SELECT timestamp FROM msgs WHERE id=chats.last_msg_id) WHERE id>9;
+CREATE TRIGGER chats_last_msg_insert AFTER INSERT ON msgs WHEN new.chat_id>9 BEGIN
+  UPDATE chats SET last_msg_id=(
+    SELECT id FROM msgs
+    WHERE chat_id=chats.id AND (hidden=0 OR state=19)
+    ORDER BY timestamp DESC, id DESC LIMIT 1
+  ) WHERE id=new.chat_id;
+  UPDATE chats SET last_msg_timestamp=(SELECT timestamp FROM msgs WHERE id=chats.last_msg_id)
+  WHERE id=new.chat_id;
+END;
+CREATE TRIGGER chats_last_msg_delete AFTER DELETE ON msgs WHEN old.chat_id>9 BEGIN
+  UPDATE chats SET last_msg_id=(
+    SELECT id FROM msgs
+    WHERE chat_id=chats.id AND (hidden=0 OR state=19)
+    ORDER BY timestamp DESC, id DESC LIMIT 1
+  ) WHERE id=old.chat_id;
+  UPDATE chats SET last_msg_timestamp=(SELECT timestamp FROM msgs WHERE id=chats.last_msg_id)
+  WHERE id=old.chat_id;
+END;
+CREATE TRIGGER chats_last_msg_update AFTER UPDATE OF chat_id, timestamp, hidden, state ON msgs
+WHEN (old.chat_id>9 OR new.chat_id>9)
+  AND (old.chat_id IS NOT new.chat_id OR old.timestamp IS NOT new.timestamp
+       OR old.hidden IS NOT new.hidden OR (old.state=19) IS NOT (new.state=19))
+BEGIN
+  UPDATE chats SET last_msg_id=(
+    SELECT id FROM msgs
+    WHERE chat_id=chats.id AND (hidden=0 OR state=19)
+    ORDER BY timestamp DESC, id DESC LIMIT 1
+  ) WHERE id IN (old.chat_id, new.chat_id) AND id>9;
+  UPDATE chats SET last_msg_timestamp=(SELECT timestamp FROM msgs WHERE id=chats.last_msg_id)
+  WHERE id IN (old.chat_id, new.chat_id) AND id>9;
+END;"#,
+            79,
+        )
+        .await?;
+    }
+    if dbversion < 80 {
+        info!(context, "[migration] v80");
+        // Used by the ephemeral task to find the next message to delete.
+        sql.execute_migration(
+            "CREATE INDEX IF NOT EXISTS msgs_index9 ON msgs (ephemeral_timestamp);",
+            80,
+        )
+        .await?;
+    }
+    if dbversion < 81 {
+        info!(context, "[migration] v81");
+        // Index for searching contacts by their display name and address,
+        // see v78 for the requirements of the trigram tokenizer.
+        // The index is contentless, deletions pass the old values to FTS5.
+        let fts_created = sql
+            .transaction(move |transaction| {
+                transaction.execute_batch(
+                    r#"
+CREATE VIRTUAL TABLE IF NOT EXISTS contacts_fts USING fts5(
+  name, addr,
+  content='',
+  tokenize='trigram'
+);
+INSERT INTO contacts_fts(rowid, name, addr)
+  SELECT id, iif(name='',authname,name), addr FROM contacts;
+CREATE TRIGGER IF NOT EXISTS contacts_fts_insert AFTER INSERT ON contacts BEGIN
+  INSERT INTO contacts_fts(rowid, name, addr)
+  VALUES (new.id, iif(new.name='',new.authname,new.name), new.addr);
+END;
+CREATE TRIGGER IF NOT EXISTS contacts_fts_delete AFTER DELETE ON contacts BEGIN
+  INSERT INTO contacts_fts(contacts_fts, rowid, name, addr)
+  VALUES ('delete', old.id, iif(old.name='',old.authname,old.name), old.addr);
+END;
+CREATE TRIGGER IF NOT EXISTS contacts_fts_update AFTER UPDATE OF name, authname, addr ON contacts BEGIN
+  INSERT INTO contacts_fts(contacts_fts, rowid, name, addr)
+  VALUES ('delete', old.id, iif(old.name='',old.authname,old.name), old.addr);
+  INSERT INTO contacts_fts(rowid, name, addr)
+  VALUES (new.id, iif(new.name='',new.authname,new.name), new.addr);
+END;"#,
+                )?;
+                Ok(())
+            })
+            .await;
+        if let Err(err) = fts_created {
+            warn!(context, "Cannot create contact search index: {:#}", err);
+        }
+        sql.set_db_version(81).await?;
+    }
+    if dbversion < 82 {
+        info!(context, "[migration] v82");
+        // Received blobs by content hash and sanitised name, see `BlobObject::create_deduplicated()`.
+        sql.execute_migration(
+            r#"
+CREATE TABLE blobs (
+  hash TEXT NOT NULL,
+  basename TEXT NOT NULL,
+  name TEXT NOT NULL,
+  PRIMARY KEY (hash, basename)
+);
+CREATE INDEX blobs_index1 ON blobs (name);"#,
+            82,
+        )
+        .await?;
+    }
+    if dbversion < 83 {
+        info!(context, "[migration] v83");
+        // Range queries of `location::get_range()` and `location::get_kml()` filter by chat or
+        // sender and timestamp. The (from_id, timestamp) index replaces the one on from_id.
+        sql.execute_migration(
+            r#"
+DROP INDEX IF EXISTS locations_index1;
+CREATE INDEX locations_index3 ON locations (from_id, timestamp);
+CREATE INDEX locations_index4 ON locations (chat_id, timestamp);"#,
+            83,
+        )
+        .await?;
+    }
 
     Ok((
         recalc_fingerprints,
@@ -477,6 +641,55 @@ pub async fn run(context: &Context, sql: &Sql) -> Result<(bool, bool, bool, bool
     ))
 }
 
+/// Indexes the text of all existing messages in `msgs_fts`.
+///
+/// Messages are indexed in chunks, each in its own transaction, so large
+/// databases do not hold a write lock for a long time. The last indexed
+/// message ID is stored together with each chunk, so an interrupted
+/// migration continues where it stopped.
+async fn backfill_msgs_fts(context: &Context, sql: &Sql) -> Result<()> {
+    let mut last_id = sql
+        .get_raw_config_int64(FTS_BACKFILL_CFG)
+        .await?
+        .unwrap_or_default();
+    loop {
+        let chunk_end = sql
+            .transaction(move |transaction| {
+                let chunk_end: Option<i64> = transaction.query_row(
+                    "SELECT MAX(id) FROM (SELECT id FROM msgs WHERE id>? ORDER BY id LIMIT ?);",
+                    paramsv![last_id, FTS_BACKFILL_CHUNK],
+                    |row| row.get(0),
+                )?;
+                if let Some(chunk_end) = chunk_end {
+                    transaction.execute(
+                        "INSERT INTO msgs_fts(rowid, txt, subject) \
+                         SELECT id, txt, subject FROM msgs WHERE id>? AND id<=?;",
+                        paramsv![last_id, chunk_end],
+                    )?;
+                    transaction.execute(
+                        "DELETE FROM config WHERE keyname=?;",
+                        paramsv![FTS_BACKFILL_CFG],
+                    )?;
+                    transaction.execute(
+                        "INSERT INTO config (keyname, value) VALUES (?, ?);",
+                        paramsv![FTS_BACKFILL_CFG, chunk_end.to_string()],
+                    )?;
+                }
+                Ok(chunk_end)
+            })
+            .await?;
+        match chunk_end {
+            Some(chunk_end) => {
+                info!(context, "[migration] indexed messages up to {}", chunk_end);
+                last_id = chunk_end;
+            }
+            None => break,
+        }
+    }
+    sql.set_raw_config(FTS_BACKFILL_CFG, None).await?;
+    Ok(())
+}
+
 impl Sql {
     async fn set_db_version(&self, version: i32) -> Result<()> {
         self.set_raw_config_int(VERSION_CFG, version).await?;
@@ -496,6 +709,7 @@ async fn execute_migration(&self, query: &'static str, version: i32) -> Result<(
             Ok(())
         })
         .await?;
+        self.config_cache.write().await.remove(VERSION_CFG);
 
         Ok(())
     }
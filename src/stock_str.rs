@@ -874,6 +874,8 @@ pub async fn set_stock_translation(
             .write()
             .await
             .insert(id as usize, stockstring);
+        // Names of special chats and contacts are stock strings.
+        self.sql.read_cache.clear();
         Ok(())
     }
 